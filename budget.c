@@ -0,0 +1,286 @@
+/*-------------------------------------------------------------------------
+ *
+ * DuckDB Foreign Data Wrapper for PostgreSQL
+ *
+ * IDENTIFICATION
+ *        budget.c
+ *
+ * Cluster-wide DuckDB thread and memory budget.  Every backend runs its own
+ * embedded DuckDB, so nothing stops N backends from each starting a full
+ * thread pool and buffer manager.  When duckdb_fdw is loaded through
+ * shared_preload_libraries, backends reserve threads and memory from a pool
+ * in shared memory before running remote queries and inserts, wait (up to
+ * duckdb_fdw.budget_wait_timeout) while the pool is exhausted, and size
+ * their DuckDB connection to what they were granted.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "duckdb_fdw.h"
+
+#include "commands/defrem.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/guc.h"
+#include "utils/timestamp.h"
+
+/* Smallest memory grant, in MB, a query is degraded to */
+#define DUCKDB_BUDGET_MIN_MEMORY_MB	64
+
+typedef struct DuckDBBudgetShared
+{
+	slock_t		mutex;
+	int			threads_in_use;
+	int			memory_mb_in_use;
+	ConditionVariable cv;		/* signalled whenever budget is returned */
+} DuckDBBudgetShared;
+
+static DuckDBBudgetShared *budget = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* This backend's grant, shared by all of its concurrently running scans */
+static int	granted_threads = 0;
+static int	granted_memory_mb = 0;
+static int	grant_refcount = 0;
+
+static void
+duckdb_budget_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+	RequestAddinShmemSpace(MAXALIGN(sizeof(DuckDBBudgetShared)));
+}
+
+static void
+duckdb_budget_shmem_startup(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	budget = ShmemInitStruct("duckdb_fdw budget", sizeof(DuckDBBudgetShared), &found);
+	if (!found)
+	{
+		SpinLockInit(&budget->mutex);
+		budget->threads_in_use = 0;
+		budget->memory_mb_in_use = 0;
+		ConditionVariableInit(&budget->cv);
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+static void
+duckdb_budget_shmem_exit(int code, Datum arg)
+{
+	duckdb_budget_release_all();
+}
+
+/*
+ * Install the shared memory hooks.  Called from _PG_init; the budget is only
+ * available when the library is preloaded.
+ */
+void
+duckdb_budget_init(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = duckdb_budget_shmem_request;
+#else
+	duckdb_budget_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = duckdb_budget_shmem_startup;
+}
+
+/*
+ * Threads and memory a query on this server asks for: the configured
+ * threads/memory_limit if any, otherwise a quarter of the cluster budget.
+ */
+static void
+duckdb_budget_wanted(ForeignServer *server, int *threads, int *memory_mb)
+{
+	const char *thread_opt = NULL;
+	const char *memory_opt = duckdb_fdw_memory_limit;
+	ListCell   *lc;
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "threads") == 0)
+			thread_opt = defGetString(def);
+		else if (strcmp(def->defname, "memory_limit") == 0)
+			memory_opt = defGetString(def);
+	}
+
+	if (thread_opt != NULL)
+		*threads = atoi(thread_opt);
+	else if (duckdb_fdw_threads > 0)
+		*threads = duckdb_fdw_threads;
+	else
+		*threads = Max(duckdb_fdw_cluster_threads / 4, 1);
+
+	if (memory_opt == NULL || memory_opt[0] == '\0' ||
+		!parse_int(memory_opt, memory_mb, GUC_UNIT_MB, NULL) || *memory_mb <= 0)
+		*memory_mb = Max(duckdb_fdw_cluster_memory_limit / 4,
+						 DUCKDB_BUDGET_MIN_MEMORY_MB);
+}
+
+/*
+ * Apply this backend's grant to a DuckDB connection.
+ */
+static void
+duckdb_budget_apply(duckdb_connection conn)
+{
+	if (granted_threads > 0)
+	{
+		char	   *sql = psprintf("SET threads = %d", granted_threads);
+
+		duckdb_do_sql_command(conn, sql, ERROR);
+		pfree(sql);
+	}
+	if (granted_memory_mb > 0)
+	{
+		char	   *sql = psprintf("SET memory_limit = '%dMB'", granted_memory_mb);
+
+		duckdb_do_sql_command(conn, sql, ERROR);
+		pfree(sql);
+	}
+}
+
+/*
+ * Reserve budget for a remote query, insert or duckdb_execute() call about
+ * to run on conn.  Work running concurrently in one backend shares the
+ * first grant.  If the pool stays exhausted past
+ * duckdb_fdw.budget_wait_timeout, the query fails rather than exceed the
+ * cluster limits.
+ */
+void
+duckdb_budget_acquire(duckdb_connection conn, ForeignServer *server)
+{
+	int			want_threads;
+	int			want_memory_mb;
+	TimestampTz start;
+	static bool exit_callback_registered = false;
+
+	if (budget == NULL ||
+		(duckdb_fdw_cluster_threads <= 0 && duckdb_fdw_cluster_memory_limit <= 0))
+		return;
+
+	if (grant_refcount > 0)
+	{
+		grant_refcount++;
+		duckdb_budget_apply(conn);
+		return;
+	}
+
+	if (!exit_callback_registered)
+	{
+		before_shmem_exit(duckdb_budget_shmem_exit, (Datum) 0);
+		exit_callback_registered = true;
+	}
+
+	duckdb_budget_wanted(server, &want_threads, &want_memory_mb);
+	start = GetCurrentTimestamp();
+
+	for (;;)
+	{
+		int			avail_threads;
+		int			avail_memory_mb;
+		int			min_memory_mb = Min(want_memory_mb, DUCKDB_BUDGET_MIN_MEMORY_MB);
+		bool		fits;
+
+		SpinLockAcquire(&budget->mutex);
+		avail_threads = duckdb_fdw_cluster_threads - budget->threads_in_use;
+		avail_memory_mb = duckdb_fdw_cluster_memory_limit - budget->memory_mb_in_use;
+		fits = (duckdb_fdw_cluster_threads <= 0 || avail_threads >= 1) &&
+			(duckdb_fdw_cluster_memory_limit <= 0 || avail_memory_mb >= min_memory_mb);
+
+		if (fits)
+		{
+			if (duckdb_fdw_cluster_threads > 0)
+				granted_threads = Max(Min(want_threads, avail_threads), 1);
+			if (duckdb_fdw_cluster_memory_limit > 0)
+				granted_memory_mb = Max(Min(want_memory_mb, avail_memory_mb), min_memory_mb);
+			budget->threads_in_use += granted_threads;
+			budget->memory_mb_in_use += granted_memory_mb;
+			SpinLockRelease(&budget->mutex);
+			break;
+		}
+		SpinLockRelease(&budget->mutex);
+
+		if (duckdb_fdw_budget_wait_timeout >= 0)
+		{
+			long		elapsed = TimestampDifferenceMilliseconds(start, GetCurrentTimestamp());
+
+			if (elapsed >= duckdb_fdw_budget_wait_timeout)
+			{
+				ConditionVariableCancelSleep();
+				ereport(ERROR,
+						(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+						 errmsg("duckdb_fdw: cluster DuckDB budget stayed exhausted for %d ms",
+								duckdb_fdw_budget_wait_timeout),
+						 errhint("Raise duckdb_fdw.budget_wait_timeout, duckdb_fdw.cluster_threads or duckdb_fdw.cluster_memory_limit.")));
+			}
+			(void) ConditionVariableTimedSleep(&budget->cv,
+											   duckdb_fdw_budget_wait_timeout - elapsed,
+											   duckdb_wait_event(DUCKDB_WAIT_BUDGET));
+		}
+		else
+			ConditionVariableSleep(&budget->cv, duckdb_wait_event(DUCKDB_WAIT_BUDGET));
+	}
+	ConditionVariableCancelSleep();
+
+	grant_refcount = 1;
+	duckdb_budget_apply(conn);
+}
+
+/*
+ * Drop one reference to this backend's grant, returning it to the pool when
+ * the last scan using it ends.
+ */
+void
+duckdb_budget_release(void)
+{
+	if (grant_refcount == 0)
+		return;
+	if (--grant_refcount == 0)
+		duckdb_budget_release_all();
+}
+
+/*
+ * Return this backend's whole grant; used at transaction end, where scans
+ * aborted by an error never reached EndForeignScan, and at process exit.
+ */
+void
+duckdb_budget_release_all(void)
+{
+	grant_refcount = 0;
+	if (budget == NULL || (granted_threads == 0 && granted_memory_mb == 0))
+		return;
+
+	SpinLockAcquire(&budget->mutex);
+	budget->threads_in_use -= granted_threads;
+	budget->memory_mb_in_use -= granted_memory_mb;
+	SpinLockRelease(&budget->mutex);
+	granted_threads = 0;
+	granted_memory_mb = 0;
+
+	ConditionVariableBroadcast(&budget->cv);
+}
@@ -1,49 +1,370 @@
 #include "postgres.h"
 #include "duckdb_fdw.h"
+
+#include <ctype.h>
+
 #include "miscadmin.h"
 #include "access/xact.h"
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
 #include "catalog/pg_foreign_server.h"
 #include "utils/syscache.h"
+#include "utils/inval.h"
 #include "commands/defrem.h"
+#include "nodes/makefuncs.h"
 #include "lib/stringinfo.h"
+#include "lib/ilist.h"
+#include "pgstat.h"
+#include "storage/latch.h"
+#include "access/htup_details.h"
+#include "common/hashfn.h"
 
 typedef Oid ConnCacheKey;
 
+/*
+ * One connection of a server's pool.  Prepared statements are bound to the
+ * connection that prepared them, so each has its own statement cache.
+ */
+typedef struct PooledConn
+{
+	duckdb_connection conn;
+	dlist_head	stmt_cache;		/* PreparedStmtEntry list, most recent first */
+	int			stmt_cache_len;
+	int			leases;			/* scans and modifies currently using conn */
+} PooledConn;
+
 typedef struct ConnCacheEntry
 {
 	ConnCacheKey key;
 	duckdb_database db;
-	duckdb_connection conn;
+	duckdb_connection conn;		/* primary connection, first in pool */
+	List	   *pool;			/* PooledConn list, in CacheMemoryContext */
+	int			nleases;		/* sum of leases over pool */
+	bool		read_only;		/* database was opened READ_ONLY */
+	List	   *attached;		/* attach_catalogs aliases ATTACHed so far */
+	List	   *appenders;		/* XactAppenders of the current transaction */
+	duckdb_connection xact_conn;	/* runs the transaction's inserts, or NULL */
+	SubTransactionId xact_subid;	/* subtransaction that opened xact_conn */
+	SubTransactionId xact_used_subid;	/* latest subtransaction using it */
+	char	   *dbpath;			/* database file opened, in CacheMemoryContext */
+	Oid			userid;			/* user whose mapping opened the database */
+	bool		keep;			/* keep_connections: survive transaction end */
+	bool		invalidated;	/* server or user mapping changed since open */
+	uint32		server_hashvalue;	/* syscache hash of the server's OID */
 } ConnCacheEntry;
 
+/*
+ * An appender kept open for the rest of the transaction, so a run of
+ * INSERT statements into one foreign table shares it.  It appends on the
+ * server's transaction connection, so its rows commit or roll back with the
+ * PostgreSQL transaction.
+ */
+typedef struct XactAppender
+{
+	Oid			relid;			/* foreign table appended to */
+	char	   *table;			/* its table option, for messages */
+	duckdb_appender appender;
+} XactAppender;
+
+/*
+ * One catalog of a server's attach_catalogs: its alias and the commands
+ * that attach it, loading the extension its type needs first.
+ */
+typedef struct DuckDBCatalog
+{
+	char	   *alias;
+	List	   *cmds;
+} DuckDBCatalog;
+
+/*
+ * A prepared statement cached on a connection, keyed by its SQL text.  A
+ * statement is leased to one scan at a time; a second scan running the same
+ * SQL concurrently gets a private, uncached statement.
+ */
+typedef struct PreparedStmtEntry
+{
+	dlist_node	node;
+	uint32		hash;
+	char	   *sql;
+	duckdb_prepared_statement stmt;
+	bool		in_use;
+} PreparedStmtEntry;
+
 static HTAB *ConnectionHash = NULL;
 static bool ConnectionXactCallbackRegistered = false;
 
+/* A rollback to a savepoint discarded inserts made before the savepoint */
+static bool xact_inserts_lost = false;
+
+/* Backend-lifetime prepared statement cache counters */
+static uint64 stmt_cache_hits = 0;
+static uint64 stmt_cache_misses = 0;
+static uint64 stmt_cache_evictions = 0;
+
+static PooledConn *duckdb_find_pooled_connection(duckdb_connection conn, ConnCacheEntry **entry);
+static void duckdb_discard_xact_appenders(ConnCacheEntry *entry);
+static void duckdb_flush_entry_appenders(ConnCacheEntry *entry, bool close);
+static List *duckdb_server_catalogs(ForeignServer *server);
+
+static void
+duckdb_stmt_cache_remove(PooledConn *pconn, PreparedStmtEntry *pentry)
+{
+	dlist_delete(&pentry->node);
+	pconn->stmt_cache_len--;
+	duckdb_destroy_prepare(&pentry->stmt);
+	pfree(pentry->sql);
+	pfree(pentry);
+}
+
+static void
+duckdb_stmt_cache_reset(PooledConn *pconn)
+{
+	dlist_mutable_iter iter;
+
+	dlist_foreach_modify(iter, &pconn->stmt_cache)
+	{
+		PreparedStmtEntry *pentry = dlist_container(PreparedStmtEntry, node, iter.cur);
+
+		duckdb_stmt_cache_remove(pconn, pentry);
+	}
+}
+
+static void
+duckdb_setup_connection(duckdb_connection conn)
+{
+	/* duckdb_query_progress() only reports while the progress bar is on */
+	if (duckdb_progress_enabled())
+		duckdb_do_sql_command(conn,
+							  "SET enable_progress_bar = true; SET enable_progress_bar_print = false;",
+							  ERROR);
+}
+
+static PooledConn *
+duckdb_add_pooled_connection(ConnCacheEntry *entry, duckdb_connection conn)
+{
+	PooledConn *pconn = MemoryContextAllocZero(CacheMemoryContext, sizeof(PooledConn));
+	MemoryContext oldcxt;
+
+	pconn->conn = conn;
+	dlist_init(&pconn->stmt_cache);
+	duckdb_setup_connection(conn);
+
+	oldcxt = MemoryContextSwitchTo(CacheMemoryContext);
+	entry->pool = lappend(entry->pool, pconn);
+	MemoryContextSwitchTo(oldcxt);
+	return pconn;
+}
+
+static void
+duckdb_close_connection_entry(ConnCacheEntry *entry)
+{
+	ListCell   *lc;
+
+	/* After commit nothing is left to flush; after an abort it is dropped */
+	duckdb_discard_xact_appenders(entry);
+	if (entry->xact_conn != NULL)
+	{
+		/* Disconnecting rolls back the inserts it did not commit */
+		duckdb_disconnect(&entry->xact_conn);
+		entry->xact_conn = NULL;
+	}
+
+	foreach(lc, entry->pool)
+	{
+		PooledConn *pconn = (PooledConn *) lfirst(lc);
+
+		/* Prepared statements belong to the connection being closed */
+		duckdb_stmt_cache_reset(pconn);
+		duckdb_disconnect(&pconn->conn);
+		pfree(pconn);
+	}
+	list_free(entry->pool);
+	entry->pool = NIL;
+	entry->conn = NULL;
+	entry->nleases = 0;
+	if (entry->db)
+	{
+		duckdb_close(&entry->db);
+		entry->db = NULL;
+	}
+	entry->read_only = false;
+	list_free_deep(entry->attached);
+	entry->attached = NIL;
+	if (entry->dbpath)
+	{
+		pfree(entry->dbpath);
+		entry->dbpath = NULL;
+	}
+	entry->userid = InvalidOid;
+	entry->invalidated = false;
+}
+
+/*
+ * Close the servers' databases at transaction end.  With all_entries false
+ * (a commit), databases whose connections hold no transaction state any
+ * more stay open with their prepared statements, unless the server sets
+ * keep_connections to false or was altered meanwhile.
+ */
+static void
+duckdb_cleanup_connection_cache(bool all_entries)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (ConnectionHash == NULL)
+		return;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+	{
+		if (all_entries || !entry->keep || entry->invalidated ||
+			entry->nleases > 0 || entry->xact_conn != NULL ||
+			entry->appenders != NIL)
+			duckdb_close_connection_entry(entry);
+	}
+}
+
+/*
+ * Server or user mapping changes: reopen the affected databases once they
+ * are idle, so new options and credentials take effect.
+ */
+static void
+duckdb_connection_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	(void) arg;
+
+	if (ConnectionHash == NULL)
+		return;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+	{
+		if (entry->db == NULL)
+			continue;
+		/* User mappings are keyed by their own OID: invalidate them all */
+		if (hashvalue == 0 || cacheid == USERMAPPINGOID ||
+			entry->server_hashvalue == hashvalue)
+			entry->invalidated = true;
+	}
+}
+
+/*
+ * Whether the server keeps its database open across transactions
+ * (keep_connections, default true).
+ */
+static bool
+duckdb_server_keeps_connections(ForeignServer *server)
+{
+	ListCell   *lc;
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "keep_connections") == 0)
+			return defGetBoolean(def);
+	}
+	return true;
+}
+
+/*
+ * DuckDB locks a database file for the process that opened it, so close
+ * idle databases of other servers on the same file before opening it again.
+ */
+static void
+duckdb_close_idle_entries_for(const char *dbpath, Oid serverid)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (dbpath == NULL || dbpath[0] == '\0' || strcmp(dbpath, ":memory:") == 0)
+		return;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+	{
+		if (entry->key != serverid && entry->db != NULL &&
+			entry->dbpath != NULL && strcmp(entry->dbpath, dbpath) == 0 &&
+			entry->nleases == 0 && entry->xact_conn == NULL &&
+			entry->appenders == NIL)
+			duckdb_close_connection_entry(entry);
+	}
+}
+
+/*
+ * Close the transaction appenders of every server and commit the DuckDB
+ * transactions holding the inserts.
+ */
 static void
-duckdb_cleanup_connection_cache(void)
+duckdb_commit_xact_connections(void)
 {
 	HASH_SEQ_STATUS scan;
 	ConnCacheEntry *entry;
 
+	if (xact_inserts_lost)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("duckdb_fdw: cannot commit inserts into DuckDB foreign tables after rolling back to a savepoint"),
+				 errdetail("DuckDB has no savepoints, so the rollback discarded the transaction's earlier inserts too.")));
+
+	duckdb_host_commit_sessions();
+
 	if (ConnectionHash == NULL)
 		return;
 
 	hash_seq_init(&scan, ConnectionHash);
 	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
 	{
-		if (entry->conn)
+		PG_TRY();
+		{
+			duckdb_flush_entry_appenders(entry, true);
+			if (entry->xact_conn != NULL)
+			{
+				duckdb_do_sql_command(entry->xact_conn, "COMMIT", ERROR);
+				duckdb_disconnect(&entry->xact_conn);
+				entry->xact_conn = NULL;
+			}
+		}
+		PG_CATCH();
 		{
-			duckdb_disconnect(&entry->conn);
-			entry->conn = NULL;
+			hash_seq_term(&scan);
+			PG_RE_THROW();
 		}
-		if (entry->db)
+		PG_END_TRY();
+	}
+}
+
+/*
+ * Refuse to prepare a transaction that inserted into DuckDB: its DuckDB
+ * transaction cannot outlive the session.
+ */
+static void
+duckdb_prepare_xact_connections(void)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+	bool		inserted = xact_inserts_lost || duckdb_host_in_transaction();
+
+	if (ConnectionHash != NULL && !inserted)
+	{
+		hash_seq_init(&scan, ConnectionHash);
+		while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
 		{
-			duckdb_close(&entry->db);
-			entry->db = NULL;
+			if (entry->xact_conn != NULL)
+			{
+				hash_seq_term(&scan);
+				inserted = true;
+				break;
+			}
 		}
 	}
+	if (inserted)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("duckdb_fdw: cannot prepare a transaction that inserted into DuckDB foreign tables")));
 }
 
 static void
@@ -53,11 +374,25 @@ duckdb_connection_xact_callback(XactEvent event, void *arg)
 
 	switch (event)
 	{
+		case XACT_EVENT_PRE_COMMIT:
+		case XACT_EVENT_PARALLEL_PRE_COMMIT:
+			/* Inserts DuckDB refuses fail the commit rather than vanish after it */
+			duckdb_commit_xact_connections();
+			break;
+		case XACT_EVENT_PRE_PREPARE:
+			duckdb_prepare_xact_connections();
+			break;
 		case XACT_EVENT_COMMIT:
 		case XACT_EVENT_ABORT:
 		case XACT_EVENT_PARALLEL_COMMIT:
 		case XACT_EVENT_PARALLEL_ABORT:
-			duckdb_cleanup_connection_cache();
+			xact_inserts_lost = false;
+			duckdb_cleanup_connection_cache(event == XACT_EVENT_ABORT ||
+											event == XACT_EVENT_PARALLEL_ABORT);
+			duckdb_budget_release_all();
+			duckdb_progress_end();
+			if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+				duckdb_host_abort_sessions();
 			break;
 		default:
 			break;
@@ -69,18 +404,39 @@ duckdb_connection_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
 									SubTransactionId parentSubid, void *arg)
 {
 	(void) arg;
-	(void) mySubid;
 	(void) parentSubid;
 
 	/*
-	 * On subtransaction abort, clean up cached connections so that any
-	 * in-progress DuckDB state from the aborted subtransaction is discarded.
-	 * This is conservative (clears all connections, not just those created
-	 * in the subtransaction) but avoids leaking DuckDB internal state into
-	 * the parent transaction.
+	 * DuckDB has no savepoints, so a subtransaction abort cannot undo just
+	 * the subtransaction's work.  A transaction connection the subtransaction
+	 * never used holds none of it and stays open.  Every other connection is
+	 * closed, which discards in-progress DuckDB state and rolls back the
+	 * whole transaction's inserts.  Inserts from inside the subtransaction
+	 * were meant to go; if some predate it, remember that the commit would
+	 * now silently lose them and make it fail instead.
 	 */
 	if (event == SUBXACT_EVENT_ABORT_SUB)
-		duckdb_cleanup_connection_cache();
+	{
+		if (ConnectionHash != NULL)
+		{
+			HASH_SEQ_STATUS scan;
+			ConnCacheEntry *entry;
+
+			hash_seq_init(&scan, ConnectionHash);
+			while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+			{
+				/* Subtransactions started later are descendants of mySubid */
+				if (entry->xact_conn != NULL && entry->xact_used_subid < mySubid)
+					continue;
+				if (entry->xact_conn != NULL && entry->xact_subid < mySubid)
+					xact_inserts_lost = true;
+				duckdb_close_connection_entry(entry);
+			}
+		}
+		if (duckdb_host_abort_subxact(mySubid))
+			xact_inserts_lost = true;
+		duckdb_progress_end();
+	}
 }
 
 static void
@@ -104,26 +460,95 @@ append_endpoint_clause(StringInfo sql, const char *s3_endpoint, const char *s3_r
 	}
 }
 
-static void
-install_extension_if_valid(duckdb_connection conn, const char *ext_name)
+/*
+ * SQL that installs an extension, from repository if given, and loads it.
+ * Without allow_install it only loads, so the extension must already be in
+ * the extension directory.  duckdb_setup_command_sql skips the INSTALL of
+ * extensions that are installed already.
+ */
+static char *
+duckdb_extension_sql(const char *ext_name, const char *repository, bool allow_install)
 {
-	char	   *ext_lit;
+	char	   *ext_lit = duckdb_fdw_quote_literal(ext_name);
 	char	   *sql;
 
+	if (!allow_install)
+		sql = psprintf("LOAD %s;", ext_lit);
+	else if (repository)
+		sql = psprintf("INSTALL %s FROM %s; LOAD %s;", ext_lit, repository, ext_lit);
+	else
+		sql = psprintf("INSTALL %s; LOAD %s;", ext_lit, ext_lit);
+	pfree(ext_lit);
+	return sql;
+}
+
+static void
+install_extension_if_valid(List **cmds, const char *ext_name, bool allow_install)
+{
 	if (!duckdb_fdw_is_valid_identifier(ext_name))
 		ereport(ERROR,
 				(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
 				 errmsg("invalid extension name \"%s\"", ext_name)));
 
-	ext_lit = duckdb_fdw_quote_literal(ext_name);
-	sql = psprintf("INSTALL %s; LOAD %s;", ext_lit, ext_lit);
-	duckdb_do_sql_command(conn, sql, ERROR);
-	pfree(ext_lit);
+	*cmds = lappend(*cmds, duckdb_extension_sql(ext_name, NULL, allow_install));
+}
+
+/*
+ * Whether the server may download extensions (allow_extension_install,
+ * default true).
+ */
+static bool
+duckdb_server_allows_extension_install(ForeignServer *server)
+{
+	ListCell   *lc;
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "allow_extension_install") == 0)
+			return defGetBoolean(def);
+	}
+	return true;
+}
+
+/*
+ * The part of a setup command that still has to run on conn.  Extension
+ * setup drops its INSTALL when duckdb_extensions() lists the extension as
+ * installed, so opening a connection needs no network access once the
+ * extension directory is populated.  Uses plain DuckDB calls only, as the
+ * host worker runs setup commands too.
+ */
+const char *
+duckdb_setup_command_sql(duckdb_connection conn, const char *cmd)
+{
+	const char *name;
+	const char *name_end;
+	const char *load;
+	char	   *sql;
+	duckdb_result res;
+	bool		installed = false;
+
+	if (strncmp(cmd, "INSTALL '", 9) != 0 || (load = strstr(cmd, "; LOAD ")) == NULL)
+		return cmd;
+	name = cmd + 9;
+	name_end = strchr(name, '\'');
+	if (name_end == NULL)
+		return cmd;
+
+	/* Extension names were checked by duckdb_fdw_is_valid_identifier */
+	sql = psprintf("SELECT installed FROM duckdb_extensions() WHERE extension_name = '%.*s'",
+				   (int) (name_end - name), name);
+	if (duckdb_query(conn, sql, &res) == DuckDBSuccess && duckdb_row_count(&res) > 0)
+		installed = duckdb_value_boolean(&res, 0, 0);
+	duckdb_destroy_result(&res);
 	pfree(sql);
+
+	return installed ? load + 2 : cmd;
 }
 
 static void
-duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *server)
+duckdb_collect_setup_commands(List **cmds, ForeignServer *server, bool with_catalogs)
 {
     char *s3_region = NULL;
     char *s3_access_key = NULL;
@@ -131,8 +556,10 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
     char *s3_endpoint = NULL;
     bool s3_use_ssl = true;
     char *extensions = NULL;
-    char *attach_catalogs = NULL;
     char *motherduck_token = NULL;
+    char *disk_cache_directory = NULL;
+    int disk_cache_max_size;
+    bool allow_install = duckdb_server_allows_extension_install(server);
     ListCell *lc;
     Oid userid = GetUserId();
 
@@ -166,31 +593,32 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
         else if (strcmp(def->defname, "s3_endpoint") == 0) s3_endpoint = defGetString(def);
         else if (strcmp(def->defname, "s3_use_ssl") == 0) s3_use_ssl = defGetBoolean(def);
         else if (strcmp(def->defname, "extensions") == 0) extensions = defGetString(def);
-        else if (strcmp(def->defname, "attach_catalogs") == 0) attach_catalogs = defGetString(def);
         else if (strcmp(def->defname, "motherduck_token") == 0 && motherduck_token == NULL)
             motherduck_token = defGetString(def);
     }
 
-    /* 2. Intelligent Extension Autoloading */
-    {
-        bool need_httpfs = (s3_access_key != NULL);
-        bool need_iceberg = false;
-        bool need_motherduck = (motherduck_token != NULL);
+    (void) duckdb_server_disk_cache(server, &disk_cache_directory, &disk_cache_max_size);
 
-        if (attach_catalogs)
+    /*
+     * 2. Extensions.  DuckDB's autoload_known_extensions loads httpfs,
+     * iceberg, ducklake and motherduck when a secret, path or ATTACH first
+     * needs them, so only the ones the server asks for are loaded here.
+     */
+    {
+        /*
+         * cache_httpfs wraps httpfs, so every remote read goes through the
+         * on-disk cache.  A community extension is never autoloaded, and its
+         * settings must be in place before the first read.
+         */
+        if (disk_cache_directory)
         {
-            /* DuckLake resource types are handled by the 'iceberg' extension */
-            if (strstr(attach_catalogs, "type=iceberg") || strstr(attach_catalogs, "type=ducklake"))
-            {
-                need_iceberg = true;
-                need_httpfs = true;
-            }
-        }
+            char *dir_lit = duckdb_fdw_quote_literal(disk_cache_directory);
 
-        /* Use ERROR level to ensure user sees why extension loading fails */
-        if (need_httpfs) duckdb_do_sql_command(conn, "INSTALL 'httpfs'; LOAD 'httpfs';", ERROR);
-        if (need_iceberg) duckdb_do_sql_command(conn, "INSTALL 'iceberg'; LOAD 'iceberg';", ERROR);
-        if (need_motherduck) duckdb_do_sql_command(conn, "INSTALL 'motherduck'; LOAD 'motherduck';", ERROR);
+            *cmds = lappend(*cmds, duckdb_extension_sql("cache_httpfs", "community", allow_install));
+            *cmds = lappend(*cmds, psprintf("SET cache_httpfs_type = 'on_disk'; "
+                                            "SET cache_httpfs_cache_directory = %s;", dir_lit));
+            pfree(dir_lit);
+        }
 
 	        /* Also load any manually specified extensions */
 		        if (extensions)
@@ -206,8 +634,7 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
 		                    token = duckdb_fdw_next_token(NULL, ",", &saveptr);
 		                    continue;
 		                }
-		                if (strcmp(trimmed, "httpfs") != 0 && strcmp(trimmed, "iceberg") != 0)
-		                    install_extension_if_valid(conn, trimmed);
+		                install_extension_if_valid(cmds, trimmed, allow_install);
 		                token = duckdb_fdw_next_token(NULL, ",", &saveptr);
 		            }
 		            pfree(ext_copy);
@@ -237,7 +664,7 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
 				pfree(endpoint_lit);
 			}
 	        appendStringInfo(&sql, "USE_SSL %s );", s3_use_ssl ? "true" : "false");
-	        duckdb_do_sql_command(conn, sql.data, ERROR);
+	        *cmds = lappend(*cmds, pstrdup(sql.data));
 			pfree(key_lit);
 			pfree(secret_lit);
 			pfree(sql.data);
@@ -251,12 +678,39 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
         initStringInfo(&sql);
         appendStringInfo(&sql, "CREATE OR REPLACE SECRET pg_duck_md "
                          "( TYPE MOTHERDUCK, TOKEN %s );", token_lit);
-        duckdb_do_sql_command(conn, sql.data, ERROR);
+        *cmds = lappend(*cmds, pstrdup(sql.data));
         pfree(token_lit);
         pfree(sql.data);
     }
 
-    /* 5. Catalogs (Auto ATTACH) */
+    /* 5. Catalogs; backends attach them on first reference instead */
+    if (with_catalogs)
+    {
+        foreach(lc, duckdb_server_catalogs(server))
+            *cmds = list_concat(*cmds, ((DuckDBCatalog *) lfirst(lc))->cmds);
+    }
+}
+
+/*
+ * Parse the server's attach_catalogs into DuckDBCatalogs, in option order.
+ */
+static List *
+duckdb_server_catalogs(ForeignServer *server)
+{
+    char *s3_region = NULL;
+    char *s3_endpoint = NULL;
+    char *attach_catalogs = NULL;
+    List *catalogs = NIL;
+    ListCell *lc;
+
+    foreach(lc, server->options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
+        if (strcmp(def->defname, "s3_region") == 0) s3_region = defGetString(def);
+        else if (strcmp(def->defname, "s3_endpoint") == 0) s3_endpoint = defGetString(def);
+        else if (strcmp(def->defname, "attach_catalogs") == 0) attach_catalogs = defGetString(def);
+    }
+
 	    if (attach_catalogs)
 	    {
 	        char *at_copy = pstrdup(attach_catalogs);
@@ -269,6 +723,8 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
 	            if (uri)
 	            {
 	                char *options = NULL;
+	                char *attach = NULL;
+	                DuckDBCatalog *catalog;
 	                *uri = '\0';
 	                uri = duckdb_fdw_trim_token(uri + 1);
 
@@ -317,7 +773,7 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
 
 	                        appendStringInfoString(&sql, ");");
 
-	                        duckdb_do_sql_command(conn, sql.data, ERROR);
+	                        attach = pstrdup(sql.data);
 							pfree(uri_lit);
 							pfree(name_id);
 	                        pfree(sql.data);
@@ -338,7 +794,7 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
 							name_id = duckdb_fdw_quote_identifier(name);
 							initStringInfo(&sql);
 							appendStringInfo(&sql, "ATTACH %s AS %s (%s);", uri_lit, name_id, options);
-	                        duckdb_do_sql_command(conn, sql.data, ERROR);
+	                        attach = pstrdup(sql.data);
 							pfree(uri_lit);
 							pfree(name_id);
 							pfree(sql.data);
@@ -366,7 +822,7 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
 
 	                        appendStringInfoString(&sql, ");");
 
-	                        duckdb_do_sql_command(conn, sql.data, ERROR);
+	                        attach = pstrdup(sql.data);
 							pfree(uri_lit);
 							pfree(name_id);
 	                        pfree(sql.data);
@@ -387,25 +843,220 @@ duckdb_setup_secrets_and_extensions(duckdb_connection conn, ForeignServer *serve
 							name_id = duckdb_fdw_quote_identifier(name);
 							initStringInfo(&sql);
 							appendStringInfo(&sql, "ATTACH %s AS %s;", uri_lit, name_id);
-	                        duckdb_do_sql_command(conn, sql.data, ERROR);
+	                        attach = pstrdup(sql.data);
 							pfree(uri_lit);
 							pfree(name_id);
 							pfree(sql.data);
 	                    }
 	                }
+
+	                catalog = palloc0(sizeof(DuckDBCatalog));
+	                catalog->alias = pstrdup(name);
+	                /* ATTACH autoloads the extension of the catalog's TYPE */
+	                catalog->cmds = lappend(catalog->cmds, attach);
+	                catalogs = lappend(catalogs, catalog);
 	            }
 	            token = duckdb_fdw_next_token(NULL, ",", &saveptr);
 	        }
 	        pfree(at_copy);
 	    }
+    return catalogs;
+}
+
+/*
+ * Set one DuckDB configuration option, reporting DuckDB's rejection as an
+ * option error.
+ */
+static void
+duckdb_set_config_option(duckdb_config config, const char *name, const char *value)
+{
+	if (duckdb_set_config(config, name, value) == DuckDBError)
+	{
+		duckdb_destroy_config(&config);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+				 errmsg("invalid DuckDB setting \"%s\" = \"%s\"", name, value)));
+	}
+}
+
+/*
+ * SQL commands that prepare a freshly opened DuckDB for a server: extension
+ * loading, secrets and catalog attachment, in the order they must run.  The
+ * shared host attaches every catalog up front; backends leave them to
+ * duckdb_attach_catalogs.
+ */
+List *
+duckdb_server_setup_commands(ForeignServer *server)
+{
+	List	   *cmds = NIL;
+
+	duckdb_collect_setup_commands(&cmds, server, true);
+	return cmds;
+}
+
+/*
+ * Engine settings for a server as a list of DefElems with string values:
+ * server options override the duckdb_fdw.* GUC defaults, and anything left
+ * unset keeps DuckDB's default.
+ */
+List *
+duckdb_server_engine_settings(ForeignServer *server)
+{
+	List	   *settings = NIL;
+	const char *threads = NULL;
+	const char *memory_limit = duckdb_fdw_memory_limit;
+	const char *temp_directory = duckdb_fdw_temp_directory;
+	const char *max_temp_directory_size = duckdb_fdw_max_temp_directory_size;
+	const char *default_order = duckdb_fdw_default_order;
+	const char *extension_directory = NULL;
+	bool		preserve_insertion_order = duckdb_fdw_preserve_insertion_order;
+	bool		allow_extension_install = true;
+	ListCell   *lc;
+
+	if (duckdb_fdw_threads > 0)
+		threads = psprintf("%d", duckdb_fdw_threads);
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "threads") == 0)
+			threads = defGetString(def);
+		else if (strcmp(def->defname, "memory_limit") == 0)
+			memory_limit = defGetString(def);
+		else if (strcmp(def->defname, "temp_directory") == 0)
+			temp_directory = defGetString(def);
+		else if (strcmp(def->defname, "max_temp_directory_size") == 0)
+			max_temp_directory_size = defGetString(def);
+		else if (strcmp(def->defname, "preserve_insertion_order") == 0)
+			preserve_insertion_order = defGetBoolean(def);
+		else if (strcmp(def->defname, "default_order") == 0)
+			default_order = defGetString(def);
+		else if (strcmp(def->defname, "extension_directory") == 0)
+			extension_directory = defGetString(def);
+		else if (strcmp(def->defname, "allow_extension_install") == 0)
+			allow_extension_install = defGetBoolean(def);
+	}
+
+	if (duckdb_server_access_mode(server) == DUCKDB_ACCESS_READ_ONLY)
+		settings = lappend(settings,
+						   makeDefElem("access_mode", (Node *) makeString("READ_ONLY"), -1));
+
+#define ADD_SETTING(name, value) \
+	settings = lappend(settings, makeDefElem(name, (Node *) makeString(pstrdup(value)), -1))
+
+	if (threads)
+		ADD_SETTING("threads", threads);
+	if (memory_limit && memory_limit[0] != '\0')
+		ADD_SETTING("memory_limit", memory_limit);
+	if (temp_directory && temp_directory[0] != '\0')
+		ADD_SETTING("temp_directory", temp_directory);
+	if (max_temp_directory_size && max_temp_directory_size[0] != '\0')
+		ADD_SETTING("max_temp_directory_size", max_temp_directory_size);
+	if (default_order && default_order[0] != '\0')
+		ADD_SETTING("default_order", default_order);
+	ADD_SETTING("preserve_insertion_order",
+				preserve_insertion_order ? "true" : "false");
+	if (extension_directory)
+		ADD_SETTING("extension_directory", extension_directory);
+	/* Known extensions load on first use; setup loads only the listed ones */
+	ADD_SETTING("autoload_known_extensions", "true");
+	/* Neither may DuckDB fetch extensions on its own */
+	if (!allow_extension_install)
+		ADD_SETTING("autoinstall_known_extensions", "false");
+
+#undef ADD_SETTING
+
+	return settings;
+}
+
+/*
+ * Build the DuckDB configuration a server's database is opened with.
+ * read_only forces READ_ONLY access on top of the server's settings.
+ */
+static duckdb_config
+duckdb_build_engine_config(ForeignServer *server, bool read_only)
+{
+	duckdb_config config;
+	ListCell   *lc;
+
+	if (duckdb_create_config(&config) == DuckDBError)
+		elog(ERROR, "duckdb_fdw: failed to create DuckDB config");
+
+	foreach(lc, duckdb_server_engine_settings(server))
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		duckdb_set_config_option(config, def->defname, strVal(def->arg));
+	}
+	if (read_only)
+		duckdb_set_config_option(config, "access_mode", "READ_ONLY");
+
+	return config;
+}
+
+/*
+ * The server's access_mode option; read_write when unset.
+ */
+DuckDBAccessMode
+duckdb_server_access_mode(ForeignServer *server)
+{
+	ListCell   *lc;
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "access_mode") == 0)
+		{
+			char	   *value = defGetString(def);
+
+			if (pg_strcasecmp(value, "read_only") == 0)
+				return DUCKDB_ACCESS_READ_ONLY;
+			if (pg_strcasecmp(value, "automatic") == 0)
+				return DUCKDB_ACCESS_AUTOMATIC;
+			return DUCKDB_ACCESS_READ_WRITE;
+		}
+	}
+	return DUCKDB_ACCESS_READ_WRITE;
+}
+
+/*
+ * Register the transaction and invalidation callbacks, once per backend.
+ * Shared-host sessions need them too, to commit and abort their inserts.
+ */
+void
+duckdb_register_xact_callbacks(void)
+{
+	if (ConnectionXactCallbackRegistered)
+		return;
+	RegisterXactCallback(duckdb_connection_xact_callback, NULL);
+	RegisterSubXactCallback(duckdb_connection_subxact_callback, NULL);
+	CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+								  duckdb_connection_inval_callback, (Datum) 0);
+	CacheRegisterSyscacheCallback(USERMAPPINGOID,
+								  duckdb_connection_inval_callback, (Datum) 0);
+	ConnectionXactCallbackRegistered = true;
 }
 
+/*
+ * Get the connection for a server, opening its database if needed.  for_write
+ * says the caller modifies data: a read_only server refuses it, and an
+ * automatic one opened READ_ONLY for earlier scans is reopened read-write.
+ */
 duckdb_connection
-duckdb_get_connection(ForeignServer *server, bool truncatable)
+duckdb_get_connection(ForeignServer *server, bool for_write)
 {
 	bool		found;
 	ConnCacheEntry *entry;
 	ConnCacheKey key;
+	DuckDBAccessMode access_mode = duckdb_server_access_mode(server);
+
+	if (for_write && access_mode == DUCKDB_ACCESS_READ_ONLY)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("duckdb_fdw: server \"%s\" is read-only", server->servername),
+				 errhint("Set the server's access_mode option to 'read_write' or 'automatic'.")));
 
 	duckdb_runtime_guard_check();
 
@@ -418,22 +1069,57 @@ duckdb_get_connection(ForeignServer *server, bool truncatable)
 		ctl.hcxt = CacheMemoryContext;
 		ConnectionHash = hash_create("duckdb_fdw connections", 8, &ctl, HASH_ELEM | HASH_BLOBS);
 	}
-	if (!ConnectionXactCallbackRegistered)
-	{
-		RegisterXactCallback(duckdb_connection_xact_callback, NULL);
-		RegisterSubXactCallback(duckdb_connection_subxact_callback, NULL);
-		ConnectionXactCallbackRegistered = true;
-	}
+	duckdb_register_xact_callbacks();
 
 	key = server->serverid;
 	entry = hash_search(ConnectionHash, &key, HASH_ENTER, &found);
 
-	if (!found || entry->conn == NULL)
+	if (!found)
+	{
+		entry->db = NULL;
+		entry->conn = NULL;
+		entry->pool = NIL;
+		entry->nleases = 0;
+		entry->read_only = false;
+		entry->attached = NIL;
+		entry->appenders = NIL;
+		entry->xact_conn = NULL;
+		entry->xact_subid = InvalidSubTransactionId;
+		entry->xact_used_subid = InvalidSubTransactionId;
+		entry->dbpath = NULL;
+		entry->userid = InvalidOid;
+		entry->keep = true;
+		entry->invalidated = false;
+		entry->server_hashvalue = 0;
+	}
+
+	/*
+	 * A database kept from an earlier transaction was opened with options
+	 * or credentials that may be stale now; reopen it while nothing uses it.
+	 */
+	if (entry->conn != NULL &&
+		(entry->invalidated || entry->userid != GetUserId()) &&
+		entry->nleases == 0 && entry->xact_conn == NULL && entry->appenders == NIL)
+		duckdb_close_connection_entry(entry);
+
+	if (entry->conn != NULL && for_write && entry->read_only)
+	{
+		if (entry->nleases > 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_ERROR),
+					 errmsg("duckdb_fdw: cannot reopen server \"%s\" for writing while a read-only scan of it is open",
+							server->servername),
+					 errhint("Close open cursors on the server first, or set its access_mode option to 'read_write'.")));
+		duckdb_close_connection_entry(entry);
+	}
+
+	if (entry->conn == NULL)
 	{
         const char *dbpath = NULL;
         const char *quack_host = NULL;
         const char *quack_token = NULL;
         Oid userid = GetUserId();
+        List *setup = NIL;
         ListCell *lc;
 
         /* Check user mapping for quack_token first (secure path) */
@@ -466,21 +1152,67 @@ duckdb_get_connection(ForeignServer *server, bool truncatable)
         if (quack_host && !dbpath)
             dbpath = ":memory:";
 
-        if (duckdb_open(dbpath, &entry->db) == DuckDBError)
-            elog(ERROR, "failed to open DuckDB");
+        /*
+         * In automatic mode, pure readers open the file READ_ONLY so any
+         * number of backends can share it.  In-memory databases cannot be
+         * opened read-only.
+         */
+        entry->read_only = (access_mode == DUCKDB_ACCESS_READ_ONLY) ||
+            (access_mode == DUCKDB_ACCESS_AUTOMATIC && !for_write &&
+             dbpath != NULL && dbpath[0] != '\0' && strcmp(dbpath, ":memory:") != 0);
+
+        duckdb_close_idle_entries_for(dbpath, server->serverid);
+        entry->keep = duckdb_server_keeps_connections(server);
+        entry->userid = userid;
+        entry->server_hashvalue = GetSysCacheHashValue1(FOREIGNSERVEROID,
+                                                        ObjectIdGetDatum(server->serverid));
+        {
+            duckdb_config config = duckdb_build_engine_config(server,
+                                                              entry->read_only &&
+                                                              access_mode == DUCKDB_ACCESS_AUTOMATIC);
+            char *open_err = NULL;
+            duckdb_state open_state;
+
+            pgstat_report_wait_start(duckdb_wait_event(DUCKDB_WAIT_OPEN));
+            open_state = duckdb_open_ext(dbpath, &entry->db, config, &open_err);
+            pgstat_report_wait_end();
+            if (open_state == DuckDBError)
+            {
+                char *msg = pstrdup(open_err ? open_err : "unknown error");
+
+                if (open_err)
+                    duckdb_free(open_err);
+                duckdb_destroy_config(&config);
+                entry->db = NULL;
+                ereport(ERROR,
+                        (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+                         errmsg("failed to open DuckDB: %s", msg)));
+            }
+            duckdb_destroy_config(&config);
+            if (dbpath != NULL)
+                entry->dbpath = MemoryContextStrdup(CacheMemoryContext, dbpath);
+        }
 	        if (duckdb_connect(entry->db, &entry->conn) == DuckDBError)
 	            elog(ERROR, "failed to connect to DuckDB");
+	        duckdb_add_pooled_connection(entry, entry->conn);
 
-	        duckdb_setup_secrets_and_extensions(entry->conn, server);
+	        duckdb_collect_setup_commands(&setup, server, false);
+	        foreach(lc, setup)
+	            duckdb_do_sql_command(entry->conn,
+	                                  duckdb_setup_command_sql(entry->conn, (char *) lfirst(lc)),
+	                                  ERROR);
 
         /* Quack proxy mode: load Quack extension and ATTACH remote */
         if (quack_host)
         {
             char *host_lit;
             char *attach_sql;
+            char *quack_sql = duckdb_extension_sql("quack", "core_nightly",
+                                                   duckdb_server_allows_extension_install(server));
 
             duckdb_do_sql_command(entry->conn,
-                "INSTALL quack FROM core_nightly; LOAD quack;", ERROR);
+                                  duckdb_setup_command_sql(entry->conn, quack_sql), ERROR);
+            pfree(quack_sql);
 
             if (quack_token)
             {
@@ -498,30 +1230,749 @@ duckdb_get_connection(ForeignServer *server, bool truncatable)
             pfree(attach_sql);
         }
 	}
+
+	/*
+	 * Once the transaction has inserted, its statements run on the
+	 * transaction connection, where they see its rows.
+	 */
+	if (entry->xact_conn != NULL)
+	{
+		entry->xact_used_subid = GetCurrentSubTransactionId();
+		return entry->xact_conn;
+	}
 	return entry->conn;
 }
 
-void
-duckdb_do_sql_command(duckdb_connection conn, const char *sql, int level)
+/*
+ * Lease a connection of the server's pool for one scan or modify.  Idle
+ * connections are reused; up to duckdb_fdw.max_connections_per_server are
+ * opened on the server's database, after which the least used one is
+ * shared.  Once the transaction has inserted, every lease gets its
+ * transaction connection instead.  Hand it back with
+ * duckdb_release_connection.
+ */
+duckdb_connection
+duckdb_lease_connection(ForeignServer *server, bool for_write)
+{
+	ConnCacheEntry *entry;
+	PooledConn *best = NULL;
+	duckdb_connection conn;
+	ListCell   *lc;
+
+	duckdb_disk_cache_maintain(server);
+	conn = duckdb_get_connection(server, for_write);
+	entry = hash_search(ConnectionHash, &server->serverid, HASH_FIND, NULL);
+	if (conn == entry->xact_conn)
+		return conn;
+
+	foreach(lc, entry->pool)
+	{
+		PooledConn *pconn = (PooledConn *) lfirst(lc);
+
+		if (best == NULL || pconn->leases < best->leases)
+			best = pconn;
+	}
+
+	if (best->leases > 0 &&
+		list_length(entry->pool) < duckdb_fdw_max_connections_per_server)
+	{
+		if (duckdb_connect(entry->db, &conn) == DuckDBError)
+			elog(ERROR, "failed to connect to DuckDB");
+		best = duckdb_add_pooled_connection(entry, conn);
+	}
+
+	best->leases++;
+	entry->nleases++;
+	return best->conn;
+}
+
+void
+duckdb_release_connection(duckdb_connection conn)
+{
+	ConnCacheEntry *entry;
+	PooledConn *pconn = duckdb_find_pooled_connection(conn, &entry);
+
+	if (pconn != NULL && pconn->leases > 0)
+	{
+		pconn->leases--;
+		entry->nleases--;
+	}
+}
+
+static void
+duckdb_xact_appender_free(XactAppender *xa)
+{
+	duckdb_appender_destroy(&xa->appender);
+	pfree(xa->table);
+	pfree(xa);
+}
+
+/*
+ * The server's transaction connection, opening it on first use.  It is a
+ * private connection in an explicit DuckDB transaction that commits at
+ * PostgreSQL commit and rolls back on abort, so inserts run on it are not
+ * visible to other sessions until then.  The transaction's later scans and
+ * statements on the server run on it too.
+ */
+duckdb_connection
+duckdb_xact_connection(ForeignServer *server)
+{
+	ConnCacheEntry *entry = NULL;
+	duckdb_connection conn;
+
+	if (ConnectionHash != NULL)
+		entry = hash_search(ConnectionHash, &server->serverid, HASH_FIND, NULL);
+	if (entry != NULL && entry->xact_conn != NULL)
+	{
+		entry->xact_used_subid = GetCurrentSubTransactionId();
+		return entry->xact_conn;
+	}
+
+	(void) duckdb_get_connection(server, true);
+	entry = hash_search(ConnectionHash, &server->serverid, HASH_FIND, NULL);
+	if (duckdb_connect(entry->db, &conn) == DuckDBError)
+		elog(ERROR, "failed to connect to DuckDB");
+	PG_TRY();
+	{
+		duckdb_setup_connection(conn);
+		duckdb_do_sql_command(conn, "BEGIN TRANSACTION", ERROR);
+	}
+	PG_CATCH();
+	{
+		duckdb_disconnect(&conn);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	entry->xact_conn = conn;
+	entry->xact_subid = GetCurrentSubTransactionId();
+	entry->xact_used_subid = entry->xact_subid;
+	return conn;
+}
+
+/*
+ * The transaction's appender for foreign table relid, whose table option
+ * is table, creating it on first use on the transaction connection.  Returns
+ * NULL if DuckDB cannot append to the table, e.g. because it is a view or a
+ * file.
+ */
+duckdb_appender
+duckdb_xact_appender(ForeignServer *server, Oid relid, const char *table)
+{
+	ConnCacheEntry *entry = hash_search(ConnectionHash, &server->serverid, HASH_FIND, NULL);
+	XactAppender *xa;
+	duckdb_connection conn;
+	duckdb_appender appender;
+	MemoryContext oldcxt;
+	ListCell   *lc;
+
+	foreach(lc, entry->appenders)
+	{
+		xa = (XactAppender *) lfirst(lc);
+		if (xa->relid == relid)
+			return xa->appender;
+	}
+
+	conn = duckdb_xact_connection(server);
+	if (duckdb_appender_create(conn, NULL, table, &appender) == DuckDBError)
+	{
+		duckdb_appender_destroy(&appender);
+		return NULL;
+	}
+
+	oldcxt = MemoryContextSwitchTo(CacheMemoryContext);
+	xa = palloc(sizeof(XactAppender));
+	xa->relid = relid;
+	xa->table = pstrdup(table);
+	xa->appender = appender;
+	entry->appenders = lappend(entry->appenders, xa);
+	MemoryContextSwitchTo(oldcxt);
+
+	return appender;
+}
+
+/*
+ * Send the rows buffered by an entry's appenders to DuckDB.  With close the
+ * appenders are closed too, as at commit.  An appender that fails is dropped
+ * with its rows and the error reported.
+ */
+static void
+duckdb_flush_entry_appenders(ConnCacheEntry *entry, bool close)
+{
+	ListCell   *lc;
+
+	foreach(lc, entry->appenders)
+	{
+		XactAppender *xa = (XactAppender *) lfirst(lc);
+		duckdb_state state;
+
+		pgstat_report_wait_start(duckdb_wait_event(DUCKDB_WAIT_APPENDER_FLUSH));
+		state = close ? duckdb_appender_close(xa->appender) : duckdb_appender_flush(xa->appender);
+		pgstat_report_wait_end();
+		if (state == DuckDBError)
+		{
+			const char *err = duckdb_appender_error(xa->appender);
+			char	   *msg = pstrdup(err ? err : "unknown appender error");
+			char	   *table = pstrdup(xa->table);
+
+			/* The rows are gone, whichever subtransaction inserted them */
+			entry->xact_used_subid = GetCurrentSubTransactionId();
+			(void) duckdb_appender_clear(xa->appender);
+			entry->appenders = foreach_delete_current(entry->appenders, lc);
+			duckdb_xact_appender_free(xa);
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_ERROR),
+					 errmsg("duckdb_fdw: could not flush inserts into \"%s\": %s", table, msg)));
+		}
+		if (close)
+		{
+			entry->appenders = foreach_delete_current(entry->appenders, lc);
+			duckdb_xact_appender_free(xa);
+		}
+	}
+}
+
+/*
+ * Flush the server's transaction appenders, so later statements on its
+ * transaction connection see the rows they buffer.
+ */
+void
+duckdb_flush_xact_appenders(ForeignServer *server)
+{
+	ConnCacheEntry *entry;
+
+	if (ConnectionHash == NULL)
+		return;
+	entry = hash_search(ConnectionHash, &server->serverid, HASH_FIND, NULL);
+	if (entry != NULL)
+		duckdb_flush_entry_appenders(entry, false);
+}
+
+/*
+ * Flush the appenders of the transaction connection conn, if it is one, so
+ * a statement run on it sees the rows they buffer.
+ */
+static void
+duckdb_flush_appenders_for(duckdb_connection conn)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (ConnectionHash == NULL)
+		return;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+	{
+		if (entry->xact_conn != NULL && entry->xact_conn == conn)
+		{
+			hash_seq_term(&scan);
+			duckdb_flush_entry_appenders(entry, false);
+			return;
+		}
+	}
+}
+
+/*
+ * Drop an entry's appenders and the rows they still buffer.
+ */
+static void
+duckdb_discard_xact_appenders(ConnCacheEntry *entry)
+{
+	ListCell   *lc;
+
+	foreach(lc, entry->appenders)
+	{
+		XactAppender *xa = (XactAppender *) lfirst(lc);
+
+		(void) duckdb_appender_clear(xa->appender);
+		duckdb_xact_appender_free(xa);
+	}
+	list_free(entry->appenders);
+	entry->appenders = NIL;
+}
+
+/*
+ * Whether text mentions alias as a whole identifier, quoted or not.
+ */
+static bool
+duckdb_text_references(const char *text, const char *alias)
+{
+	size_t		len = strlen(alias);
+
+	for (const char *p = text; *p; p++)
+	{
+		if (pg_strncasecmp(p, alias, len) == 0 &&
+			(p == text || !(isalnum((unsigned char) p[-1]) || p[-1] == '_')) &&
+			!(isalnum((unsigned char) p[len]) || p[len] == '_'))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Attach the catalogs of the server's attach_catalogs that text refers to
+ * (a table option, an imported schema or SQL), or all of them when text is
+ * NULL.  Opening a database attaches nothing, so a query pays only for the
+ * remote catalogs it reads; the connection cache entry remembers what its
+ * database has attached.  Returns whether text referred to any catalog.
+ */
+bool
+duckdb_attach_catalogs(ForeignServer *server, const char *text)
+{
+	ConnCacheEntry *entry = NULL;
+	bool		referenced = false;
+	ListCell   *lc;
+
+	foreach(lc, duckdb_server_catalogs(server))
+	{
+		DuckDBCatalog *catalog = (DuckDBCatalog *) lfirst(lc);
+		bool		attached = false;
+		ListCell   *alc;
+		MemoryContext oldcxt;
+
+		if (text != NULL && !duckdb_text_references(text, catalog->alias))
+			continue;
+		referenced = true;
+
+		if (entry == NULL)
+		{
+			(void) duckdb_get_connection(server, false);
+			entry = hash_search(ConnectionHash, &server->serverid, HASH_FIND, NULL);
+		}
+		foreach(alc, entry->attached)
+		{
+			if (strcmp((char *) lfirst(alc), catalog->alias) == 0)
+				attached = true;
+		}
+		if (attached)
+			continue;
+
+		foreach(alc, catalog->cmds)
+			duckdb_do_sql_command(entry->conn,
+								  duckdb_setup_command_sql(entry->conn, (char *) lfirst(alc)),
+								  ERROR);
+
+		oldcxt = MemoryContextSwitchTo(CacheMemoryContext);
+		entry->attached = lappend(entry->attached, pstrdup(catalog->alias));
+		MemoryContextSwitchTo(oldcxt);
+	}
+	return referenced;
+}
+
+static PooledConn *
+duckdb_find_pooled_connection(duckdb_connection conn, ConnCacheEntry **entry_out)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (ConnectionHash == NULL)
+		return NULL;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+	{
+		ListCell   *lc;
+
+		foreach(lc, entry->pool)
+		{
+			PooledConn *pconn = (PooledConn *) lfirst(lc);
+
+			if (pconn->conn == conn)
+			{
+				hash_seq_term(&scan);
+				if (entry_out)
+					*entry_out = entry;
+				return pconn;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Get a prepared statement for sql on conn, reusing a cached one if
+ * possible.  The caller must hand it back with
+ * duckdb_release_prepared_statement.
+ */
+duckdb_prepared_statement
+duckdb_acquire_prepared_statement(duckdb_connection conn, const char *sql)
+{
+	PooledConn *pconn = duckdb_find_pooled_connection(conn, NULL);
+	uint32		hash = string_hash(sql, strlen(sql) + 1);
+	duckdb_prepared_statement stmt = NULL;
+	PreparedStmtEntry *pentry;
+	dlist_iter	iter;
+
+	if (pconn != NULL && duckdb_fdw_prepared_statement_cache_size > 0)
+	{
+		dlist_foreach(iter, &pconn->stmt_cache)
+		{
+			pentry = dlist_container(PreparedStmtEntry, node, iter.cur);
+
+			if (pentry->hash == hash && !pentry->in_use &&
+				strcmp(pentry->sql, sql) == 0)
+			{
+				stmt_cache_hits++;
+				pentry->in_use = true;
+				dlist_move_head(&pconn->stmt_cache, &pentry->node);
+				return pentry->stmt;
+			}
+		}
+	}
+
+	stmt_cache_misses++;
+	if (duckdb_prepare(conn, sql, &stmt) == DuckDBError)
+	{
+		const char *err = stmt ? duckdb_prepare_error(stmt) : "prepare error";
+		char	   *err_msg = pstrdup(err ? err : "prepare error");
+
+		if (stmt)
+			duckdb_destroy_prepare(&stmt);
+		elog(ERROR, "duckdb_fdw: prepare failed: %s", err_msg);
+	}
+
+	if (pconn == NULL || duckdb_fdw_prepared_statement_cache_size <= 0)
+		return stmt;
+
+	/* Make room by evicting the least recently used idle statements */
+	while (pconn->stmt_cache_len >= duckdb_fdw_prepared_statement_cache_size)
+	{
+		PreparedStmtEntry *victim = NULL;
+
+		dlist_reverse_foreach(iter, &pconn->stmt_cache)
+		{
+			pentry = dlist_container(PreparedStmtEntry, node, iter.cur);
+			if (!pentry->in_use)
+			{
+				victim = pentry;
+				break;
+			}
+		}
+		if (victim == NULL)
+			return stmt;		/* everything is leased; don't cache */
+
+		duckdb_stmt_cache_remove(pconn, victim);
+		stmt_cache_evictions++;
+	}
+
+	pentry = MemoryContextAllocZero(CacheMemoryContext, sizeof(PreparedStmtEntry));
+	pentry->hash = hash;
+	pentry->sql = MemoryContextStrdup(CacheMemoryContext, sql);
+	pentry->stmt = stmt;
+	pentry->in_use = true;
+	dlist_push_head(&pconn->stmt_cache, &pentry->node);
+	pconn->stmt_cache_len++;
+
+	return stmt;
+}
+
+/*
+ * Return a statement obtained from duckdb_acquire_prepared_statement.
+ * Cached statements stay prepared; private ones are destroyed.
+ */
+void
+duckdb_release_prepared_statement(duckdb_connection conn, duckdb_prepared_statement stmt)
+{
+	PooledConn *pconn = duckdb_find_pooled_connection(conn, NULL);
+	dlist_iter	iter;
+
+	if (pconn != NULL)
+	{
+		dlist_foreach(iter, &pconn->stmt_cache)
+		{
+			PreparedStmtEntry *pentry = dlist_container(PreparedStmtEntry, node, iter.cur);
+
+			if (pentry->stmt == stmt)
+			{
+				duckdb_clear_bindings(stmt);
+				pentry->in_use = false;
+				return;
+			}
+		}
+	}
+
+	duckdb_destroy_prepare(&stmt);
+}
+
+PG_FUNCTION_INFO_V1(duckdb_fdw_prepared_statement_cache_stats);
+Datum
+duckdb_fdw_prepared_statement_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[4];
+	bool		nulls[4] = {false, false, false, false};
+	int			entries = 0;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (ConnectionHash != NULL)
+	{
+		HASH_SEQ_STATUS scan;
+		ConnCacheEntry *entry;
+
+		hash_seq_init(&scan, ConnectionHash);
+		while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+		{
+			ListCell   *lc;
+
+			foreach(lc, entry->pool)
+				entries += ((PooledConn *) lfirst(lc))->stmt_cache_len;
+		}
+	}
+
+	values[0] = Int64GetDatum((int64) stmt_cache_hits);
+	values[1] = Int64GetDatum((int64) stmt_cache_misses);
+	values[2] = Int64GetDatum((int64) stmt_cache_evictions);
+	values[3] = Int32GetDatum(entries);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/*
+ * Wait event for one of the DuckDB calls a backend can block in.  PostgreSQL
+ * 17 and later let extensions name their wait events, so pg_stat_activity
+ * and wait samplers show e.g. DuckDBQuery; older releases report all of them
+ * as the generic Extension event.
+ */
+uint32
+duckdb_wait_event(DuckDBWaitEvent event)
+{
+#if PG_VERSION_NUM >= 170000
+	static uint32 wait_events[DUCKDB_WAIT_NUM_EVENTS];
+	static const char *const wait_event_names[DUCKDB_WAIT_NUM_EVENTS] = {
+		"DuckDBQuery",
+		"DuckDBFetchChunk",
+		"DuckDBAppenderFlush",
+		"DuckDBAttach",
+		"DuckDBExtensionLoad",
+		"DuckDBOpen",
+		"DuckDBBudget"
+	};
+
+	if (wait_events[event] == 0)
+		wait_events[event] = WaitEventExtensionNew(wait_event_names[event]);
+	return wait_events[event];
+#else
+	return PG_WAIT_EXTENSION;
+#endif
+}
+
+/*
+ * Execute a prepared statement through DuckDB's pending-result API, running
+ * its tasks on this thread and checking for interrupts between them.  On
+ * query cancel, statement_timeout or termination the DuckDB query is
+ * interrupted and the PostgreSQL error is rethrown, so a long remote scan
+ * stops promptly.  Returns false with a palloc'd message in *errmsg if DuckDB
+ * reports an error.  The backend reports the given wait event meanwhile.
+ */
+static bool
+duckdb_run_pending(duckdb_connection conn, duckdb_prepared_statement stmt,
+				   duckdb_result *res, char **errmsg, DuckDBWaitEvent event)
+{
+	duckdb_pending_result pending;
+	duckdb_pending_state state;
+	duckdb_state exec_state = DuckDBSuccess;
+
+	/* Statements of an inserting transaction see the rows it appended */
+	duckdb_flush_appenders_for(conn);
+
+	if (duckdb_pending_prepared(stmt, &pending) == DuckDBError)
+	{
+		const char *err = duckdb_pending_error(pending);
+
+		*errmsg = pstrdup(err ? err : "unknown error");
+		duckdb_destroy_pending(&pending);
+		return false;
+	}
+
+	for (;;)
+	{
+		if (InterruptPending)
+		{
+			PG_TRY();
+			{
+				CHECK_FOR_INTERRUPTS();
+			}
+			PG_CATCH();
+			{
+				duckdb_interrupt(conn);
+				duckdb_destroy_pending(&pending);
+				PG_RE_THROW();
+			}
+			PG_END_TRY();
+		}
+
+		pgstat_report_wait_start(duckdb_wait_event(event));
+		state = duckdb_pending_execute_task(pending);
+		pgstat_report_wait_end();
+		if (state == DUCKDB_PENDING_RESULT_READY || state == DUCKDB_PENDING_ERROR)
+			break;
+		duckdb_progress_update(conn, state == DUCKDB_PENDING_NO_TASKS_AVAILABLE);
+		if (state == DUCKDB_PENDING_NO_TASKS_AVAILABLE)
+		{
+			/* DuckDB's own threads hold the remaining work; wait briefly */
+			(void) WaitLatch(MyLatch,
+							 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+							 1L,
+							 duckdb_wait_event(event));
+			ResetLatch(MyLatch);
+		}
+	}
+
+	if (state != DUCKDB_PENDING_ERROR)
+	{
+		pgstat_report_wait_start(duckdb_wait_event(event));
+		exec_state = duckdb_execute_pending(pending, res);
+		pgstat_report_wait_end();
+	}
+
+	if (state == DUCKDB_PENDING_ERROR || exec_state == DuckDBError)
+	{
+		const char *err = state == DUCKDB_PENDING_ERROR ?
+			duckdb_pending_error(pending) : duckdb_result_error(res);
+
+		*errmsg = pstrdup(err ? err : "unknown error");
+		if (state != DUCKDB_PENDING_ERROR)
+			duckdb_destroy_result(res);
+		duckdb_destroy_pending(&pending);
+		return false;
+	}
+
+	duckdb_destroy_pending(&pending);
+	return true;
+}
+
+bool
+duckdb_run_prepared(duckdb_connection conn, duckdb_prepared_statement stmt,
+					duckdb_result *res, char **errmsg)
 {
+	return duckdb_run_pending(conn, stmt, res, errmsg, DUCKDB_WAIT_QUERY);
+}
+
+/*
+ * duckdb_run_prepared for a single SQL statement without parameters.
+ */
+bool
+duckdb_run_query(duckdb_connection conn, const char *sql,
+				 duckdb_result *res, char **errmsg)
+{
+	duckdb_prepared_statement stmt;
+	bool		ok;
+
+	if (duckdb_prepare(conn, sql, &stmt) == DuckDBError)
+	{
+		const char *err = duckdb_prepare_error(stmt);
+
+		*errmsg = pstrdup(err ? err : "prepare error");
+		duckdb_destroy_prepare(&stmt);
+		return false;
+	}
+
+	PG_TRY();
+	{
+		ok = duckdb_run_prepared(conn, stmt, res, errmsg);
+	}
+	PG_FINALLY();
+	{
+		duckdb_destroy_prepare(&stmt);
+	}
+	PG_END_TRY();
+
+	return ok;
+}
+
+/*
+ * Run statement i of extracted through the pending-result loop, discarding
+ * any result.
+ */
+static bool
+duckdb_run_extracted(duckdb_connection conn, duckdb_extracted_statements extracted,
+					 idx_t i, DuckDBWaitEvent event, char **errmsg)
+{
+	duckdb_prepared_statement stmt;
 	duckdb_result res;
-	MemSet(&res, 0, sizeof(res));
-	if (duckdb_query(conn, sql, &res) == DuckDBError)
+	bool		ok;
+
+	if (duckdb_prepare_extracted_statement(conn, extracted, i, &stmt) == DuckDBError)
 	{
-		const char *err = duckdb_result_error(&res);
-		char *safe_err = duckdb_fdw_redact_secret_text(err ? err : "error");
+		const char *err = duckdb_prepare_error(stmt);
 
+		*errmsg = pstrdup(err ? err : "prepare error");
+		duckdb_destroy_prepare(&stmt);
+		return false;
+	}
+
+	PG_TRY();
+	{
+		ok = duckdb_run_pending(conn, stmt, &res, errmsg, event);
+	}
+	PG_FINALLY();
+	{
+		duckdb_destroy_prepare(&stmt);
+	}
+	PG_END_TRY();
+
+	if (ok)
+		duckdb_destroy_result(&res);
+	return ok;
+}
+
+/*
+ * Run one or more ';'-separated statements, reporting a DuckDB error at the
+ * given level.  Each statement goes through the pending-result loop, so a
+ * long command can be cancelled like a scan.
+ */
+void
+duckdb_do_sql_command(duckdb_connection conn, const char *sql, int level)
+{
+	duckdb_extracted_statements extracted;
+	DuckDBWaitEvent event = DUCKDB_WAIT_QUERY;
+	char	   *err = NULL;
+	idx_t		n;
+	idx_t		i;
+
+	if (pg_strncasecmp(sql, "INSTALL ", 8) == 0 || pg_strncasecmp(sql, "LOAD ", 5) == 0)
+		event = DUCKDB_WAIT_EXTENSION_LOAD;
+	else if (pg_strncasecmp(sql, "ATTACH ", 7) == 0)
+		event = DUCKDB_WAIT_ATTACH;
+
+	n = duckdb_extract_statements(conn, sql, &extracted);
+	PG_TRY();
+	{
+		if (n == 0)
+		{
+			const char *msg = duckdb_extract_statements_error(extracted);
+
+			if (msg != NULL)
+				err = pstrdup(msg);
+		}
+		for (i = 0; i < n; i++)
+		{
+			if (!duckdb_run_extracted(conn, extracted, i, event, &err))
+				break;
+		}
+	}
+	PG_FINALLY();
+	{
+		duckdb_destroy_extracted(&extracted);
+	}
+	PG_END_TRY();
+
+	if (err != NULL)
+	{
+		char *safe_err = duckdb_fdw_redact_secret_text(err);
+
+		pfree(err);
 		PG_TRY();
 		{
 			ereport(level, (errcode(ERRCODE_FDW_ERROR), errmsg("DuckDB: %s", safe_err)));
 		}
 		PG_FINALLY();
 		{
-			duckdb_destroy_result(&res);
 			pfree(safe_err);
 		}
 		PG_END_TRY();
-		return;
 	}
-	duckdb_destroy_result(&res);
 }
@@ -24,6 +24,8 @@
 #include "access/htup_details.h"
 #include "access/sysattr.h"
 #include "catalog/pg_aggregate.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_amop.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_namespace.h"
 #include "catalog/pg_operator.h"
@@ -35,6 +37,7 @@
 #include "optimizer/clauses.h"
 #include "optimizer/tlist.h"
 #include "parser/parsetree.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
@@ -91,6 +94,9 @@ typedef struct deparse_expr_cxt
 #define SUBQUERY_REL_ALIAS_PREFIX	"s"
 #define SUBQUERY_COL_ALIAS_PREFIX	"c"
 
+/* Constant arrays longer than this are bound as a LIST parameter */
+#define DUCKDB_MAX_INLINE_ARRAY_ELEMS	64
+
 /*
  * Functions to determine whether an expression can be evaluated safely on
  * remote server.
@@ -136,9 +142,12 @@ static void duckdb_deparse_range_tbl_ref(StringInfo buf, PlannerInfo *root,
 										 Index ignore_rel, List **ignore_conds, List **params_list);
 static void duckdb_deparse_from_expr(List *quals, deparse_expr_cxt *context);
 static void duckdb_deparse_aggref(Aggref *node, deparse_expr_cxt *context);
+static void duckdb_deparse_window_func(WindowFunc *node, deparse_expr_cxt *context);
+static void duckdb_append_window_spec(WindowClause *wc, deparse_expr_cxt *context);
 static void duckdb_append_limit_clause(deparse_expr_cxt *context);
 static void duckdb_append_conditions(List *exprs, deparse_expr_cxt *context);
-static void duckdb_append_group_by_clause(List *tlist, deparse_expr_cxt *context);
+static void duckdb_append_group_by_clause(List *tlist, bool use_exprs,
+										  deparse_expr_cxt *context);
 static void duckdb_append_agg_order_by(List *orderList, List *targetList,
 									   deparse_expr_cxt *context);
 static void duckdb_append_order_by_clause(List *pathkeys, bool has_final_sort, deparse_expr_cxt *context);
@@ -161,6 +170,19 @@ static char *duckdb_quote_identifier(const char *s, char q);
 static bool duckdb_contain_immutable_functions_walker(Node *node, void *context);
 static bool duckdb_is_valid_type(Oid type);
 static bool duckdb_is_builtin(Oid objectId);
+static bool duckdb_is_pushable_aggregate(const char *proname);
+static bool duckdb_is_pushable_window_func(const char *proname);
+static WindowClause *duckdb_get_window_clause(PlannerInfo *root, Index winref);
+static bool duckdb_is_foreign_window_clause(WindowClause *wc,
+											foreign_glob_cxt *glob_cxt);
+static RelOptInfo *duckdb_get_upper_stage_rel(RelOptInfo *rel,
+											  UpperRelationKind stage);
+static bool duckdb_is_default_sort_operator(SortGroupClause *srt, Node *expr);
+static void duckdb_append_distinct_clause(deparse_expr_cxt *context);
+static bool duckdb_is_large_array_const(Const *c);
+static bool duckdb_is_bound_array_op(ScalarArrayOpExpr *oe);
+static void duckdb_append_remote_param(Node *node, Oid paramtype, int32 paramtypmod,
+									   deparse_expr_cxt *context);
 
 /*
  * Append remote name of specified foreign table to buf.
@@ -192,22 +214,28 @@ duckdb_deparse_relation(StringInfo buf, Relation rel)
 	if (relname == NULL)
 		relname = RelationGetRelationName(rel);
 
-	if (!duckdb_fdw_is_safe_sql_fragment(relname))
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-				 errmsg("table option contains unsafe SQL fragment")));
-
 	/* 
 	 * DuckDB 特化：支持数据湖直连
 	 * 如果表名以 .parquet 结尾，或者定义了 path 选项，生成 read_parquet
+	 *
+	 * The path is sent as a quoted literal, so glob patterns, whose slashes
+	 * and stars look like comment markers, need not pass the unsafe-fragment
+	 * check below.
 	 */
 	if (strstr(relname, ".parquet") != NULL && strstr(relname, "read_parquet") == NULL)
 	{
 		char *rel_lit = duckdb_fdw_quote_literal(relname);
 		appendStringInfo(buf, "read_parquet(%s)", rel_lit);
 		pfree(rel_lit);
+		return;
 	}
-    else if (strstr(relname, "read_parquet") != NULL || strstr(relname, "read_csv") != NULL)
+
+	if (!duckdb_fdw_is_safe_sql_fragment(relname))
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+				 errmsg("table option contains unsafe SQL fragment")));
+
+    if (strstr(relname, "read_parquet") != NULL || strstr(relname, "read_csv") != NULL)
     {
         /* Already a function call, pass as is */
         appendStringInfo(buf, "%s", relname);
@@ -259,6 +287,22 @@ duckdb_deparse_relation(StringInfo buf, Relation rel)
 	}
 }
 
+/*
+ * The remote name of a foreign table, as duckdb_deparse_relation writes it.
+ * The caller must already hold a lock on the table.
+ */
+char *
+duckdb_deparse_table_reference(Oid relid)
+{
+	Relation	rel = table_open(relid, NoLock);
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+	duckdb_deparse_relation(&buf, rel);
+	table_close(rel, NoLock);
+	return buf.data;
+}
+
 static char *
 duckdb_quote_identifier(const char *s, char q)
 {
@@ -333,7 +377,7 @@ duckdb_is_foreign_expr(PlannerInfo *root,
         {
             return false;
         }
-		glob_cxt.relids = fpinfo->outerrel->relids;
+		glob_cxt.relids = duckdb_get_upper_scanrel(baserel)->relids;
     }
 	else
 		glob_cxt.relids = baserel->relids;
@@ -420,7 +464,7 @@ duckdb_is_foreign_param(PlannerInfo *root,
 								Relids		relids;
 				
 								if (IS_UPPER_REL(baserel))
-									relids = fpinfo ? fpinfo->outerrel->relids : NULL;
+									relids = fpinfo ? duckdb_get_upper_scanrel(baserel)->relids : NULL;
 								else
 									relids = baserel->relids;
 				
@@ -458,9 +502,17 @@ duckdb_is_valid_type(Oid type)
 		case TIMEOID:
 		case TIMESTAMPOID:
 		case TIMESTAMPTZOID:
+		case BOOLOID:
+		case DATEOID:
+		case BPCHAROID:
+		case BYTEAOID:
+		case UUIDOID:
+		case INTERVALOID:
 			return true;
 	}
-	return false;
+
+	/* Arrays are bound as DuckDB LIST values */
+	return duckdb_can_bind_array_type(get_element_type(type));
 }
 
 /*
@@ -781,6 +833,15 @@ duckdb_foreign_expr_walker(Node *node,
 				if (!duckdb_is_builtin(oe->opno))
 					return false;
 
+				/*
+				 * Other than array literals, only arrays we can bind as a
+				 * LIST parameter are deparsed.
+				 */
+				if (!IsA(lsecond(oe->args), ArrayExpr) &&
+					!IsA(lsecond(oe->args), Const) &&
+					!duckdb_is_bound_array_op(oe))
+					return false;
+
 				/*
 				 * Recurse to input subexpressions.
 				 */
@@ -954,24 +1015,8 @@ duckdb_foreign_expr_walker(Node *node,
 					return false;
 
 				/* these function can be passed to DuckDB */
-				if (!(strcmp(opername, "sum") == 0
-					  || strcmp(opername, "avg") == 0
-					  || strcmp(opername, "max") == 0
-					  || strcmp(opername, "min") == 0
-					  || strcmp(opername, "array_agg") == 0
-                      || strcmp(opername, "stddev") == 0
-                      || strcmp(opername, "stddev_pop") == 0
-                      || strcmp(opername, "stddev_samp") == 0
-                      || strcmp(opername, "variance") == 0
-                      || strcmp(opername, "var_pop") == 0
-                      || strcmp(opername, "var_samp") == 0
-					  || strcmp(opername, "mode") == 0
-					  || strcmp(opername, "percentile_cont") == 0
-					  || strcmp(opername, "percentile_disc") == 0
-					  || strcmp(opername, "count") == 0))
-				{
+				if (!duckdb_is_pushable_aggregate(opername))
 					return false;
-				}
 
 
 				/* Not safe to pushdown when not in grouping context */
@@ -1031,6 +1076,85 @@ duckdb_foreign_expr_walker(Node *node,
 					state = FDW_COLLATE_UNSAFE;
 			}
 			break;
+		case T_WindowFunc:
+			{
+				WindowFunc *wfunc = (WindowFunc *) node;
+				WindowClause *wc;
+				char	   *opername = NULL;
+				Oid			schema;
+
+				/* Only safe to push down at or above the window stage */
+				if (!IS_UPPER_REL(glob_cxt->foreignrel) ||
+					glob_cxt->foreignrel->fdw_private == NULL ||
+					duckdb_get_upper_stage_rel(glob_cxt->foreignrel,
+											   UPPERREL_WINDOW) == NULL)
+					return false;
+
+				/* get function name and schema */
+				tuple = SearchSysCache1(PROCOID, ObjectIdGetDatum(wfunc->winfnoid));
+				if (!HeapTupleIsValid(tuple))
+					elog(ERROR, "cache lookup failed for function %u", wfunc->winfnoid);
+				opername = pstrdup(((Form_pg_proc) GETSTRUCT(tuple))->proname.data);
+				schema = ((Form_pg_proc) GETSTRUCT(tuple))->pronamespace;
+				ReleaseSysCache(tuple);
+
+				/* ignore functions in other than the pg_catalog schema */
+				if (schema != PG_CATALOG_NAMESPACE)
+					return false;
+
+				/*
+				 * Ranking/offset functions, plus the aggregates we already
+				 * push down for GROUP BY used as window aggregates.
+				 */
+				if (wfunc->winagg)
+				{
+					if (!duckdb_is_pushable_aggregate(opername))
+						return false;
+				}
+				else if (!duckdb_is_pushable_window_func(opername))
+					return false;
+
+				if (!duckdb_foreign_expr_walker((Node *) wfunc->args,
+												glob_cxt, &inner_cxt))
+					return false;
+				if (!duckdb_foreign_expr_walker((Node *) wfunc->aggfilter,
+												glob_cxt, &inner_cxt))
+					return false;
+#if PG_VERSION_NUM >= 170000
+				/* See duckdb_is_foreign_window_clause */
+				if (wfunc->runCondition != NIL)
+					return false;
+#endif
+
+				/* The OVER clause must be shippable as well */
+				wc = duckdb_get_window_clause(glob_cxt->root, wfunc->winref);
+				if (wc == NULL ||
+					!duckdb_is_foreign_window_clause(wc, glob_cxt))
+					return false;
+
+				/*
+				 * If function's input collation is not derived from a foreign
+				 * Var, it can't be sent to remote.
+				 */
+				if (wfunc->inputcollid == InvalidOid)
+					 /* OK, inputs are all noncollatable */ ;
+				else if (inner_cxt.state != FDW_COLLATE_SAFE ||
+						 wfunc->inputcollid != inner_cxt.collation)
+					return false;
+
+				/* Result-collation handling is same as for aggregates */
+				collation = wfunc->wincollid;
+				if (collation == InvalidOid)
+					state = FDW_COLLATE_NONE;
+				else if (inner_cxt.state == FDW_COLLATE_SAFE &&
+						 collation == inner_cxt.collation)
+					state = FDW_COLLATE_SAFE;
+				else if (collation == DEFAULT_COLLATION_OID)
+					state = FDW_COLLATE_NONE;
+				else
+					state = FDW_COLLATE_UNSAFE;
+			}
+			break;
 		case T_ArrayExpr:
 			{
 				ArrayExpr  *a = (ArrayExpr *) node;
@@ -1249,7 +1373,7 @@ duckdb_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo
 	context.root = root;
 	context.foreignrel = rel;
 	context.scanrel = IS_UPPER_REL(rel) ?
-		fpinfo->outerrel : rel;
+		duckdb_get_upper_scanrel(rel) : rel;
 	context.params_list = params_list;
 
 	/* Construct SELECT clause */
@@ -1264,7 +1388,7 @@ duckdb_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo
 	{
 		DuckDBFdwRelationInfo *ofpinfo;
 
-		ofpinfo = (DuckDBFdwRelationInfo *) fpinfo->outerrel->fdw_private;
+		ofpinfo = (DuckDBFdwRelationInfo *) context.scanrel->fdw_private;
 		quals = ofpinfo->remote_conds;
 	}
 	else
@@ -1275,17 +1399,45 @@ duckdb_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo
 
 	if (IS_UPPER_REL(rel))
 	{
-		/* Append GROUP BY clause */
-		duckdb_append_group_by_clause(tlist, &context);
+		RelOptInfo *grouped_rel = duckdb_get_upper_stage_rel(rel, UPPERREL_GROUP_AGG);
 
-		/* Append HAVING clause */
-		if (remote_conds)
+		/*
+		 * Upper stages are stacked into a single SELECT: window functions
+		 * are evaluated over the grouped rows, so the GROUP BY and HAVING of
+		 * a pushed-down grouping stage still apply.
+		 */
+		if (grouped_rel != NULL)
 		{
-			appendStringInfo(buf, " HAVING ");
-			duckdb_append_conditions(remote_conds, &context);
+			DuckDBFdwRelationInfo *gfpinfo = (DuckDBFdwRelationInfo *) grouped_rel->fdw_private;
+
+			/* Append GROUP BY clause */
+			if (grouped_rel == rel)
+				duckdb_append_group_by_clause(tlist, false, &context);
+			else
+				duckdb_append_group_by_clause(gfpinfo->grouped_tlist, true, &context);
+
+			/* Append HAVING clause */
+			if (gfpinfo->remote_conds)
+			{
+				appendStringInfo(buf, " HAVING ");
+				duckdb_append_conditions(gfpinfo->remote_conds, &context);
+			}
 		}
 	}
 
+	/*
+	 * DISTINCT ON keeps the first row of each group, so the query's ORDER BY
+	 * has to be evaluated remotely together with it.
+	 */
+	if (IS_UPPER_REL(rel) && root->parse->hasDistinctOn &&
+		root->parse->sortClause != NIL &&
+		duckdb_get_upper_stage_rel(rel, UPPERREL_DISTINCT) != NULL)
+	{
+		appendStringInfoString(buf, " ORDER BY ");
+		duckdb_append_agg_order_by(root->parse->sortClause,
+								   root->processed_tlist, &context);
+	}
+
 	/* Add ORDER BY clause if we found any useful pathkeys */
 	if (pathkeys)
 		duckdb_append_order_by_clause(pathkeys, has_final_sort, &context);
@@ -1314,6 +1466,10 @@ duckdb_deparse_select(List *tlist, List **retrieved_attrs, deparse_expr_cxt *con
 	 */
 	appendStringInfoString(buf, "SELECT ");
 
+	if (IS_UPPER_REL(foreignrel) &&
+		duckdb_get_upper_stage_rel(foreignrel, UPPERREL_DISTINCT) != NULL)
+		duckdb_append_distinct_clause(context);
+
 	if (IS_JOIN_REL(foreignrel) ||
 		fpinfo->is_tlist_func_pushdown == true ||
 		IS_UPPER_REL(foreignrel))
@@ -1481,7 +1637,22 @@ duckdb_deparse_explicit_target_list(List *tlist, List **retrieved_attrs,
             expr_type == TEXTOID ||
             expr_type == VARCHAROID)
         {
-            duckdb_deparse_expr((Expr *) tle->expr, context);
+            /*
+             * Computed numeric columns (sum(int4) is HUGEINT, rank() is
+             * BIGINT, ...) may come back wider than the chunk reader
+             * expects, so pin them to the PostgreSQL result type.
+             */
+            if (!IsA(tle->expr, Var) && expr_type != BOOLOID &&
+                expr_type != TEXTOID && expr_type != VARCHAROID)
+            {
+                appendStringInfoString(buf, "CAST(");
+                duckdb_deparse_expr((Expr *) tle->expr, context);
+                appendStringInfoString(buf, expr_type == INT4OID ? " AS INTEGER)" :
+                                       expr_type == INT8OID ? " AS BIGINT)" :
+                                       " AS DOUBLE)");
+            }
+            else
+                duckdb_deparse_expr((Expr *) tle->expr, context);
         }
         else
         {
@@ -1637,8 +1808,13 @@ duckdb_deparse_from_expr_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo *
 		 * can use NoLock here.
 		 */
 		Relation	rel = table_open(rte->relid, NoLock);
+		char	   *cached = duckdb_local_cache_relation(rte->relid);
 
-		duckdb_deparse_relation(buf, rel);
+		/* Scans of a locally cached table read the fresh copy instead */
+		if (cached != NULL)
+			appendStringInfoString(buf, cached);
+		else
+			duckdb_deparse_relation(buf, rel);
 
 		/*
 		 * Add a unique alias to avoid any conflict in relation names due to
@@ -2282,6 +2458,9 @@ duckdb_deparse_expr(Expr *node, deparse_expr_cxt *context)
 		case T_Aggref:
 			duckdb_deparse_aggref((Aggref *) node, context);
 			break;
+		case T_WindowFunc:
+			duckdb_deparse_window_func((WindowFunc *) node, context);
+			break;
 		default:
 			elog(ERROR, "unsupported expression type for deparse: %d",
 				 (int) nodeTag(node));
@@ -2729,6 +2908,18 @@ duckdb_deparse_const(Const *node, deparse_expr_cxt *context, int showtype)
  */
 static void
 duckdb_deparse_param(Param *node, deparse_expr_cxt *context)
+{
+	duckdb_append_remote_param((Node *) node, node->paramtype, node->paramtypmod,
+							   context);
+}
+
+/*
+ * Send an expression evaluated locally (a Param, or a constant too large to
+ * inline) as a remote query parameter.
+ */
+static void
+duckdb_append_remote_param(Node *node, Oid paramtype, int32 paramtypmod,
+						   deparse_expr_cxt *context)
 {
 	if (context->params_list)
 	{
@@ -2749,11 +2940,11 @@ duckdb_deparse_param(Param *node, deparse_expr_cxt *context)
 			*context->params_list = lappend(*context->params_list, node);
 		}
 
-		duckdb_print_remote_param(pindex, node->paramtype, node->paramtypmod, context);
+		duckdb_print_remote_param(pindex, paramtype, paramtypmod, context);
 	}
 	else
 	{
-		duckdb_print_remote_placeholder(node->paramtype, node->paramtypmod, context);
+		duckdb_print_remote_placeholder(paramtype, paramtypmod, context);
 	}
 }
 
@@ -2938,6 +3129,79 @@ duckdb_deparse_operator_name(StringInfo buf, Form_pg_operator opform)
 	}
 }
 
+/*
+ * Return true if a constant array has more than DUCKDB_MAX_INLINE_ARRAY_ELEMS
+ * elements and can be sent as a bound LIST parameter instead.
+ */
+static bool
+duckdb_is_large_array_const(Const *c)
+{
+	ArrayType  *arr;
+
+	if (c->constisnull ||
+		!duckdb_can_bind_array_type(get_element_type(c->consttype)))
+		return false;
+
+	arr = DatumGetArrayTypeP(c->constvalue);
+	return ARR_NDIM(arr) == 1 &&
+		ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr)) > DUCKDB_MAX_INLINE_ARRAY_ELEMS;
+}
+
+/*
+ * Return true if the given operator, or its negator for "<>", is a member of
+ * a btree operator family.
+ */
+static bool
+duckdb_is_btree_comparison_op(Oid opno)
+{
+	Oid			negator = get_negator(opno);
+	bool		result = false;
+	int			pass;
+
+	for (pass = 0; pass < 2 && !result; pass++)
+	{
+		Oid			op = (pass == 0) ? opno : negator;
+		CatCList   *catlist;
+		int			i;
+
+		if (!OidIsValid(op))
+			continue;
+
+		catlist = SearchSysCacheList1(AMOPOPID, ObjectIdGetDatum(op));
+		for (i = 0; i < catlist->n_members; i++)
+		{
+			Form_pg_amop amop = (Form_pg_amop) GETSTRUCT(&catlist->members[i]->tuple);
+
+			if (amop->amopmethod == BTREE_AM_OID)
+			{
+				result = true;
+				break;
+			}
+		}
+		ReleaseSysCacheList(catlist);
+	}
+
+	return result;
+}
+
+/*
+ * Return true if the array side of the given ScalarArrayOpExpr is sent as a
+ * bound LIST parameter and compared through "x op ANY (SELECT UNNEST($n))".
+ * That form matches PostgreSQL only for btree comparisons against a Param or
+ * Const array; anything else keeps the inlined IN/list form.
+ */
+static bool
+duckdb_is_bound_array_op(ScalarArrayOpExpr *oe)
+{
+	Node	   *arg2 = lsecond(oe->args);
+
+	if (!duckdb_is_btree_comparison_op(oe->opno))
+		return false;
+	if (IsA(arg2, Param))
+		return true;
+	return IsA(arg2, Const) && duckdb_is_large_array_const((Const *) arg2);
+}
+
 /*
  * Deparse given ScalarArrayOpExpr expression.  To avoid problems
  * around priority of operations, we always parenthesize the arguments.
@@ -2977,6 +3241,38 @@ duckdb_deparse_scalar_array_op_expr(ScalarArrayOpExpr *node, deparse_expr_cxt *c
 	arg1 = linitial(node->args);
 	arg2 = lsecond(node->args);
 
+	/*
+	 * Arrays computed at execution time, and constant arrays too large to
+	 * inline, are bound as a single LIST parameter and compared through a
+	 * subquery.  That matches the array form for NULL elements and empty
+	 * arrays, but over a NULL list the subquery is empty, which makes ALL
+	 * true and ANY false where PostgreSQL yields NULL; a NULL parameter is
+	 * therefore mapped to NULL explicitly.
+	 */
+	if (duckdb_is_bound_array_op(node))
+	{
+		appendStringInfoChar(buf, '(');
+		if (IsA(arg2, Param))
+		{
+			appendStringInfoString(buf, "CASE WHEN ");
+			duckdb_deparse_expr(arg2, context);
+			appendStringInfoString(buf, " IS NULL THEN NULL ELSE ");
+		}
+		duckdb_deparse_expr(arg1, context);
+		appendStringInfo(buf, " %s %s (SELECT UNNEST(", opname,
+						 node->useOr ? "ANY" : "ALL");
+		if (IsA(arg2, Const))
+			duckdb_append_remote_param((Node *) arg2, ((Const *) arg2)->consttype,
+									   ((Const *) arg2)->consttypmod, context);
+		else
+			duckdb_deparse_expr(arg2, context);
+		appendStringInfoString(buf, "))");
+		if (IsA(arg2, Param))
+			appendStringInfoString(buf, " END");
+		appendStringInfoChar(buf, ')');
+		return;
+	}
+
 	if (useIn)
 	{
 		/* Deparse left operand. */
@@ -3084,7 +3380,7 @@ duckdb_deparse_scalar_array_op_expr(ScalarArrayOpExpr *node, deparse_expr_cxt *c
 				else
 				{
 					appendStringInfoString(buf, " NULL");
-					return;
+					break;
 				}
 			}
 			break;
@@ -3353,7 +3649,11 @@ duckdb_print_remote_param(int paramindex, Oid paramtype, int32 paramtypmod,
 {
 	StringInfo	buf = context->buf;
 
-	appendStringInfo(buf, "?");
+	/*
+	 * Use numbered parameters: the same Param may be referenced more than
+	 * once but is only bound once.
+	 */
+	appendStringInfo(buf, "$%d", paramindex);
 }
 
 static void
@@ -3393,6 +3693,194 @@ duckdb_is_builtin(Oid oid)
 #endif
 }
 
+/*
+ * Return true if the named pg_catalog aggregate has a DuckDB equivalent.
+ */
+static bool
+duckdb_is_pushable_aggregate(const char *proname)
+{
+	return (strcmp(proname, "sum") == 0
+			|| strcmp(proname, "avg") == 0
+			|| strcmp(proname, "max") == 0
+			|| strcmp(proname, "min") == 0
+			|| strcmp(proname, "array_agg") == 0
+			|| strcmp(proname, "stddev") == 0
+			|| strcmp(proname, "stddev_pop") == 0
+			|| strcmp(proname, "stddev_samp") == 0
+			|| strcmp(proname, "variance") == 0
+			|| strcmp(proname, "var_pop") == 0
+			|| strcmp(proname, "var_samp") == 0
+			|| strcmp(proname, "mode") == 0
+			|| strcmp(proname, "percentile_cont") == 0
+			|| strcmp(proname, "percentile_disc") == 0
+			|| strcmp(proname, "count") == 0);
+}
+
+/*
+ * Return true if the named pg_catalog window function has a DuckDB
+ * equivalent with the same argument conventions.
+ */
+static bool
+duckdb_is_pushable_window_func(const char *proname)
+{
+	return (strcmp(proname, "row_number") == 0
+			|| strcmp(proname, "rank") == 0
+			|| strcmp(proname, "dense_rank") == 0
+			|| strcmp(proname, "percent_rank") == 0
+			|| strcmp(proname, "cume_dist") == 0
+			|| strcmp(proname, "ntile") == 0
+			|| strcmp(proname, "lag") == 0
+			|| strcmp(proname, "lead") == 0
+			|| strcmp(proname, "first_value") == 0
+			|| strcmp(proname, "last_value") == 0
+			|| strcmp(proname, "nth_value") == 0);
+}
+
+/*
+ * Find the WindowClause a WindowFunc refers to.
+ */
+static WindowClause *
+duckdb_get_window_clause(PlannerInfo *root, Index winref)
+{
+	ListCell   *lc;
+
+	foreach(lc, root->parse->windowClause)
+	{
+		WindowClause *wc = lfirst_node(WindowClause, lc);
+
+		if (wc->winref == winref)
+			return wc;
+	}
+	return NULL;
+}
+
+/*
+ * Returns true if the PARTITION BY, ORDER BY and frame offsets of the given
+ * window clause are safe to evaluate on DuckDB.
+ */
+static bool
+duckdb_is_foreign_window_clause(WindowClause *wc, foreign_glob_cxt *glob_cxt)
+{
+	List	   *tlist = glob_cxt->root->processed_tlist;
+	foreign_loc_cxt loc_cxt;
+	ListCell   *lc;
+
+	loc_cxt.collation = InvalidOid;
+	loc_cxt.state = FDW_COLLATE_NONE;
+
+#if PG_VERSION_NUM >= 150000 && PG_VERSION_NUM < 170000
+	/*
+	 * The planner drops an upper qual it turned into a run condition, which
+	 * only the local WindowAgg evaluates.
+	 */
+	if (wc->runCondition != NIL)
+		return false;
+#endif
+
+	foreach(lc, wc->partitionClause)
+	{
+		SortGroupClause *grp = (SortGroupClause *) lfirst(lc);
+		TargetEntry *tle = get_sortgroupref_tle(grp->tleSortGroupRef, tlist);
+
+		if (!duckdb_foreign_expr_walker((Node *) tle->expr, glob_cxt, &loc_cxt))
+			return false;
+	}
+
+	foreach(lc, wc->orderClause)
+	{
+		SortGroupClause *srt = (SortGroupClause *) lfirst(lc);
+		TargetEntry *tle = get_sortgroupref_tle(srt->tleSortGroupRef, tlist);
+
+		if (!duckdb_foreign_expr_walker((Node *) tle->expr, glob_cxt, &loc_cxt))
+			return false;
+		if (!duckdb_is_default_sort_operator(srt, (Node *) tle->expr))
+			return false;
+	}
+
+	/* Frame offsets are only sent as plain constants */
+	if (wc->startOffset != NULL &&
+		(!IsA(wc->startOffset, Const) ||
+		 !duckdb_foreign_expr_walker(wc->startOffset, glob_cxt, &loc_cxt)))
+		return false;
+	if (wc->endOffset != NULL &&
+		(!IsA(wc->endOffset, Const) ||
+		 !duckdb_foreign_expr_walker(wc->endOffset, glob_cxt, &loc_cxt)))
+		return false;
+
+	return loc_cxt.state != FDW_COLLATE_UNSAFE;
+}
+
+/*
+ * Return the base or join relation underneath a stack of pushed-down upper
+ * relations.
+ */
+RelOptInfo *
+duckdb_get_upper_scanrel(RelOptInfo *rel)
+{
+	while (IS_UPPER_REL(rel))
+	{
+		DuckDBFdwRelationInfo *fpinfo = (DuckDBFdwRelationInfo *) rel->fdw_private;
+
+		rel = fpinfo->outerrel;
+	}
+	return rel;
+}
+
+/*
+ * Return the relation for the given stage in a stack of pushed-down upper
+ * relations, or NULL if that stage was not pushed down.
+ */
+static RelOptInfo *
+duckdb_get_upper_stage_rel(RelOptInfo *rel, UpperRelationKind stage)
+{
+	while (IS_UPPER_REL(rel))
+	{
+		DuckDBFdwRelationInfo *fpinfo = (DuckDBFdwRelationInfo *) rel->fdw_private;
+
+		if (fpinfo->stage == stage)
+			return rel;
+		rel = fpinfo->outerrel;
+	}
+	return NULL;
+}
+
+/*
+ * DuckDB has no ORDER BY ... USING, so only the default ascending or
+ * descending operator of the sort key's type can be shipped.
+ */
+static bool
+duckdb_is_default_sort_operator(SortGroupClause *srt, Node *expr)
+{
+	TypeCacheEntry *typentry;
+
+	typentry = lookup_type_cache(exprType(expr),
+								 TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+	return (srt->sortop == typentry->lt_opr || srt->sortop == typentry->gt_opr);
+}
+
+/*
+ * Returns true if all sort keys of the given ORDER BY list can be evaluated
+ * on DuckDB for the upper relation rel.
+ */
+bool
+duckdb_is_foreign_sort_clause(PlannerInfo *root, RelOptInfo *rel, List *sortClause)
+{
+	ListCell   *lc;
+
+	foreach(lc, sortClause)
+	{
+		SortGroupClause *srt = (SortGroupClause *) lfirst(lc);
+		TargetEntry *tle = get_sortgroupref_tle(srt->tleSortGroupRef,
+												root->processed_tlist);
+
+		if (!duckdb_is_foreign_expr(root, rel, tle->expr))
+			return false;
+		if (!duckdb_is_default_sort_operator(srt, (Node *) tle->expr))
+			return false;
+	}
+	return true;
+}
+
 /*
  * Deparse an Aggref node.
  */
@@ -3489,11 +3977,192 @@ duckdb_deparse_aggref(Aggref *node, deparse_expr_cxt *context)
 	appendStringInfoChar(buf, ')');
 }
 
+/*
+ * Deparse a WindowFunc node, including its OVER clause.
+ */
+static void
+duckdb_deparse_window_func(WindowFunc *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	WindowClause *wc;
+
+	duckdb_append_function_name(node->winfnoid, context);
+	appendStringInfoChar(buf, '(');
+
+	/* winstar can be set only in zero-argument aggregates */
+	if (node->winstar)
+		appendStringInfoChar(buf, '*');
+	else
+	{
+		ListCell   *arg;
+		bool		first = true;
+
+		foreach(arg, node->args)
+		{
+			if (!first)
+				appendStringInfoString(buf, ", ");
+			first = false;
+
+			duckdb_deparse_expr((Expr *) lfirst(arg), context);
+		}
+	}
+	appendStringInfoChar(buf, ')');
+
+	/* Add FILTER (WHERE ..) */
+	if (node->aggfilter != NULL)
+	{
+		appendStringInfoString(buf, " FILTER (WHERE ");
+		duckdb_deparse_expr((Expr *) node->aggfilter, context);
+		appendStringInfoChar(buf, ')');
+	}
+
+	wc = duckdb_get_window_clause(context->root, node->winref);
+	if (wc == NULL)
+		elog(ERROR, "could not find window clause for winref %u", node->winref);
+
+	appendStringInfoString(buf, " OVER (");
+	duckdb_append_window_spec(wc, context);
+	appendStringInfoChar(buf, ')');
+}
+
+/*
+ * Deparse the PARTITION BY, ORDER BY and frame clause of a window
+ * definition (cf. ruleutils.c's get_rule_windowspec).
+ */
+static void
+duckdb_append_window_spec(WindowClause *wc, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	List	   *tlist = context->root->processed_tlist;
+	bool		needspace = false;
+	ListCell   *lc;
+
+	if (wc->partitionClause)
+	{
+		bool		first = true;
+
+		appendStringInfoString(buf, "PARTITION BY ");
+		foreach(lc, wc->partitionClause)
+		{
+			SortGroupClause *grp = (SortGroupClause *) lfirst(lc);
+
+			if (!first)
+				appendStringInfoString(buf, ", ");
+			first = false;
+
+			duckdb_deparse_sort_group_clause(grp->tleSortGroupRef, tlist, false,
+											 context);
+		}
+		needspace = true;
+	}
+
+	if (wc->orderClause)
+	{
+		if (needspace)
+			appendStringInfoChar(buf, ' ');
+		appendStringInfoString(buf, "ORDER BY ");
+		duckdb_append_agg_order_by(wc->orderClause, tlist, context);
+		needspace = true;
+	}
+
+	/* Both PostgreSQL and DuckDB default to RANGE UNBOUNDED PRECEDING */
+	if (!(wc->frameOptions & FRAMEOPTION_NONDEFAULT))
+		return;
+
+	if (needspace)
+		appendStringInfoChar(buf, ' ');
+	if (wc->frameOptions & FRAMEOPTION_RANGE)
+		appendStringInfoString(buf, "RANGE ");
+	else if (wc->frameOptions & FRAMEOPTION_ROWS)
+		appendStringInfoString(buf, "ROWS ");
+	else if (wc->frameOptions & FRAMEOPTION_GROUPS)
+		appendStringInfoString(buf, "GROUPS ");
+	else
+		Assert(false);
+
+	if (wc->frameOptions & FRAMEOPTION_BETWEEN)
+		appendStringInfoString(buf, "BETWEEN ");
+
+	if (wc->frameOptions & FRAMEOPTION_START_UNBOUNDED_PRECEDING)
+		appendStringInfoString(buf, "UNBOUNDED PRECEDING");
+	else if (wc->frameOptions & FRAMEOPTION_START_CURRENT_ROW)
+		appendStringInfoString(buf, "CURRENT ROW");
+	else if (wc->frameOptions & FRAMEOPTION_START_OFFSET)
+	{
+		duckdb_deparse_expr((Expr *) wc->startOffset, context);
+		if (wc->frameOptions & FRAMEOPTION_START_OFFSET_PRECEDING)
+			appendStringInfoString(buf, " PRECEDING");
+		else
+			appendStringInfoString(buf, " FOLLOWING");
+	}
+
+	if (wc->frameOptions & FRAMEOPTION_BETWEEN)
+	{
+		appendStringInfoString(buf, " AND ");
+		if (wc->frameOptions & FRAMEOPTION_END_UNBOUNDED_FOLLOWING)
+			appendStringInfoString(buf, "UNBOUNDED FOLLOWING");
+		else if (wc->frameOptions & FRAMEOPTION_END_CURRENT_ROW)
+			appendStringInfoString(buf, "CURRENT ROW");
+		else if (wc->frameOptions & FRAMEOPTION_END_OFFSET)
+		{
+			duckdb_deparse_expr((Expr *) wc->endOffset, context);
+			if (wc->frameOptions & FRAMEOPTION_END_OFFSET_PRECEDING)
+				appendStringInfoString(buf, " PRECEDING");
+			else
+				appendStringInfoString(buf, " FOLLOWING");
+		}
+	}
+
+	if (wc->frameOptions & FRAMEOPTION_EXCLUDE_CURRENT_ROW)
+		appendStringInfoString(buf, " EXCLUDE CURRENT ROW");
+	else if (wc->frameOptions & FRAMEOPTION_EXCLUDE_GROUP)
+		appendStringInfoString(buf, " EXCLUDE GROUP");
+	else if (wc->frameOptions & FRAMEOPTION_EXCLUDE_TIES)
+		appendStringInfoString(buf, " EXCLUDE TIES");
+}
+
+/*
+ * Deparse DISTINCT or DISTINCT ON (...) after the SELECT keyword.
+ */
+static void
+duckdb_append_distinct_clause(deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	Query	   *query = context->root->parse;
+	ListCell   *lc;
+	bool		first = true;
+
+	if (!query->hasDistinctOn)
+	{
+		appendStringInfoString(buf, "DISTINCT ");
+		return;
+	}
+
+	appendStringInfoString(buf, "DISTINCT ON (");
+	foreach(lc, query->distinctClause)
+	{
+		SortGroupClause *grp = (SortGroupClause *) lfirst(lc);
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		duckdb_deparse_sort_group_clause(grp->tleSortGroupRef,
+										 context->root->processed_tlist, false,
+										 context);
+	}
+	appendStringInfoString(buf, ") ");
+}
+
 /*
  * Deparse GROUP BY clause.
+ *
+ * Grouping columns are normally referenced by their position in tlist.  When
+ * a later upper stage supplies the SELECT list, use_exprs makes us deparse
+ * the grouping expressions themselves from the grouping stage's tlist.
  */
 static void
-duckdb_append_group_by_clause(List *tlist, deparse_expr_cxt *context)
+duckdb_append_group_by_clause(List *tlist, bool use_exprs, deparse_expr_cxt *context)
 {
 	StringInfo	buf = context->buf;
 	Query	   *query = context->root->parse;
@@ -3520,7 +4189,8 @@ duckdb_append_group_by_clause(List *tlist, deparse_expr_cxt *context)
 			appendStringInfoString(buf, ", ");
 		first = false;
 
-		duckdb_deparse_sort_group_clause(grp->tleSortGroupRef, tlist, true, context);
+		duckdb_deparse_sort_group_clause(grp->tleSortGroupRef, tlist, !use_exprs,
+										 context);
 	}
 }
 
@@ -0,0 +1,305 @@
+/*-------------------------------------------------------------------------
+ *
+ * DuckDB Foreign Data Wrapper for PostgreSQL
+ *
+ * IDENTIFICATION
+ *        diskcache.c
+ *
+ * Size limits for local cache directories shared by all backends.  A server
+ * with disk_cache_directory loads DuckDB's cache_httpfs extension in on-disk
+ * mode, so remote reads of every backend land as block files in one shared
+ * subdirectory of it; the result cache keeps its files in
+ * result_cache_directory.  Neither bounds itself, so backends trim the
+ * directories here, least recently used files first, deleting only files
+ * the cache wrote.  A lock on a lock file in the directory (flock, or
+ * LockFileEx on Windows) keeps two backends from trimming at once.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "duckdb_fdw.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/file.h>
+#endif
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "commands/defrem.h"
+#include "storage/fd.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+/* Seconds between size checks of the cache directory in one backend */
+#define DUCKDB_DISK_CACHE_CHECK_INTERVAL	30
+
+/* Trim to this fraction of the limit, so the next check has headroom */
+#define DUCKDB_DISK_CACHE_LOW_WATERMARK		0.9
+
+#define DUCKDB_DISK_CACHE_LOCK_FILE		".duckdb_fdw.lock"
+
+/* Subdirectory of disk_cache_directory that cache_httpfs owns */
+#define DUCKDB_DISK_CACHE_SUBDIR		"cache_httpfs"
+
+typedef struct DuckDBCacheFile
+{
+	char	   *path;
+	off_t		size;
+	time_t		used;			/* last access, or modification if later */
+} DuckDBCacheFile;
+
+/* When this backend last checked each cache directory's size */
+typedef struct DuckDBCacheCheck
+{
+	char	   *directory;
+	TimestampTz checked_at;
+} DuckDBCacheCheck;
+
+static List *cache_checks = NIL;
+
+/*
+ * Parse a disk_cache_max_size value such as '20GB' into megabytes.
+ */
+bool
+duckdb_disk_cache_parse_size(const char *value, int *size_mb)
+{
+	const char *hintmsg;
+
+	return parse_int(value, size_mb, GUC_UNIT_MB, &hintmsg) && *size_mb > 0;
+}
+
+/*
+ * The directory cache_httpfs keeps the server's blocks in, under its
+ * disk_cache_directory, and the size limit in megabytes (0 when
+ * unlimited).  Returns false when the server has no disk cache.
+ */
+bool
+duckdb_server_disk_cache(ForeignServer *server, char **directory, int *max_size_mb)
+{
+	ListCell   *lc;
+
+	*directory = NULL;
+	*max_size_mb = 0;
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "disk_cache_directory") == 0)
+			*directory = psprintf("%s/%s", defGetString(def), DUCKDB_DISK_CACHE_SUBDIR);
+		else if (strcmp(def->defname, "disk_cache_max_size") == 0)
+			(void) duckdb_disk_cache_parse_size(defGetString(def), max_size_mb);
+	}
+	return *directory != NULL;
+}
+
+static int
+duckdb_cache_file_cmp(const void *a, const void *b)
+{
+	time_t		ua = ((const DuckDBCacheFile *) a)->used;
+	time_t		ub = ((const DuckDBCacheFile *) b)->used;
+
+	if (ua < ub)
+		return -1;
+	if (ua > ub)
+		return 1;
+	return 0;
+}
+
+/*
+ * Delete the least recently used files of directory until it holds at most
+ * the low watermark of max_bytes.  Only files is_cache_file accepts (every
+ * file when it is NULL) are counted and deleted.  Caller holds the
+ * directory's lock.
+ */
+static void
+duckdb_disk_cache_trim(const char *directory, uint64 max_bytes,
+					   DuckDBCacheFileFilter is_cache_file)
+{
+	DIR		   *dir;
+	struct dirent *de;
+	DuckDBCacheFile *files;
+	int			nfiles = 0;
+	int			maxfiles = 64;
+	uint64		total = 0;
+	uint64		target;
+
+	dir = AllocateDir(directory);
+	if (dir == NULL)
+		return;
+
+	files = palloc(maxfiles * sizeof(DuckDBCacheFile));
+	while ((de = ReadDirExtended(dir, directory, LOG)) != NULL)
+	{
+		char	   *path;
+		struct stat st;
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+			strcmp(de->d_name, DUCKDB_DISK_CACHE_LOCK_FILE) == 0 ||
+			(is_cache_file != NULL && !is_cache_file(de->d_name)))
+			continue;
+
+		path = psprintf("%s/%s", directory, de->d_name);
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+		{
+			pfree(path);
+			continue;
+		}
+
+		if (nfiles == maxfiles)
+		{
+			maxfiles *= 2;
+			files = repalloc(files, maxfiles * sizeof(DuckDBCacheFile));
+		}
+		files[nfiles].path = path;
+		files[nfiles].size = st.st_size;
+		files[nfiles].used = Max(st.st_atime, st.st_mtime);
+		total += st.st_size;
+		nfiles++;
+	}
+	FreeDir(dir);
+
+	if (total > max_bytes)
+	{
+		target = (uint64) (max_bytes * DUCKDB_DISK_CACHE_LOW_WATERMARK);
+		qsort(files, nfiles, sizeof(DuckDBCacheFile), duckdb_cache_file_cmp);
+		for (int i = 0; i < nfiles && total > target; i++)
+		{
+			/* Readers that have the file open keep their copy */
+			if (unlink(files[i].path) == 0)
+				total -= files[i].size;
+			else if (errno != ENOENT)
+				ereport(LOG,
+						(errcode_for_file_access(),
+						 errmsg("duckdb_fdw: could not remove cache file \"%s\": %m",
+								files[i].path)));
+		}
+	}
+
+	for (int i = 0; i < nfiles; i++)
+		pfree(files[i].path);
+	pfree(files);
+}
+
+/*
+ * Whether directory is due for a size check: this backend checks each
+ * directory at most every interval_secs.  Records the check when it is due.
+ */
+bool
+duckdb_cache_check_due(const char *directory, int interval_secs)
+{
+	TimestampTz now = GetCurrentTimestamp();
+	DuckDBCacheCheck *check = NULL;
+	ListCell   *lc;
+
+	foreach(lc, cache_checks)
+	{
+		DuckDBCacheCheck *c = (DuckDBCacheCheck *) lfirst(lc);
+
+		if (strcmp(c->directory, directory) == 0)
+		{
+			check = c;
+			break;
+		}
+	}
+
+	if (check == NULL)
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+		check = palloc(sizeof(DuckDBCacheCheck));
+		check->directory = pstrdup(directory);
+		cache_checks = lappend(cache_checks, check);
+		MemoryContextSwitchTo(oldcxt);
+	}
+	else if (!TimestampDifferenceExceeds(check->checked_at, now, interval_secs * 1000))
+		return false;
+
+	check->checked_at = now;
+	return true;
+}
+
+/*
+ * Take the lock file's lock without waiting; false if another backend
+ * holds it.
+ */
+static bool
+duckdb_cache_lock(int fd)
+{
+#ifdef _WIN32
+	OVERLAPPED	overlapped = {0};
+
+	return LockFileEx((HANDLE) _get_osfhandle(fd),
+					  LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY,
+					  0, 1, 0, &overlapped);
+#else
+	return flock(fd, LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+static void
+duckdb_cache_unlock(int fd)
+{
+#ifdef _WIN32
+	OVERLAPPED	overlapped = {0};
+
+	(void) UnlockFileEx((HANDLE) _get_osfhandle(fd), 0, 1, 0, &overlapped);
+#else
+	(void) flock(fd, LOCK_UN);
+#endif
+}
+
+/*
+ * Trim a cache directory to max_size_mb, unless another backend is already
+ * trimming it.  is_cache_file recognizes the files the cache wrote; NULL
+ * means the directory holds nothing else.
+ */
+void
+duckdb_trim_cache_directory(const char *directory, int max_size_mb,
+							DuckDBCacheFileFilter is_cache_file)
+{
+	char	   *lock_path;
+	int			fd;
+
+	lock_path = psprintf("%s/%s", directory, DUCKDB_DISK_CACHE_LOCK_FILE);
+	fd = OpenTransientFile(lock_path, O_RDWR | O_CREAT | PG_BINARY);
+	if (fd < 0)
+	{
+		/* Nothing is cached until the directory exists */
+		pfree(lock_path);
+		return;
+	}
+
+	if (duckdb_cache_lock(fd))
+	{
+		duckdb_disk_cache_trim(directory, (uint64) max_size_mb * 1024 * 1024,
+							   is_cache_file);
+		duckdb_cache_unlock(fd);
+	}
+
+	CloseTransientFile(fd);
+	pfree(lock_path);
+}
+
+/*
+ * Keep the server's disk cache under its size limit.  Called when a scan
+ * or insert leases a connection; each directory is listed at most every
+ * DUCKDB_DISK_CACHE_CHECK_INTERVAL seconds per backend.
+ */
+void
+duckdb_disk_cache_maintain(ForeignServer *server)
+{
+	char	   *directory;
+	int			max_size_mb;
+
+	if (!duckdb_server_disk_cache(server, &directory, &max_size_mb) || max_size_mb == 0)
+		return;
+	if (!duckdb_cache_check_due(directory, DUCKDB_DISK_CACHE_CHECK_INTERVAL))
+		return;
+
+	/* cache_httpfs is the only writer of its subdirectory */
+	duckdb_trim_cache_directory(directory, max_size_mb, NULL);
+}
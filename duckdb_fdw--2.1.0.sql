@@ -0,0 +1,103 @@
+/* duckdb_fdw--2.1.0.sql */
+
+CREATE FUNCTION duckdb_fdw_handler()
+RETURNS fdw_handler
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION duckdb_fdw_validator(text[], oid)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FOREIGN DATA WRAPPER duckdb_fdw
+  HANDLER duckdb_fdw_handler
+  VALIDATOR duckdb_fdw_validator;
+
+CREATE FUNCTION duckdb_fdw_version()
+  RETURNS text STRICT
+  AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION duckdb_fdw_runtime_compatibility_status()
+  RETURNS text
+  AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION duckdb_fdw_runtime_fingerprint()
+  RETURNS jsonb
+  AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION duckdb_fdw_preflight()
+  RETURNS jsonb
+  AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION duckdb_execute(server name, statement text)
+RETURNS void STRICT
+AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION duckdb_create_s3_secret(server name, secret_name text, key_id text, secret text, region text DEFAULT NULL)
+RETURNS void
+AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION duckdb_fdw_prepared_statement_cache_stats(
+    OUT hits bigint,
+    OUT misses bigint,
+    OUT evictions bigint,
+    OUT entries integer)
+  RETURNS record
+  AS 'MODULE_PATHNAME' LANGUAGE C;
+
+CREATE FUNCTION duckdb_fdw_stat_statements(
+    OUT userid oid,
+    OUT dbid oid,
+    OUT serverid oid,
+    OUT queryid bigint,
+    OUT query text,
+    OUT calls bigint,
+    OUT total_exec_time double precision,
+    OUT min_exec_time double precision,
+    OUT max_exec_time double precision,
+    OUT mean_exec_time double precision,
+    OUT rows bigint,
+    OUT total_convert_time double precision,
+    OUT fallback_cells bigint)
+  RETURNS SETOF record
+  AS 'MODULE_PATHNAME' LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW duckdb_fdw_stat_statements AS
+  SELECT * FROM duckdb_fdw_stat_statements();
+
+CREATE FUNCTION duckdb_fdw_stat_statements_reset()
+  RETURNS void
+  AS 'MODULE_PATHNAME' LANGUAGE C PARALLEL SAFE;
+
+REVOKE EXECUTE ON FUNCTION duckdb_fdw_stat_statements_reset() FROM PUBLIC;
+
+CREATE FUNCTION duckdb_fdw_progress(
+    OUT pid integer,
+    OUT serverid oid,
+    OUT query_start timestamptz,
+    OUT query text,
+    OUT percentage double precision,
+    OUT rows_processed bigint,
+    OUT total_rows bigint)
+  RETURNS SETOF record
+  AS 'MODULE_PATHNAME' LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE FUNCTION duckdb_fdw_refresh_cache(regclass)
+  RETURNS bigint
+  AS 'MODULE_PATHNAME' LANGUAGE C STRICT VOLATILE PARALLEL UNSAFE;
+
+CREATE FUNCTION duckdb_fdw_result_cache_stats(
+    OUT hits bigint,
+    OUT misses bigint,
+    OUT bypasses bigint)
+  RETURNS record
+  AS 'MODULE_PATHNAME' LANGUAGE C;
+
+REVOKE EXECUTE ON FUNCTION duckdb_execute(name, text) FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION duckdb_create_s3_secret(name, text, text, text, text) FROM PUBLIC;
+
+COMMENT ON FUNCTION duckdb_execute(name, text)
+IS 'executes an arbitrary SQL statement on DuckDB';
+
+SELECT duckdb_fdw_preflight();
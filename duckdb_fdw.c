@@ -2,6 +2,7 @@
 #include "duckdb_fdw.h"
 #include "access/xact.h"
 #include "executor/spi.h"
+#include "utils/array.h"
 #include "utils/uuid.h"
 #include "utils/numeric.h"
 #include "access/reloptions.h"
@@ -9,6 +10,7 @@
 #include "optimizer/optimizer.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/planmain.h"
+#include "optimizer/tlist.h"
 #include "utils/memutils.h"
 #include "utils/builtins.h"
 #include "utils/rel.h"
@@ -18,14 +20,20 @@
 #include "utils/date.h"
 #include "utils/guc.h"
 #include "utils/json.h"
+#include "utils/datum.h"
 #include "utils/fmgrprotos.h"
 #include "utils/timestamp.h"
 #include "utils/lsyscache.h"
+#include "utils/selfuncs.h"
 #include "utils/syscache.h"
 #include "catalog/pg_user_mapping.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 #include "executor/executor.h"
 #include "commands/explain.h"
+#if PG_VERSION_NUM >= 180000
+#include "commands/explain_format.h"
+#endif
 #include "nodes/nodeFuncs.h"
 
 PG_MODULE_MAGIC;
@@ -33,7 +41,39 @@ PG_MODULE_MAGIC;
 #define DUCKDB_EPOCH_DIFF_DAYS 10957
 #define DUCKDB_EPOCH_DIFF_MICROS INT64CONST(946684800000000)
 
+/* Rows sent to the shared host per INSERT statement */
+#define DUCKDB_HOST_INSERT_BATCH 1000
+
 bool duckdb_fdw_allow_unsupported_pg_duckdb_coexistence = false;
+int duckdb_fdw_prepared_statement_cache_size = 32;
+int duckdb_fdw_max_connections_per_server = 4;
+int duckdb_fdw_threads = 0;
+char *duckdb_fdw_memory_limit = NULL;
+char *duckdb_fdw_temp_directory = NULL;
+char *duckdb_fdw_max_temp_directory_size = NULL;
+bool duckdb_fdw_preserve_insertion_order = true;
+char *duckdb_fdw_default_order = NULL;
+int duckdb_fdw_cluster_threads = 0;
+int duckdb_fdw_cluster_memory_limit = 0;
+int duckdb_fdw_budget_wait_timeout = 1000;
+bool duckdb_fdw_host_worker = false;
+int duckdb_fdw_stat_statements_max = 1000;
+bool duckdb_fdw_track_statements = true;
+int duckdb_fdw_metadata_estimates = DUCKDB_METADATA_ESTIMATES_LOCAL;
+int duckdb_fdw_metadata_cache_ttl = 60;
+
+static const struct config_enum_entry metadata_estimates_options[] = {
+	{"off", DUCKDB_METADATA_ESTIMATES_OFF, false},
+	{"local", DUCKDB_METADATA_ESTIMATES_LOCAL, false},
+	{"on", DUCKDB_METADATA_ESTIMATES_ON, false},
+	{"false", DUCKDB_METADATA_ESTIMATES_OFF, true},
+	{"true", DUCKDB_METADATA_ESTIMATES_ON, true},
+	{"no", DUCKDB_METADATA_ESTIMATES_OFF, true},
+	{"yes", DUCKDB_METADATA_ESTIMATES_ON, true},
+	{"0", DUCKDB_METADATA_ESTIMATES_OFF, true},
+	{"1", DUCKDB_METADATA_ESTIMATES_ON, true},
+	{NULL, 0, false}
+};
 
 static void duckdb_estimate_path_cost_size(PlannerInfo *root, RelOptInfo *foreignrel,
 										   List *param_join_conds, List *pathkeys,
@@ -51,17 +91,13 @@ static void duckdb_fdw_preflight_probe(bool *installed_in_database,
 									   bool *available_in_instance,
 									   bool *catalog_lookup_ok);
 
-static char *
+char *
 duckdb_build_relation_reference(const char *table_name)
 {
 	if (!table_name)
 		return pstrdup("\"\"");
 
-	if (!duckdb_fdw_is_safe_sql_fragment(table_name))
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-				 errmsg("unsafe table option value")));
-
+	/* Parquet paths, globs included, are quoted; see duckdb_deparse_relation */
 	if (strstr(table_name, ".parquet") != NULL &&
 		strstr(table_name, "read_parquet") == NULL)
 	{
@@ -71,6 +107,11 @@ duckdb_build_relation_reference(const char *table_name)
 		return expr;
 	}
 
+	if (!duckdb_fdw_is_safe_sql_fragment(table_name))
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+				 errmsg("unsafe table option value")));
+
 	if (strstr(table_name, "read_parquet") != NULL ||
 		strstr(table_name, "read_csv") != NULL ||
 		strchr(table_name, '(') != NULL)
@@ -84,12 +125,280 @@ duckdb_build_relation_reference(const char *table_name)
 	return duckdb_fdw_quote_identifier(table_name);
 }
 
+/*
+ * Map a PostgreSQL type to the DuckDB type its values are bound as, or
+ * DUCKDB_TYPE_INVALID if they are sent as text.  NUMERIC is bound as
+ * DECIMAL, whose width and scale depend on the value.
+ */
+static duckdb_type
+duckdb_bind_type_for(Oid typid)
+{
+	switch (typid)
+	{
+		case BOOLOID:
+			return DUCKDB_TYPE_BOOLEAN;
+		case INT2OID:
+			return DUCKDB_TYPE_SMALLINT;
+		case INT4OID:
+			return DUCKDB_TYPE_INTEGER;
+		case INT8OID:
+			return DUCKDB_TYPE_BIGINT;
+		case FLOAT4OID:
+			return DUCKDB_TYPE_FLOAT;
+		case FLOAT8OID:
+			return DUCKDB_TYPE_DOUBLE;
+		case NUMERICOID:
+			return DUCKDB_TYPE_DECIMAL;
+		case DATEOID:
+			return DUCKDB_TYPE_DATE;
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			return DUCKDB_TYPE_TIMESTAMP;
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			return DUCKDB_TYPE_VARCHAR;
+		case BYTEAOID:
+			return DUCKDB_TYPE_BLOB;
+		case UUIDOID:
+			return DUCKDB_TYPE_UUID;
+		case INTERVALOID:
+			return DUCKDB_TYPE_INTERVAL;
+		default:
+			return DUCKDB_TYPE_INVALID;
+	}
+}
+
+/*
+ * Return true if a one-dimensional array of elemtype can be bound as a DuckDB
+ * LIST parameter.  Used by deparse to decide whether an array constant is
+ * sent as a parameter rather than inlined.
+ */
+bool
+duckdb_can_bind_array_type(Oid elemtype)
+{
+	return duckdb_bind_type_for(elemtype) != DUCKDB_TYPE_INVALID;
+}
+
+/*
+ * Convert a finite NUMERIC to a DuckDB DECIMAL(38, scale).  Returns false for
+ * NaN, infinities and values that need more than 38 digits.
+ */
+static bool
+duckdb_numeric_to_decimal(Datum val, duckdb_decimal *dec)
+{
+#ifdef HAVE_INT128
+	char	   *str = DatumGetCString(DirectFunctionCall1(numeric_out, val));
+	char	   *p = str;
+	bool		negative = false;
+	bool		fraction = false;
+	bool		ok;
+	int			digits = 0;
+	int			scale = 0;
+	int128		unscaled = 0;
+
+	if (*p == '-')
+	{
+		negative = true;
+		p++;
+	}
+	for (; *p; p++)
+	{
+		if (*p == '.')
+		{
+			fraction = true;
+			continue;
+		}
+		if (*p < '0' || *p > '9')
+			break;
+		if (unscaled != 0 || *p != '0')
+			digits++;
+		if (digits > 38)
+			break;
+		unscaled = unscaled * 10 + (*p - '0');
+		if (fraction)
+			scale++;
+	}
+	ok = (*p == '\0' && scale <= 38);
+	pfree(str);
+	if (!ok)
+		return false;
+
+	if (negative)
+		unscaled = -unscaled;
+	dec->width = 38;
+	dec->scale = (uint8_t) scale;
+	dec->value.lower = (uint64_t) unscaled;
+	dec->value.upper = (int64_t) (unscaled >> 64);
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Build a DuckDB value for a non-null scalar datum, or return NULL if the
+ * type (or this particular value) has no native mapping.
+ */
+static duckdb_value
+duckdb_datum_to_value(Oid typid, Datum val)
+{
+	switch (typid)
+	{
+		case BOOLOID:
+			return duckdb_create_bool(DatumGetBool(val));
+		case INT2OID:
+			return duckdb_create_int16(DatumGetInt16(val));
+		case INT4OID:
+			return duckdb_create_int32(DatumGetInt32(val));
+		case INT8OID:
+			return duckdb_create_int64(DatumGetInt64(val));
+		case FLOAT4OID:
+			return duckdb_create_float(DatumGetFloat4(val));
+		case FLOAT8OID:
+			return duckdb_create_double(DatumGetFloat8(val));
+		case NUMERICOID:
+			{
+				duckdb_decimal dec;
+
+				if (!duckdb_numeric_to_decimal(val, &dec))
+					return NULL;
+				return duckdb_create_decimal(dec);
+			}
+		case DATEOID:
+			{
+				duckdb_date date = {DatumGetDateADT(val) + DUCKDB_EPOCH_DIFF_DAYS};
+
+				return duckdb_create_date(date);
+			}
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			{
+				duckdb_timestamp ts;
+
+				ts.micros = DatumGetInt64(val) + DUCKDB_EPOCH_DIFF_MICROS;
+				return duckdb_create_timestamp(ts);
+			}
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
+			{
+				text	   *t = DatumGetTextPP(val);
+
+				return duckdb_create_varchar_length(VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t));
+			}
+		case BYTEAOID:
+			{
+				bytea	   *b = DatumGetByteaPP(val);
+
+				return duckdb_create_blob((const uint8_t *) VARDATA_ANY(b),
+										  VARSIZE_ANY_EXHDR(b));
+			}
+		case UUIDOID:
+			{
+				pg_uuid_t  *uuid = DatumGetUUIDP(val);
+				duckdb_uhugeint u = {0, 0};
+				int			i;
+
+				/* DuckDB takes the UUID as a big-endian 128-bit integer */
+				for (i = 0; i < UUID_LEN / 2; i++)
+					u.upper = (u.upper << 8) | uuid->data[i];
+				for (; i < UUID_LEN; i++)
+					u.lower = (u.lower << 8) | uuid->data[i];
+				return duckdb_create_uuid(u);
+			}
+		case INTERVALOID:
+			{
+				Interval   *span = DatumGetIntervalP(val);
+				duckdb_interval iv;
+
+#if PG_VERSION_NUM >= 170000
+				if (INTERVAL_NOT_FINITE(span))
+					return NULL;
+#endif
+				iv.months = span->month;
+				iv.days = span->day;
+				iv.micros = span->time;
+				return duckdb_create_interval(iv);
+			}
+		default:
+			return NULL;
+	}
+}
+
+/*
+ * Build a DuckDB LIST value from a PostgreSQL array, or return NULL if the
+ * array has no native mapping.  Array parameters feed = ANY / <> ALL, which
+ * read a multi-dimensional array as the flat list of its elements, so that
+ * is what it is bound as rather than a nested list.
+ */
+static duckdb_value
+duckdb_array_to_list_value(Oid elemtype, Datum val)
+{
+	ArrayType  *arr = DatumGetArrayTypeP(val);
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int			max_scale = 0;
+	int			i;
+	duckdb_value *values;
+	duckdb_logical_type child_type;
+	duckdb_value result = NULL;
+
+	if (duckdb_bind_type_for(elemtype) == DUCKDB_TYPE_INVALID)
+		return NULL;
+
+	get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+	deconstruct_array(arr, elemtype, typlen, typbyval, typalign,
+					  &elems, &nulls, &nelems);
+
+	values = (duckdb_value *) palloc0(sizeof(duckdb_value) * Max(nelems, 1));
+	for (i = 0; i < nelems; i++)
+	{
+		if (nulls[i])
+			values[i] = duckdb_create_null_value();
+		else
+			values[i] = duckdb_datum_to_value(elemtype, elems[i]);
+		if (values[i] == NULL)
+			break;
+		if (elemtype == NUMERICOID && !nulls[i])
+		{
+			duckdb_logical_type t = duckdb_get_value_type(values[i]);
+
+			max_scale = Max(max_scale, duckdb_decimal_scale(t));
+		}
+	}
+
+	if (i == nelems)
+	{
+		/* Element decimals are widened to the largest scale in the list */
+		if (elemtype == NUMERICOID)
+			child_type = duckdb_create_decimal_type(38, max_scale);
+		else
+			child_type = duckdb_create_logical_type(duckdb_bind_type_for(elemtype));
+		result = duckdb_create_list_value(child_type, values, nelems);
+		duckdb_destroy_logical_type(&child_type);
+	}
+
+	while (--i >= 0)
+		duckdb_destroy_value(&values[i]);
+	pfree(values);
+	pfree(elems);
+	pfree(nulls);
+	return result;
+}
+
 static void
 duckdb_bind_parameter(duckdb_prepared_statement stmt, idx_t param_idx, Oid typid, Datum val, bool isnull)
 {
 	Oid			typoutput;
 	bool		typisvarlena;
+	Oid			elemtype;
 	char	   *outstr;
+	duckdb_value value;
 
 	if (isnull)
 	{
@@ -140,41 +449,222 @@ duckdb_bind_parameter(duckdb_prepared_statement stmt, idx_t param_idx, Oid typid
 					elog(ERROR, "duckdb_fdw: bind timestamp failed at parameter %zu", (size_t) param_idx);
 				return;
 			}
-		default:
-			getTypeOutputInfo(typid, &typoutput, &typisvarlena);
-			outstr = OidOutputFunctionCall(typoutput, val);
-			if (duckdb_bind_varchar(stmt, param_idx, outstr) == DuckDBError)
+		case TEXTOID:
+		case VARCHAROID:
+		case BPCHAROID:
 			{
-				pfree(outstr);
-				elog(ERROR, "duckdb_fdw: bind text fallback failed at parameter %zu", (size_t) param_idx);
+				text	   *t = DatumGetTextPP(val);
+				if (duckdb_bind_varchar_length(stmt, param_idx, VARDATA_ANY(t),
+											   VARSIZE_ANY_EXHDR(t)) == DuckDBError)
+					elog(ERROR, "duckdb_fdw: bind text failed at parameter %zu", (size_t) param_idx);
+				return;
 			}
-			pfree(outstr);
-			return;
+		case BYTEAOID:
+			{
+				bytea	   *b = DatumGetByteaPP(val);
+				if (duckdb_bind_blob(stmt, param_idx, VARDATA_ANY(b),
+									 VARSIZE_ANY_EXHDR(b)) == DuckDBError)
+					elog(ERROR, "duckdb_fdw: bind bytea failed at parameter %zu", (size_t) param_idx);
+				return;
+			}
+		default:
+			break;
+	}
+
+	/* NUMERIC, UUID, INTERVAL and arrays of bindable types */
+	elemtype = get_element_type(typid);
+	if (OidIsValid(elemtype))
+		value = duckdb_array_to_list_value(elemtype, val);
+	else
+		value = duckdb_datum_to_value(typid, val);
+
+	if (value != NULL)
+	{
+		duckdb_state rc = duckdb_bind_value(stmt, param_idx, value);
+
+		duckdb_destroy_value(&value);
+		if (rc == DuckDBError)
+			elog(ERROR, "duckdb_fdw: bind %s failed at parameter %zu",
+				 format_type_be(typid), (size_t) param_idx);
+		return;
+	}
+
+	getTypeOutputInfo(typid, &typoutput, &typisvarlena);
+	outstr = OidOutputFunctionCall(typoutput, val);
+	if (duckdb_bind_varchar(stmt, param_idx, outstr) == DuckDBError)
+	{
+		pfree(outstr);
+		elog(ERROR, "duckdb_fdw: bind text fallback failed at parameter %zu", (size_t) param_idx);
+	}
+	pfree(outstr);
+}
+
+/*
+ * Prepare the remote query if it has parameters.  The prepared statement is
+ * kept for the life of the scan so rescans only have to re-bind and execute,
+ * and comes from the connection's statement cache when the same SQL ran
+ * before.
+ */
+static void
+duckdb_prepare_query(DuckDBFdwExecState *festate, ForeignScanState *node, ForeignScan *fsplan)
+{
+	if (fsplan->fdw_exprs == NIL)
+	{
+		festate->use_prepared_stmt = false;
+		return;
+	}
+
+	festate->param_exprs = fsplan->fdw_exprs;
+	festate->param_expr_states = ExecInitExprList(fsplan->fdw_exprs, &node->ss.ps);
+	if (!festate->use_host)
+		festate->prepared_stmt = duckdb_acquire_prepared_statement(festate->conn, festate->query);
+	festate->use_prepared_stmt = true;
+}
+
+/*
+ * Fetch one metric of a DuckDB profiling node as a palloc'd string, or NULL
+ * if the profiler did not record it.
+ */
+static char *
+duckdb_profile_metric(duckdb_profiling_info info, const char *key)
+{
+	duckdb_value value = duckdb_profiling_info_get_value(info, key);
+	char	   *str;
+	char	   *result;
+
+	if (value == NULL)
+		return NULL;
+	str = duckdb_get_varchar(value);
+	result = str ? pstrdup(str) : NULL;
+	duckdb_free(str);
+	duckdb_destroy_value(&value);
+	return result;
+}
+
+/* One operator of the DuckDB profiler's tree, as saved for EXPLAIN */
+typedef struct DuckDBProfileNode
+{
+	int			depth;
+	char	   *type;
+	double		time_ms;
+	char	   *rows;
+} DuckDBProfileNode;
+
+static void
+duckdb_collect_profile_node(duckdb_profiling_info info, int depth, List **nodes)
+{
+	char	   *type = duckdb_profile_metric(info, "OPERATOR_TYPE");
+	idx_t		nchildren = duckdb_profiling_info_get_child_count(info);
+	idx_t		i;
+
+	if (type != NULL && type[0] != '\0')
+	{
+		DuckDBProfileNode *node = palloc(sizeof(DuckDBProfileNode));
+		char	   *timing = duckdb_profile_metric(info, "OPERATOR_TIMING");
+
+		node->depth = depth;
+		node->type = type;
+		node->time_ms = timing ? strtod(timing, NULL) * 1000.0 : 0.0;
+		node->rows = duckdb_profile_metric(info, "OPERATOR_CARDINALITY");
+		*nodes = lappend(*nodes, node);
+		depth++;
 	}
+
+	for (i = 0; i < nchildren; i++)
+		duckdb_collect_profile_node(duckdb_profiling_info_get_child(info, i),
+									depth, nodes);
+}
+
+/*
+ * Save the operator tree DuckDB's profiler recorded for the query just run on
+ * festate->conn, for EXPLAIN ANALYZE.  A rescan replaces it, so the plan
+ * shown is the one of the last execution.
+ */
+static void
+duckdb_collect_profile(DuckDBFdwExecState *festate)
+{
+	duckdb_profiling_info root = duckdb_get_profiling_info(festate->conn);
+	char	   *latency;
+
+	festate->remote_plan = NIL;
+	festate->remote_latency = 0;
+	if (root == NULL)
+		return;
+
+	latency = duckdb_profile_metric(root, "LATENCY");
+	if (latency != NULL)
+		festate->remote_latency = strtod(latency, NULL);
+	duckdb_collect_profile_node(root, 0, &festate->remote_plan);
+}
+
+/*
+ * Count one execution of the scan's remote query, started at start, in
+ * duckdb_fdw_stat_statements.
+ */
+static void
+duckdb_record_execution(DuckDBFdwExecState *festate, instr_time start)
+{
+	instr_time	duration;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	duckdb_stats_record(festate->server->serverid, festate->query, 1,
+						INSTR_TIME_GET_MILLISEC(duration), 0, 0, 0);
 }
 
+/*
+ * Run the remote query into festate->res, binding the current values of the
+ * parameters if the query was prepared.  Servers with shared_host run it in
+ * the host worker and read the result into festate->host_res instead.
+ */
 static void
-duckdb_execute_query(DuckDBFdwExecState *festate, ForeignScanState *node, ForeignScan *fsplan)
+duckdb_execute_query(DuckDBFdwExecState *festate, ForeignScanState *node)
 {
-	if (fsplan->fdw_exprs != NIL)
+	char	   *errmsg;
+	instr_time	start;
+
+	INSTR_TIME_SET_ZERO(start);
+	if (festate->instrument)
+		INSTR_TIME_SET_CURRENT(start);
+	festate->executions++;
+
+	if (festate->use_host)
 	{
+		List	   *params = NIL;
 		ListCell   *lc_expr;
 		ListCell   *lc_state;
-		idx_t		param_idx = 1;
 
-		festate->param_exprs = fsplan->fdw_exprs;
-		festate->param_expr_states = ExecInitExprList(fsplan->fdw_exprs, &node->ss.ps);
-
-		if (duckdb_prepare(festate->conn, festate->query, &festate->prepared_stmt) == DuckDBError)
+		/* The host binds parameters from their text form */
+		forboth(lc_state, festate->param_expr_states, lc_expr, festate->param_exprs)
 		{
-			const char *err = festate->prepared_stmt ? duckdb_prepare_error(festate->prepared_stmt) : "prepare error";
-			char *err_msg = pstrdup(err ? err : "prepare error");
-			if (festate->prepared_stmt)
-				duckdb_destroy_prepare(&festate->prepared_stmt);
-			elog(ERROR, "duckdb_fdw: prepare failed: %s", err_msg);
+			bool		isnull = false;
+			Datum		val;
+			Oid			typoutput;
+			bool		typisvarlena;
+
+			val = ExecEvalExpr(lfirst(lc_state), node->ss.ps.ps_ExprContext, &isnull);
+			if (isnull)
+			{
+				params = lappend(params, NULL);
+				continue;
+			}
+			getTypeOutputInfo(exprType((Node *) lfirst(lc_expr)), &typoutput, &typisvarlena);
+			params = lappend(params, OidOutputFunctionCall(typoutput, val));
 		}
+		festate->host_res = duckdb_host_query(festate->server, festate->query, params);
+		if (festate->instrument)
+			duckdb_record_execution(festate, start);
+		return;
+	}
+
+	if (festate->analyze)
+		duckdb_do_sql_command(festate->conn, "PRAGMA enable_profiling = 'no_output'", ERROR);
 
-		festate->use_prepared_stmt = true;
+	if (festate->use_prepared_stmt)
+	{
+		ListCell   *lc_expr;
+		ListCell   *lc_state;
+		idx_t		param_idx = 1;
 
 		forboth(lc_state, festate->param_expr_states, lc_expr, festate->param_exprs)
 		{
@@ -190,14 +680,28 @@ duckdb_execute_query(DuckDBFdwExecState *festate, ForeignScanState *node, Foreig
 			param_idx++;
 		}
 
-		if (duckdb_execute_prepared(festate->prepared_stmt, &festate->res) == DuckDBError)
-			elog(ERROR, "duckdb_fdw: execute prepared failed");
+		duckdb_progress_begin(festate->server->serverid, festate->query);
+		if (!duckdb_run_prepared(festate->conn, festate->prepared_stmt, &festate->res, &errmsg))
+			elog(ERROR, "duckdb_fdw: execute prepared failed: %s", errmsg);
 	}
 	else
 	{
-		if (duckdb_query(festate->conn, festate->query, &festate->res) == DuckDBError)
-			elog(ERROR, "duckdb_fdw: query failed: %s", duckdb_result_error(&festate->res));
-		festate->use_prepared_stmt = false;
+		const char *sql = festate->cached_query ? festate->cached_query : festate->query;
+
+		duckdb_progress_begin(festate->server->serverid, sql);
+		if (!duckdb_run_query(festate->conn, sql, &festate->res, &errmsg))
+			elog(ERROR, "duckdb_fdw: query failed: %s", errmsg);
+	}
+	duckdb_progress_end();
+	festate->has_result = true;
+
+	if (festate->instrument)
+		duckdb_record_execution(festate, start);
+
+	if (festate->analyze)
+	{
+		duckdb_collect_profile(festate);
+		duckdb_do_sql_command(festate->conn, "PRAGMA disable_profiling", ERROR);
 	}
 }
 
@@ -207,7 +711,9 @@ duckdb_fetch_next_chunk(DuckDBFdwExecState *festate)
 	if (festate->current_chunk)
 		duckdb_destroy_data_chunk(&festate->current_chunk);
 
+	pgstat_report_wait_start(duckdb_wait_event(DUCKDB_WAIT_FETCH_CHUNK));
 	festate->current_chunk = duckdb_result_get_chunk(festate->res, festate->current_chunk_idx++);
+	pgstat_report_wait_end();
 	festate->current_chunk_row_idx = 0;
 	if (!festate->current_chunk)
 	{
@@ -216,9 +722,46 @@ duckdb_fetch_next_chunk(DuckDBFdwExecState *festate)
 	}
 
 	festate->current_chunk_row_count = duckdb_data_chunk_get_size(festate->current_chunk);
+	festate->chunks_fetched++;
 	return festate->current_chunk_row_count > 0;
 }
 
+static bool duckdb_can_use_chunk_scan(TupleDesc tupdesc, List *retrieved_attrs);
+static List *duckdb_slow_path_columns(DuckDBFdwExecState *festate);
+
+/*
+ * Position the scan at the first row of festate->res.  The result is fully
+ * materialized, so this is also how a rescan replays it.
+ */
+static void
+duckdb_start_iteration(DuckDBFdwExecState *festate)
+{
+	if (festate->current_chunk)
+		duckdb_destroy_data_chunk(&festate->current_chunk);
+
+	festate->current_chunk_idx = 0;
+	festate->current_chunk_row_idx = 0;
+	festate->current_chunk_row_count = 0;
+	festate->global_row_idx = 0;
+	festate->is_started = true;
+	if (festate->use_host)
+	{
+		festate->text_columns = list_length(festate->retrieved_attrs);
+		festate->use_chunk_scan = false;
+		festate->current_chunk_row_count = festate->host_res->nrows;
+		return;
+	}
+	festate->use_chunk_scan = duckdb_can_use_chunk_scan(festate->tupdesc,
+														 festate->retrieved_attrs);
+	festate->chunk_capable = festate->use_chunk_scan;
+	if (festate->instrument)
+		festate->text_columns = list_length(duckdb_slow_path_columns(festate));
+	if (festate->use_chunk_scan)
+		festate->use_chunk_scan = duckdb_fetch_next_chunk(festate);
+	if (!festate->use_chunk_scan)
+		festate->current_chunk_row_count = duckdb_row_count(&festate->res);
+}
+
 static bool
 duckdb_can_use_chunk_scan(TupleDesc tupdesc, List *retrieved_attrs)
 {
@@ -487,12 +1030,22 @@ duckdbGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntable
 {
     DuckDBFdwRelationInfo *fpinfo = (DuckDBFdwRelationInfo *) palloc0(sizeof(DuckDBFdwRelationInfo));
     duckdb_opt  *options;
+    double      metadata_rows;
+    char       *cached_relation;
     baserel->fdw_private = (void *) fpinfo;
     fpinfo->foreigntableid = foreigntableid;
     fpinfo->table = GetForeignTable(foreigntableid);
     fpinfo->server = GetForeignServer(fpinfo->table->serverid);
     options = duckdb_get_options(foreigntableid);
 
+    /* A fresh local copy stands in for the remote source, estimates included */
+    if (options && (cached_relation = duckdb_local_cache_relation(foreigntableid)) != NULL)
+        options->svr_table = cached_relation;
+
+    /* Attach the catalog the table lives in before anything looks it up */
+    if (options && options->svr_table && !duckdb_server_uses_host(fpinfo->server))
+        (void) duckdb_attach_catalogs(fpinfo->server, options->svr_table);
+
     HeapTuple tp = SearchSysCache2(USERMAPPINGUSERSERVER,
                                    ObjectIdGetDatum(GetUserId()),
                                    ObjectIdGetDatum(fpinfo->server->serverid));
@@ -526,18 +1079,48 @@ duckdbGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntable
 
     baserel->rows = 1000;
 
-    if (options && options->use_remote_estimate && options->svr_table)
+    /* An explicit use_remote_estimate asks for COUNT(*) and wins */
+    if (options && options->svr_table && !options->use_remote_estimate &&
+        (duckdb_fdw_metadata_estimates == DUCKDB_METADATA_ESTIMATES_ON ||
+         (duckdb_fdw_metadata_estimates == DUCKDB_METADATA_ESTIMATES_LOCAL &&
+          strstr(options->svr_table, "://") == NULL)) &&
+        !duckdb_server_uses_host(fpinfo->server) &&
+        duckdb_metadata_estimate(root, baserel, fpinfo->server, foreigntableid,
+                                 options->svr_table, &metadata_rows))
+    {
+        /* Footer or catalog row count, already filtered by the quals */
+        baserel->rows = metadata_rows;
+    }
+    else if (options && options->use_remote_estimate && options->svr_table &&
+        duckdb_server_uses_host(fpinfo->server))
+    {
+        DuckDBHostResult *count_res;
+        char *relation_ref = duckdb_build_relation_reference(options->svr_table);
+        char *count_sql = psprintf("SELECT COUNT(*) FROM %s", relation_ref);
+
+        count_res = duckdb_host_query(fpinfo->server, count_sql, NIL);
+        if (count_res->nrows > 0 && count_res->values[0] != NULL)
+        {
+            double count_rows = strtod(count_res->values[0], NULL);
+            if (count_rows > 0)
+                baserel->rows = count_rows;
+        }
+        pfree(relation_ref);
+        pfree(count_sql);
+    }
+    else if (options && options->use_remote_estimate && options->svr_table)
     {
         duckdb_connection conn = duckdb_get_connection(fpinfo->server, false);
         duckdb_result count_res;
         StringInfoData count_sql;
         char *relation_ref = duckdb_build_relation_reference(options->svr_table);
         bool query_ok = false;
+        char *errmsg;
 
         MemSet(&count_res, 0, sizeof(count_res));
         initStringInfo(&count_sql);
         appendStringInfo(&count_sql, "SELECT COUNT(*) FROM %s", relation_ref);
-        if (duckdb_query(conn, count_sql.data, &count_res) == DuckDBSuccess)
+        if (duckdb_run_query(conn, count_sql.data, &count_res, &errmsg))
             query_ok = true;
         if (query_ok &&
             duckdb_row_count(&count_res) > 0)
@@ -617,10 +1200,14 @@ duckdbGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid,
 
     duckdb_deparse_select_stmt_for_rel(&sql, root, baserel, deparse_tlist, fpinfo->remote_conds, NIL, false, false, false, &retrieved_attrs, &params_list);
 
-    fdw_private = list_make4(makeString(sql.data),
+    /* Local copies read by the query, rechecked for freshness at execution */
+    fdw_private = list_make5(makeString(sql.data),
                              retrieved_attrs,
                              makeInteger(rel_oid),
-                             makeInteger(fpinfo->server->serverid));
+                             makeInteger(fpinfo->server->serverid),
+                             duckdb_local_cache_relids(root,
+                                                       duckdb_get_upper_scanrel(baserel)->relids,
+                                                       sql.data));
 
     return make_foreignscan(tlist, extract_actual_clauses(fpinfo->local_conds, false), scanrelid, params_list, fdw_private, (IS_UPPER_REL(baserel) || IS_JOIN_REL(baserel) ? tlist : NIL), NIL, outer_plan);
 }
@@ -631,6 +1218,7 @@ duckdbBeginForeignScan(ForeignScanState *node, int eflags)
     DuckDBFdwExecState *festate = (DuckDBFdwExecState *)palloc0(sizeof(DuckDBFdwExecState));
     ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
     ForeignTable *table;
+    ForeignServer *server;
     Oid foreigntableid;
 
     node->fdw_state = (void *)festate;
@@ -640,19 +1228,43 @@ duckdbBeginForeignScan(ForeignScanState *node, int eflags)
         festate->tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
         foreigntableid = RelationGetRelid(node->ss.ss_currentRelation);
         table = GetForeignTable(foreigntableid);
-        festate->conn = duckdb_get_connection(GetForeignServer(table->serverid), false);
+        server = GetForeignServer(table->serverid);
     }
 	else
 	{
 		Oid serverid = intVal(list_nth(fsplan->fdw_private, 3));
 		if (node->ss.ss_ScanTupleSlot)
 			festate->tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
-		festate->conn = duckdb_get_connection(GetForeignServer(serverid), false);
+		server = GetForeignServer(serverid);
+	}
+	festate->server = server;
+	festate->use_host = duckdb_server_uses_host(server);
+	if (!festate->use_host)
+	{
+		PlannedStmt *pstmt = node->ss.ps.state->es_plannedstmt;
+
+		/*
+		 * Open for writing up front when the statement also modifies data, so
+		 * an automatic-mode server need not be reopened under this scan.
+		 */
+		festate->conn = duckdb_lease_connection(server,
+												pstmt->commandType != CMD_SELECT ||
+												pstmt->hasModifyingCTE);
 	}
 
 	festate->attinmeta = TupleDescGetAttInMetadata(festate->tupdesc);
 	festate->query = strVal(list_nth(fsplan->fdw_private, 0));
 
+	/* A cached plan may read a local copy that has expired since */
+	if (!festate->use_host && (eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0 &&
+		list_nth(fsplan->fdw_private, 4) != NIL)
+		festate->query = duckdb_local_cache_revalidate(festate->query,
+													   (List *) list_nth(fsplan->fdw_private, 4));
+
+	/* A cached plan may outlive the database it attached catalogs to */
+	if (!festate->use_host)
+		(void) duckdb_attach_catalogs(server, festate->query);
+
 	if (list_length(fsplan->fdw_private) > 1)
 		festate->retrieved_attrs = (List *) list_nth(fsplan->fdw_private, 1);
 	else
@@ -661,18 +1273,39 @@ duckdbBeginForeignScan(ForeignScanState *node, int eflags)
 	if (node->ss.ps.ps_ExprContext == NULL)
 		ExecAssignExprContext(node->ss.ps.state, &node->ss.ps);
 
-	duckdb_execute_query(festate, node, fsplan);
+	/* Only EXPLAIN ANALYZE pays for profiling and conversion timing */
+	festate->analyze = node->ss.ps.state->es_instrument != 0 &&
+		(eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0;
+	festate->instrument = festate->analyze ||
+		((eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0 && duckdb_stats_enabled());
 
-	festate->current_chunk_idx = 0;
-	festate->current_chunk_row_idx = 0;
-	festate->global_row_idx = 0;
-	festate->use_chunk_scan = duckdb_can_use_chunk_scan(festate->tupdesc,
-														 festate->retrieved_attrs);
-	if (festate->use_chunk_scan)
-		festate->use_chunk_scan = duckdb_fetch_next_chunk(festate);
-	if (!festate->use_chunk_scan)
-		festate->current_chunk_row_count = duckdb_row_count(&festate->res);
-	festate->is_started = true;
+	if (!festate->use_host)
+	{
+		duckdb_budget_acquire(festate->conn, server);
+		festate->has_budget = true;
+	}
+
+	duckdb_prepare_query(festate, node, fsplan);
+
+	/* Scans of a single table without parameters may be served from the result cache */
+	if (!festate->use_host && !festate->use_prepared_stmt && fsplan->scan.scanrelid > 0)
+		festate->cached_query = duckdb_result_cache_query(server, festate->conn,
+														  foreigntableid, festate->query);
+
+	/*
+	 * A query with parameters runs when its first row is needed: under a
+	 * correlated subplan the parameters are only set by then, and the
+	 * subplan's first rescan would run it again anyway.
+	 */
+	if (festate->use_prepared_stmt)
+	{
+		festate->chunk_capable = !festate->use_host &&
+			duckdb_can_use_chunk_scan(festate->tupdesc, festate->retrieved_attrs);
+		return;
+	}
+
+	duckdb_execute_query(festate, node);
+	duckdb_start_iteration(festate);
 }
 
 static Datum
@@ -739,9 +1372,16 @@ duckdbIterateForeignScan(ForeignScanState *node)
 	    TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
 	    ListCell   *lc;
 	    int         i;
+	    instr_time  convert_start;
 
     ExecClearTuple(slot);
 
+	    if (!festate->is_started)
+		{
+			duckdb_execute_query(festate, node);
+			duckdb_start_iteration(festate);
+		}
+
 	    if (festate->use_chunk_scan)
 		{
 			while (festate->current_chunk_row_idx >= festate->current_chunk_row_count)
@@ -758,6 +1398,9 @@ duckdbIterateForeignScan(ForeignScanState *node)
     if (festate->tupdesc == NULL)
         festate->tupdesc = slot->tts_tupleDescriptor;
 
+	    if (festate->instrument)
+	        INSTR_TIME_SET_CURRENT(convert_start);
+
 	    i = 0;
 	    foreach(lc, festate->retrieved_attrs)
 	    {
@@ -812,6 +1455,19 @@ duckdbIterateForeignScan(ForeignScanState *node)
 						}
 					}
 				}
+				else if (festate->use_host)
+				{
+					DuckDBHostResult *hres = festate->host_res;
+					char	   *value = hres->values[festate->current_chunk_row_idx * hres->ncols + i];
+
+					if (value == NULL)
+						isnull = true;
+					else
+						dvalue = InputFunctionCall(&festate->attinmeta->attinfuncs[attnum_idx],
+												   value,
+												   festate->attinmeta->attioparams[attnum_idx],
+												   festate->attinmeta->atttypmods[attnum_idx]);
+				}
 				else if (duckdb_value_is_null(&festate->res, i, festate->current_chunk_row_idx))
 				{
 					isnull = true;
@@ -823,10 +1479,26 @@ duckdbIterateForeignScan(ForeignScanState *node)
 
 				slot->tts_isnull[attnum_idx] = isnull;
 				slot->tts_values[attnum_idx] = isnull ? (Datum) 0 : dvalue;
+				if (festate->instrument && !isnull)
+				{
+					Form_pg_attribute att = TupleDescAttr(festate->tupdesc, attnum_idx);
+
+					festate->bytes_fetched += datumGetSize(dvalue, att->attbyval, att->attlen);
+				}
 	        }
 	        i++;
 	    }
 
+	    if (festate->instrument)
+	    {
+	        instr_time  convert_end;
+
+	        INSTR_TIME_SET_CURRENT(convert_end);
+	        INSTR_TIME_ACCUM_DIFF(festate->convert_time, convert_end, convert_start);
+	        festate->rows_fetched++;
+	        festate->fallback_cells += festate->text_columns;
+	    }
+
 	    ExecStoreVirtualTuple(slot);
 #if PG_VERSION_NUM >= 170000
 	    /*
@@ -846,66 +1518,184 @@ duckdbEndForeignScan(ForeignScanState *node)
 	    DuckDBFdwExecState *festate = (DuckDBFdwExecState *)node->fdw_state;
 	    if (festate)
 	    {
+			if (festate->instrument)
+				duckdb_stats_record(festate->server->serverid, festate->query, 0, 0,
+									festate->rows_fetched,
+									INSTR_TIME_GET_MILLISEC(festate->convert_time),
+									festate->fallback_cells);
 			if (festate->current_chunk)
 				duckdb_destroy_data_chunk(&festate->current_chunk);
-	        duckdb_destroy_result(&festate->res);
+			if (festate->has_result)
+				duckdb_destroy_result(&festate->res);
+			festate->has_result = false;
 			if (festate->use_prepared_stmt && festate->prepared_stmt)
-				duckdb_destroy_prepare(&festate->prepared_stmt);
+				duckdb_release_prepared_statement(festate->conn, festate->prepared_stmt);
+			festate->prepared_stmt = NULL;
+			if (festate->has_budget)
+				duckdb_budget_release();
+			festate->has_budget = false;
+			if (festate->conn)
+				duckdb_release_connection(festate->conn);
+			festate->conn = NULL;
 	    }
 }
 
 static void
 duckdbReScanForeignScan(ForeignScanState *node)
 {
-	DuckDBFdwExecState *oldstate = (DuckDBFdwExecState *)node->fdw_state;
-	duckdbEndForeignScan(node);
-	duckdbBeginForeignScan(node, 0);
-	pfree(oldstate);
-}
+	DuckDBFdwExecState *festate = (DuckDBFdwExecState *)node->fdw_state;
 
-static void
-duckdbGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
-                            RelOptInfo *input_rel, RelOptInfo *output_rel,
+	/* Not run yet; the first fetch runs it with the current parameters */
+	if (!festate->is_started)
+		return;
+
+	/*
+	 * If any parameter of the remote query changed, re-execute the prepared
+	 * statement with the new values.  Otherwise the materialized result of
+	 * the previous execution is still valid and is simply replayed.
+	 */
+	if (node->ss.ps.chgParam != NULL && festate->use_prepared_stmt)
+	{
+		if (festate->current_chunk)
+			duckdb_destroy_data_chunk(&festate->current_chunk);
+		if (festate->has_result)
+			duckdb_destroy_result(&festate->res);
+		festate->has_result = false;
+		festate->host_res = NULL;
+		duckdb_execute_query(festate, node);
+	}
+
+	duckdb_start_iteration(festate);
+}
+
+static void
+duckdbGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+                            RelOptInfo *input_rel, RelOptInfo *output_rel,
                             void *extra)
 {
+    DuckDBFdwRelationInfo *ifpinfo;
     DuckDBFdwRelationInfo *fpinfo;
+    PathTarget *target;
+    double rows;
+    Cost startup_cost;
+    Cost total_cost;
+    double input_rows = 0;
 
     if (input_rel == NULL || input_rel->fdw_private == NULL ||
         !((DuckDBFdwRelationInfo *) input_rel->fdw_private)->pushdown_safe)
         return;
 
-    if (stage != UPPERREL_GROUP_AGG)
+    /*
+     * Quals evaluated locally must filter the rows before any upper stage
+     * sees them, so that stage has to stay local too.
+     */
+    if (((DuckDBFdwRelationInfo *) input_rel->fdw_private)->local_conds != NIL ||
+        ((DuckDBFdwRelationInfo *) duckdb_get_upper_scanrel(input_rel)->fdw_private)->local_conds != NIL)
+        return;
+
+    /* Ignore stages we don't support, and skip duplicate calls */
+    if ((stage != UPPERREL_GROUP_AGG && stage != UPPERREL_WINDOW &&
+         stage != UPPERREL_DISTINCT) ||
+        output_rel->fdw_private != NULL)
         return;
 
+    ifpinfo = (DuckDBFdwRelationInfo *) input_rel->fdw_private;
+
     fpinfo = (DuckDBFdwRelationInfo *) palloc0(sizeof(DuckDBFdwRelationInfo));
     fpinfo->pushdown_safe = false;
+    fpinfo->stage = stage;
     fpinfo->outerrel = input_rel;
-    fpinfo->foreigntableid = ((DuckDBFdwRelationInfo *) input_rel->fdw_private)->foreigntableid;
-    fpinfo->server = ((DuckDBFdwRelationInfo *) input_rel->fdw_private)->server;
-    fpinfo->user = ((DuckDBFdwRelationInfo *) input_rel->fdw_private)->user;
+    fpinfo->foreigntableid = ifpinfo->foreigntableid;
+    fpinfo->server = ifpinfo->server;
+    fpinfo->user = ifpinfo->user;
     output_rel->fdw_private = fpinfo;
 
-    if (duckdb_is_foreign_expr(root, output_rel, (Expr *) output_rel->reltarget->exprs))
+    if (stage == UPPERREL_GROUP_AGG)
     {
-        double rows;
-        Cost startup_cost;
-        Cost total_cost;
+        GroupPathExtraData *gextra = (GroupPathExtraData *) extra;
+        ListCell   *lc;
 
-        fpinfo->pushdown_safe = true;
-        duckdb_estimate_path_cost_size(root, output_rel, NIL, NIL, NULL,
-                                       &rows, NULL, &startup_cost, &total_cost);
-        add_path(output_rel, (Path *)
-                 create_foreignscan_path(root, output_rel,
-                                          output_rel->reltarget,
-                                          rows,
-                                          startup_cost,
-                                          total_cost,
-                                          NIL,
-                                          NULL,
-                                          NULL,
-                                          NIL,
-                                          NIL));
+        /* Grouping sets and partial aggregation are not deparsed */
+        if (root->parse->groupingSets != NIL ||
+            gextra->patype == PARTITIONWISE_AGGREGATE_PARTIAL)
+            return;
+
+        target = output_rel->reltarget;
+        if (!duckdb_is_foreign_expr(root, output_rel, (Expr *) target->exprs))
+            return;
+
+        /* The whole HAVING clause must be evaluated remotely */
+        foreach(lc, (List *) gextra->havingQual)
+        {
+            Expr       *expr = (Expr *) lfirst(lc);
+
+            if (!duckdb_is_foreign_expr(root, output_rel, expr))
+                return;
+            fpinfo->remote_conds = lappend(fpinfo->remote_conds, expr);
+        }
+
+        fpinfo->grouped_tlist = make_tlist_from_pathtarget(target);
     }
+    else if (stage == UPPERREL_DISTINCT)
+    {
+        Query      *parse = root->parse;
+        List       *distinct_exprs;
+
+        /*
+         * The DISTINCT target is the window/grouping output; DISTINCT ON also
+         * needs its ORDER BY shipped so DuckDB keeps the same row per group.
+         */
+        target = root->upper_targets[UPPERREL_DISTINCT];
+        if (target == NULL ||
+            !duckdb_is_foreign_expr(root, output_rel, (Expr *) target->exprs))
+            return;
+        if (parse->hasDistinctOn &&
+            !duckdb_is_foreign_sort_clause(root, output_rel, parse->sortClause))
+            return;
+
+        /* Only the distinct set is transferred */
+        input_rows = ifpinfo->rows > 0 ? ifpinfo->rows : 1000.0;
+        distinct_exprs = get_sortgrouplist_exprs(parse->distinctClause,
+                                                 root->processed_tlist);
+        fpinfo->rows = estimate_num_groups(root, distinct_exprs, input_rows,
+                                           NULL, NULL);
+        fpinfo->width = ifpinfo->width;
+    }
+    else
+    {
+        /*
+         * Window functions are evaluated over the rows of the input stage;
+         * the target to produce is the one the planner computed for the
+         * window step.
+         */
+        target = root->upper_targets[UPPERREL_WINDOW];
+        if (!root->parse->hasWindowFuncs || target == NULL ||
+            !duckdb_is_foreign_expr(root, output_rel, (Expr *) target->exprs))
+            return;
+
+        fpinfo->rows = ifpinfo->rows;
+        fpinfo->width = ifpinfo->width;
+    }
+
+    fpinfo->pushdown_safe = true;
+    duckdb_estimate_path_cost_size(root, output_rel, NIL, NIL, NULL,
+                                   &rows, NULL, &startup_cost, &total_cost);
+
+    /* DuckDB must consume its whole input before returning distinct rows */
+    startup_cost += input_rows * cpu_operator_cost;
+    total_cost += input_rows * cpu_operator_cost;
+
+    add_path(output_rel, (Path *)
+             create_foreignscan_path(root, output_rel,
+                                      target,
+                                      rows,
+                                      startup_cost,
+                                      total_cost,
+                                      NIL,
+                                      NULL,
+                                      NULL,
+                                      NIL,
+                                      NIL));
 }
 
 static int
@@ -915,8 +1705,13 @@ duckdbIsForeignRelUpdatable(Relation rel)
 	 * duckdb_fdw supports INSERT via the Appender API and the legacy
 	 * SQL fallback path. UPDATE and DELETE are not supported — the
 	 * planner will skip FDW modify paths for those operations rather
-	 * than failing at execution time.
+	 * than failing at execution time.  Servers opened read_only accept no
+	 * modifications at all.
 	 */
+	ForeignServer *server = GetForeignServer(GetForeignTable(RelationGetRelid(rel))->serverid);
+
+	if (duckdb_server_access_mode(server) == DUCKDB_ACCESS_READ_ONLY)
+		return 0;
 	return (1 << CMD_INSERT);
 }
 
@@ -931,7 +1726,187 @@ duckdbAddForeignUpdateTargets(PlannerInfo *root,
 static List *
 duckdbPlanForeignModify(PlannerInfo *root, ModifyTable *plan, Index resultRelation, int subplan_index)
 {
-    return NIL;
+    /*
+     * Foreign tables have no unique indexes, so PostgreSQL plans only ON
+     * CONFLICT DO NOTHING without an arbiter on them; DuckDB resolves it
+     * against the target table's own keys.
+     */
+    if (plan->onConflictAction != ONCONFLICT_NONE &&
+        plan->onConflictAction != ONCONFLICT_NOTHING)
+        elog(ERROR, "unexpected ON CONFLICT specification: %d",
+             (int) plan->onConflictAction);
+
+    return list_make1(makeInteger(plan->onConflictAction));
+}
+
+/*
+ * An INSERT that resolves conflicts appends its rows to an empty temporary
+ * copy of the target on the transaction connection, which
+ * duckdb_finish_staged_insert merges into the target in one statement of
+ * the same DuckDB transaction.
+ */
+static void
+duckdb_begin_staged_insert(DuckDBFdwExecState *festate)
+{
+	static int	stage_count = 0;
+	duckdb_connection conn = duckdb_xact_connection(festate->server);
+	char	   *relref = duckdb_build_relation_reference(festate->table_name);
+	char	   *sql;
+
+	festate->stage_table = psprintf("duckdb_fdw_stage_%d", ++stage_count);
+	sql = psprintf("CREATE TEMP TABLE %s AS SELECT * FROM %s LIMIT 0",
+				   festate->stage_table, relref);
+	duckdb_do_sql_command(conn, sql, ERROR);
+	pfree(sql);
+	pfree(relref);
+
+	if (duckdb_appender_create_ext(conn, "temp", "main", festate->stage_table,
+								   &festate->appender) == DuckDBError)
+	{
+		const char *err = duckdb_appender_error(festate->appender);
+		char	   *msg = pstrdup(err ? err : "unknown appender error");
+
+		duckdb_appender_destroy(&festate->appender);
+		elog(ERROR, "DuckDB appender create failed: %s", msg);
+	}
+	festate->use_appender = true;
+}
+
+/*
+ * QUALIFY clause keeping one staged row per value of each primary key or
+ * unique constraint of the target named table, so rows that conflict with
+ * each other do not fail the merge.  keep_last keeps the last row inserted,
+ * as INSERT OR REPLACE would; otherwise the first, as ON CONFLICT DO NOTHING
+ * does.  Rows with a NULL key never conflict and are all kept.  Returns an
+ * empty string when the target has no such constraint, or when its name is
+ * quoted, a table function or ambiguous.
+ */
+static char *
+duckdb_stage_dedupe_clause(duckdb_connection conn, const char *table, bool keep_last)
+{
+	char	   *copy;
+	char	   *parts[3];
+	int			nparts = 0;
+	char	   *saveptr = NULL;
+	char	   *token;
+	StringInfoData sql;
+	StringInfoData clause;
+	duckdb_result res;
+	char	   *err;
+	idx_t		nrows;
+	idx_t		start = 0;
+	static const char *const columns[3] = {"database_name", "schema_name", "table_name"};
+
+	initStringInfo(&clause);
+	if (strchr(table, '"') != NULL || strchr(table, '(') != NULL)
+		return clause.data;
+
+	copy = pstrdup(table);
+	for (token = duckdb_fdw_next_token(copy, ".", &saveptr); token != NULL;
+		 token = duckdb_fdw_next_token(NULL, ".", &saveptr))
+	{
+		if (nparts == 3)
+		{
+			pfree(copy);
+			return clause.data;
+		}
+		parts[nparts++] = duckdb_fdw_trim_token(token);
+	}
+	if (nparts == 0)
+	{
+		pfree(copy);
+		return clause.data;
+	}
+
+	initStringInfo(&sql);
+	appendStringInfoString(&sql,
+						   "SELECT table_oid, constraint_index, unnest(constraint_column_names) "
+						   "FROM duckdb_constraints() "
+						   "WHERE constraint_type IN ('PRIMARY KEY', 'UNIQUE')");
+	for (int i = 0; i < nparts; i++)
+	{
+		char	   *lit = duckdb_fdw_quote_literal(parts[i]);
+
+		appendStringInfo(&sql, " AND %s = %s", columns[3 - nparts + i], lit);
+		pfree(lit);
+	}
+	appendStringInfoString(&sql, " ORDER BY table_oid, constraint_index");
+	pfree(copy);
+
+	if (!duckdb_run_query(conn, sql.data, &res, &err))
+		elog(ERROR, "duckdb_fdw: could not look up the keys of \"%s\": %s", table, err);
+	pfree(sql.data);
+
+	nrows = duckdb_row_count(&res);
+	/* An ambiguous name matches several tables; leave conflicts to DuckDB */
+	if (nrows > 0 &&
+		duckdb_value_int64(&res, 0, 0) != duckdb_value_int64(&res, 0, nrows - 1))
+		nrows = 0;
+
+	/* One "(k IS NULL OR ... row_number() OVER (PARTITION BY k, ...) = 1)" per constraint */
+	while (start < nrows)
+	{
+		StringInfoData keys;
+		idx_t		end = start;
+
+		initStringInfo(&keys);
+		appendStringInfoString(&clause, start == 0 ? " QUALIFY (" : " AND (");
+		while (end < nrows &&
+			   duckdb_value_int64(&res, 1, end) == duckdb_value_int64(&res, 1, start))
+		{
+			char	   *name = duckdb_value_varchar(&res, 2, end);
+			char	   *ident = duckdb_fdw_quote_identifier(name);
+
+			duckdb_free(name);
+			appendStringInfo(&clause, "%s IS NULL OR ", ident);
+			appendStringInfo(&keys, "%s%s", end > start ? ", " : "", ident);
+			pfree(ident);
+			end++;
+		}
+		appendStringInfo(&clause, "row_number() OVER (PARTITION BY %s ORDER BY rowid %s) = 1)",
+						 keys.data, keep_last ? "DESC" : "ASC");
+		pfree(keys.data);
+		start = end;
+	}
+	duckdb_destroy_result(&res);
+	return clause.data;
+}
+
+static void
+duckdb_finish_staged_insert(DuckDBFdwExecState *festate)
+{
+	duckdb_connection conn = duckdb_xact_connection(festate->server);
+	duckdb_state state;
+	char	   *relref;
+	char	   *dedupe;
+	char	   *sql;
+
+	pgstat_report_wait_start(duckdb_wait_event(DUCKDB_WAIT_APPENDER_FLUSH));
+	state = duckdb_appender_close(festate->appender);
+	pgstat_report_wait_end();
+	if (state == DuckDBError)
+	{
+		const char *err = duckdb_appender_error(festate->appender);
+		char	   *msg = pstrdup(err ? err : "unknown appender error");
+
+		duckdb_appender_destroy(&festate->appender);
+		elog(ERROR, "DuckDB appender insert failed: %s", msg);
+	}
+	duckdb_appender_destroy(&festate->appender);
+
+	/* Plain inserts earlier in the transaction land first */
+	duckdb_flush_xact_appenders(festate->server);
+
+	relref = duckdb_build_relation_reference(festate->table_name);
+	dedupe = duckdb_stage_dedupe_clause(conn, festate->table_name,
+										strcmp(festate->insert_verb, "INSERT OR REPLACE") == 0);
+	sql = psprintf("%s INTO %s SELECT * FROM temp.main.%s%s; DROP TABLE temp.main.%s",
+				   festate->insert_verb, relref, festate->stage_table, dedupe,
+				   festate->stage_table);
+	duckdb_do_sql_command(conn, sql, ERROR);
+	pfree(sql);
+	pfree(dedupe);
+	pfree(relref);
 }
 
 static void
@@ -940,23 +1915,75 @@ duckdbBeginForeignModify(ModifyTableState *mtstate, ResultRelInfo *resultRelInfo
 	    DuckDBFdwExecState *festate = (DuckDBFdwExecState *)palloc0(sizeof(DuckDBFdwExecState));
 	    Relation rel = resultRelInfo->ri_RelationDesc;
 	    duckdb_opt *options = duckdb_get_options(RelationGetRelid(rel));
-		duckdb_state state;
-	    festate->conn = duckdb_get_connection(GetForeignServer(GetForeignTable(RelationGetRelid(rel))->serverid), false);
+	    OnConflictAction onconflict = fdw_private ? intVal(linitial(fdw_private)) : ONCONFLICT_NONE;
+	festate->server = GetForeignServer(GetForeignTable(RelationGetRelid(rel))->serverid);
+	festate->use_host = duckdb_server_uses_host(festate->server);
     festate->table_name = options->svr_table;
+	/* ON CONFLICT DO NOTHING in the statement overrides the table's on_conflict */
+	if (onconflict == ONCONFLICT_NOTHING ||
+		(options->on_conflict && pg_strcasecmp(options->on_conflict, "nothing") == 0))
+		festate->insert_verb = "INSERT OR IGNORE";
+	else if (options->on_conflict && pg_strcasecmp(options->on_conflict, "update") == 0)
+		festate->insert_verb = "INSERT OR REPLACE";
+	else
+		festate->insert_verb = "INSERT";
     festate->tupdesc = RelationGetDescr(rel);
 	festate->use_appender = false;
+	festate->instrument = (eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0 && duckdb_stats_enabled();
     /* options->svr_table points into persistent catalog memory — safe to free the wrapper */
     pfree(options);
-	state = duckdb_appender_create(festate->conn, NULL, festate->table_name, &festate->appender);
-		if (state == DuckDBSuccess)
-			festate->use_appender = true;
+	/* The shared host has no appender; rows go through batched INSERT statements */
+	if (festate->use_host)
+		initStringInfo(&festate->host_rows);
+	else
+	{
+		festate->conn = duckdb_lease_connection(festate->server, true);
+		if ((eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0)
+		{
+			duckdb_budget_acquire(festate->conn, festate->server);
+			festate->has_budget = true;
+		}
+		(void) duckdb_attach_catalogs(festate->server, festate->table_name);
+		if (strcmp(festate->insert_verb, "INSERT") != 0)
+		{
+			if ((eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0)
+				duckdb_begin_staged_insert(festate);
+		}
+		else
+		{
+			/* Shared with the transaction's other inserts into this table */
+			festate->appender = duckdb_xact_appender(festate->server, RelationGetRelid(rel),
+													 festate->table_name);
+			festate->use_appender = festate->appender != NULL;
+		}
+	}
 	    resultRelInfo->ri_FdwState = (void *)festate;
 }
 
-static TupleTableSlot *
-duckdbExecForeignInsert(EState *executor, ResultRelInfo *resultRelInfo, TupleTableSlot *slot, TupleTableSlot *planSlot)
+/*
+ * Send the rows buffered for the shared host in one INSERT, which joins the
+ * host transaction holding this transaction's other inserts.
+ */
+static void
+duckdb_flush_host_rows(DuckDBFdwExecState *festate)
+{
+	char	   *relref;
+	char	   *sql;
+
+	if (festate->host_nrows == 0)
+		return;
+	relref = duckdb_build_relation_reference(festate->table_name);
+	sql = psprintf("%s INTO %s VALUES %s", festate->insert_verb, relref, festate->host_rows.data);
+	duckdb_host_insert(festate->server, sql);
+	pfree(sql);
+	pfree(relref);
+	resetStringInfo(&festate->host_rows);
+	festate->host_nrows = 0;
+}
+
+static void
+duckdb_insert_row(DuckDBFdwExecState *festate, TupleTableSlot *slot)
 {
-	    DuckDBFdwExecState *festate = (DuckDBFdwExecState *)resultRelInfo->ri_FdwState;
 		if (festate->use_appender)
 		{
 			if (!duckdb_append_slot_row(festate, slot))
@@ -964,18 +1991,24 @@ duckdbExecForeignInsert(EState *executor, ResultRelInfo *resultRelInfo, TupleTab
 				const char *err = duckdb_appender_error(festate->appender);
 				elog(ERROR, "DuckDB appender insert failed: %s", err ? err : "unknown appender error");
 			}
-			return slot;
+			return;
 		}
 
 		/* Legacy fallback path */
 		{
 			StringInfoData sql;
 			int i;
-			char *relref = duckdb_build_relation_reference(festate->table_name);
 
 			initStringInfo(&sql);
-			appendStringInfo(&sql, "INSERT INTO %s VALUES (", relref);
-			pfree(relref);
+			/* The shared host's rows are buffered bare and sent in batches */
+			if (!festate->use_host)
+			{
+				char *relref = duckdb_build_relation_reference(festate->table_name);
+
+				appendStringInfo(&sql, "%s INTO %s VALUES ", festate->insert_verb, relref);
+				pfree(relref);
+			}
+			appendStringInfoChar(&sql, '(');
 
 			for (i = 0; i < festate->tupdesc->natts; i++)
 			{
@@ -997,18 +2030,45 @@ duckdbExecForeignInsert(EState *executor, ResultRelInfo *resultRelInfo, TupleTab
 					pfree(s);
 				}
 			}
-			appendStringInfoString(&sql, ");");
+			appendStringInfoChar(&sql, ')');
 
+			if (festate->use_host)
+			{
+				if (festate->host_nrows > 0)
+					appendStringInfoString(&festate->host_rows, ", ");
+				appendStringInfoString(&festate->host_rows, sql.data);
+				if (++festate->host_nrows >= DUCKDB_HOST_INSERT_BATCH)
+					duckdb_flush_host_rows(festate);
+			}
+			else
 			{
-				duckdb_result res;
-				if (duckdb_query(festate->conn, sql.data, &res) == DuckDBError)
-					elog(ERROR, "DuckDB insert failed: %s", duckdb_result_error(&res));
-				duckdb_destroy_result(&res);
+				/* In the transaction the appenders' rows commit with */
+				duckdb_do_sql_command(duckdb_xact_connection(festate->server), sql.data, ERROR);
 			}
 			pfree(sql.data);
+			festate->fallback_cells += festate->tupdesc->natts;
 		}
+}
 
-	    return slot;
+static TupleTableSlot *
+duckdbExecForeignInsert(EState *executor, ResultRelInfo *resultRelInfo, TupleTableSlot *slot, TupleTableSlot *planSlot)
+{
+	DuckDBFdwExecState *festate = (DuckDBFdwExecState *) resultRelInfo->ri_FdwState;
+	instr_time	start;
+	instr_time	end;
+
+	if (!festate->instrument)
+	{
+		duckdb_insert_row(festate, slot);
+		return slot;
+	}
+
+	INSTR_TIME_SET_CURRENT(start);
+	duckdb_insert_row(festate, slot);
+	INSTR_TIME_SET_CURRENT(end);
+	INSTR_TIME_ACCUM_DIFF(festate->exec_time, end, start);
+	festate->rows_fetched++;
+	return slot;
 }
 
 static TupleTableSlot **
@@ -1057,14 +2117,107 @@ duckdbEndForeignModify(EState *executor, ResultRelInfo *resultRelInfo)
 
 	if (!festate)
 		return;
-	if (festate->use_appender && festate->appender)
+	if (festate->stage_table)
+		duckdb_finish_staged_insert(festate);
+	if (festate->use_host)
+		duckdb_flush_host_rows(festate);
+	/* A plain insert's appender belongs to the transaction, which flushes it at commit */
+	festate->appender = NULL;
+	if (festate->instrument)
 	{
-		duckdb_state close_state = duckdb_appender_close(festate->appender);
-		duckdb_appender_destroy(&festate->appender);
-		if (close_state == DuckDBError)
-			ereport(WARNING,
-					(errmsg("duckdb_fdw: appender close reported an error"),
-					 errdetail("Some buffered rows may not have been flushed to DuckDB.")));
+		char	   *relref = duckdb_build_relation_reference(festate->table_name);
+		char	   *sql = psprintf("%s INTO %s", festate->insert_verb, relref);
+
+		duckdb_stats_record(festate->server->serverid, sql, 1,
+							INSTR_TIME_GET_MILLISEC(festate->exec_time),
+							festate->rows_fetched, 0, festate->fallback_cells);
+		pfree(sql);
+		pfree(relref);
+	}
+	if (festate->has_budget)
+		duckdb_budget_release();
+	festate->has_budget = false;
+	if (festate->conn)
+		duckdb_release_connection(festate->conn);
+	festate->conn = NULL;
+}
+
+/*
+ * Columns a row-mode scan converts through their text representation rather
+ * than a typed DuckDB accessor; see duckdb_value_to_pg.
+ */
+static List *
+duckdb_slow_path_columns(DuckDBFdwExecState *festate)
+{
+	List	   *names = NIL;
+	ListCell   *lc;
+
+	if (festate->tupdesc == NULL || festate->use_host || festate->chunk_capable)
+		return NIL;
+
+	foreach(lc, festate->retrieved_attrs)
+	{
+		int			attnum_pg = lfirst_int(lc);
+		Form_pg_attribute att;
+
+		if (attnum_pg <= 0 || attnum_pg > festate->tupdesc->natts)
+			continue;
+		att = TupleDescAttr(festate->tupdesc, attnum_pg - 1);
+		switch (att->atttypid)
+		{
+			case BOOLOID:
+			case INT2OID:
+			case INT4OID:
+			case INT8OID:
+			case FLOAT4OID:
+			case FLOAT8OID:
+			case DATEOID:
+				break;
+			default:
+				names = lappend(names, NameStr(att->attname));
+				break;
+		}
+	}
+	return names;
+}
+
+/*
+ * Print the DuckDB profiler's operator tree.  Text format gets one indented
+ * line per operator; structured formats get a list of the same lines.
+ * Operator times are left out under TIMING OFF, like the local plan's.
+ */
+static void
+duckdb_explain_remote_plan(List *nodes, ExplainState *es)
+{
+	List	   *lines = NIL;
+	ListCell   *lc;
+
+	foreach(lc, nodes)
+	{
+		DuckDBProfileNode *node = (DuckDBProfileNode *) lfirst(lc);
+		const char *rows = node->rows ? node->rows : "?";
+
+		if (es->timing)
+			lines = lappend(lines, psprintf("%*s%s (actual time=%.3f ms rows=%s)",
+											node->depth * 2, "", node->type,
+											node->time_ms, rows));
+		else
+			lines = lappend(lines, psprintf("%*s%s (actual rows=%s)",
+											node->depth * 2, "", node->type, rows));
+	}
+
+	if (es->format != EXPLAIN_FORMAT_TEXT)
+	{
+		ExplainPropertyList("Remote Plan", lines, es);
+		return;
+	}
+
+	ExplainIndentText(es);
+	appendStringInfoString(es->str, "Remote Plan:\n");
+	foreach(lc, lines)
+	{
+		ExplainIndentText(es);
+		appendStringInfo(es->str, "  %s\n", (char *) lfirst(lc));
 	}
 }
 
@@ -1073,8 +2226,51 @@ duckdbExplainForeignScan(ForeignScanState *node, ExplainState *es)
 {
     List       *fdw_private = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
     char       *sql = strVal(list_nth(fdw_private, 0));
+    DuckDBFdwExecState *festate = (DuckDBFdwExecState *) node->fdw_state;
 
     ExplainPropertyText("Remote SQL", sql, es);
+
+    if (festate == NULL)
+        return;
+
+    if (es->verbose)
+    {
+        const char *mode;
+        List       *slow_columns;
+
+        if (festate->use_host)
+            mode = "shared host";
+        else if (festate->chunk_capable)
+            mode = "chunk";
+        else
+            mode = "row";
+        ExplainPropertyText("Scan Mode", mode, es);
+        if (festate->use_prepared_stmt)
+            ExplainPropertyBool("Prepared", true, es);
+
+        slow_columns = duckdb_slow_path_columns(festate);
+        if (slow_columns != NIL)
+            ExplainPropertyList("Text Conversion", slow_columns, es);
+    }
+
+    if (es->analyze && festate->analyze)
+    {
+        ExplainPropertyInteger("Remote Executions", NULL, festate->executions, es);
+        if (!festate->use_host)
+            ExplainPropertyInteger("Remote Chunks", NULL, festate->chunks_fetched, es);
+        ExplainPropertyInteger("Remote Rows", NULL, festate->rows_fetched, es);
+        ExplainPropertyInteger("Remote Bytes", NULL, festate->bytes_fetched, es);
+        if (es->timing)
+        {
+            ExplainPropertyFloat("Conversion Time", "ms",
+                                 INSTR_TIME_GET_MILLISEC(festate->convert_time), 3, es);
+            if (festate->remote_plan != NIL)
+                ExplainPropertyFloat("Remote Latency", "ms",
+                                     festate->remote_latency * 1000.0, 3, es);
+        }
+        if (festate->remote_plan != NIL)
+            duckdb_explain_remote_plan(festate->remote_plan, es);
+    }
 }
 
 PG_FUNCTION_INFO_V1(duckdb_fdw_handler);
@@ -1290,8 +2486,26 @@ PG_FUNCTION_INFO_V1(duckdb_execute);
 Datum duckdb_execute(PG_FUNCTION_ARGS) {
     char *servername = NameStr(*PG_GETARG_NAME(0));
     char *query = text_to_cstring(PG_GETARG_TEXT_PP(1));
-    duckdb_connection conn = duckdb_get_connection(GetForeignServerByName(servername, false), false);
-    duckdb_do_sql_command(conn, query, LOG);
+    ForeignServer *server = GetForeignServerByName(servername, false);
+
+    instr_time start;
+    instr_time duration;
+
+    INSTR_TIME_SET_CURRENT(start);
+    if (duckdb_server_uses_host(server))
+        duckdb_host_exec(server, query, LOG);
+    else
+    {
+        duckdb_connection conn = duckdb_get_connection(server, true);
+
+        (void) duckdb_attach_catalogs(server, query);
+        duckdb_budget_acquire(conn, server);
+        duckdb_do_sql_command(conn, query, LOG);
+        duckdb_budget_release();
+    }
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, start);
+    duckdb_stats_record(server->serverid, query, 1, INSTR_TIME_GET_MILLISEC(duration), 0, 0, 0);
     PG_RETURN_VOID();
 }
 
@@ -1303,7 +2517,7 @@ Datum duckdb_create_s3_secret(PG_FUNCTION_ARGS) {
     char *secret = text_to_cstring(PG_GETARG_TEXT_PP(3));
     char *region = PG_ARGISNULL(4) ? NULL : text_to_cstring(PG_GETARG_TEXT_PP(4));
 
-	    duckdb_connection conn = duckdb_get_connection(GetForeignServerByName(servername, false), false);
+	    ForeignServer *server = GetForeignServerByName(servername, false);
 
 	    StringInfoData sql;
 		char *secret_id;
@@ -1327,7 +2541,10 @@ Datum duckdb_create_s3_secret(PG_FUNCTION_ARGS) {
 		}
 	    appendStringInfoString(&sql, " );");
 
-	    duckdb_do_sql_command(conn, sql.data, ERROR);
+	    if (duckdb_server_uses_host(server))
+	        duckdb_host_exec(server, sql.data, ERROR);
+	    else
+	        duckdb_do_sql_command(duckdb_get_connection(server, false), sql.data, ERROR);
 		pfree(secret_id);
 		pfree(key_lit);
 		pfree(secret_lit);
@@ -1436,6 +2653,228 @@ _PG_init(void)
 		NULL,
 		NULL);
 
+	DefineCustomIntVariable(
+		"duckdb_fdw.prepared_statement_cache_size",
+		"Maximum number of prepared DuckDB statements cached per connection.",
+		"Parameterized remote queries with identical SQL reuse a cached statement until the end of the transaction. Zero disables the cache.",
+		&duckdb_fdw_prepared_statement_cache_size,
+		32,
+		0,
+		INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomIntVariable(
+		"duckdb_fdw.max_connections_per_server",
+		"Maximum number of DuckDB connections a backend opens per server.",
+		"Scans running at the same time use separate connections up to this limit, then share them. Connections are closed at the end of the transaction.",
+		&duckdb_fdw_max_connections_per_server,
+		4,
+		1,
+		INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	/*
+	 * Defaults for the DuckDB engine settings; the server options of the same
+	 * names take precedence.  They apply when a connection is opened.
+	 */
+	DefineCustomIntVariable(
+		"duckdb_fdw.threads",
+		"Default number of DuckDB worker threads per connection.",
+		"Zero leaves DuckDB's default (all cores).",
+		&duckdb_fdw_threads,
+		0,
+		0,
+		INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomStringVariable(
+		"duckdb_fdw.memory_limit",
+		"Default DuckDB memory_limit per connection, e.g. '4GB'.",
+		"Empty leaves DuckDB's default (80% of RAM).",
+		&duckdb_fdw_memory_limit,
+		"",
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomStringVariable(
+		"duckdb_fdw.temp_directory",
+		"Default directory DuckDB spills to.",
+		NULL,
+		&duckdb_fdw_temp_directory,
+		"",
+		PGC_SUSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomStringVariable(
+		"duckdb_fdw.max_temp_directory_size",
+		"Default cap on DuckDB spill space, e.g. '50GB'.",
+		NULL,
+		&duckdb_fdw_max_temp_directory_size,
+		"",
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomBoolVariable(
+		"duckdb_fdw.preserve_insertion_order",
+		"Default for DuckDB's preserve_insertion_order setting.",
+		"Turning it off lets DuckDB use less memory for unordered results.",
+		&duckdb_fdw_preserve_insertion_order,
+		true,
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomStringVariable(
+		"duckdb_fdw.default_order",
+		"Default DuckDB sort direction ('asc' or 'desc').",
+		NULL,
+		&duckdb_fdw_default_order,
+		"",
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	/*
+	 * Cluster-wide budget shared by every backend's DuckDB.  Only effective
+	 * when duckdb_fdw is in shared_preload_libraries.
+	 */
+	DefineCustomIntVariable(
+		"duckdb_fdw.cluster_threads",
+		"Total DuckDB worker threads shared by all backends.",
+		"Zero disables the thread budget. Requires shared_preload_libraries.",
+		&duckdb_fdw_cluster_threads,
+		0,
+		0,
+		INT_MAX,
+		PGC_SIGHUP,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomIntVariable(
+		"duckdb_fdw.cluster_memory_limit",
+		"Total DuckDB memory shared by all backends.",
+		"Zero disables the memory budget. Requires shared_preload_libraries.",
+		&duckdb_fdw_cluster_memory_limit,
+		0,
+		0,
+		INT_MAX,
+		PGC_SIGHUP,
+		GUC_UNIT_MB,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomIntVariable(
+		"duckdb_fdw.budget_wait_timeout",
+		"Time a query waits for cluster budget before failing.",
+		"-1 waits indefinitely.",
+		&duckdb_fdw_budget_wait_timeout,
+		1000,
+		-1,
+		INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_MS,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomBoolVariable(
+		"duckdb_fdw.host_worker",
+		"Start a background worker that hosts DuckDB for servers with shared_host.",
+		"Requires shared_preload_libraries.",
+		&duckdb_fdw_host_worker,
+		false,
+		PGC_POSTMASTER,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomIntVariable(
+		"duckdb_fdw.stat_statements_max",
+		"Maximum number of remote statements tracked by duckdb_fdw_stat_statements.",
+		"Requires shared_preload_libraries.",
+		&duckdb_fdw_stat_statements_max,
+		1000,
+		100,
+		INT_MAX / 2,
+		PGC_POSTMASTER,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomBoolVariable(
+		"duckdb_fdw.track_statements",
+		"Collect statistics for duckdb_fdw_stat_statements.",
+		NULL,
+		&duckdb_fdw_track_statements,
+		true,
+		PGC_SUSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomEnumVariable(
+		"duckdb_fdw.metadata_estimates",
+		"Estimate foreign table sizes from Parquet footers and DuckDB catalog metadata.",
+		"\"local\" skips sources named by a URL, whose footers would be fetched while planning.",
+		&duckdb_fdw_metadata_estimates,
+		DUCKDB_METADATA_ESTIMATES_LOCAL,
+		metadata_estimates_options,
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL);
+
+	DefineCustomIntVariable(
+		"duckdb_fdw.metadata_cache_ttl",
+		"Seconds cached metadata estimates are used before being revalidated.",
+		NULL,
+		&duckdb_fdw_metadata_cache_ttl,
+		60,
+		0,
+		INT_MAX / 1000,
+		PGC_USERSET,
+		GUC_UNIT_S,
+		NULL,
+		NULL,
+		NULL);
+
+	duckdb_budget_init();
+	duckdb_host_init();
+	duckdb_stats_init();
+	duckdb_progress_init();
+
 	/*
 	 * Clear any pre-load placeholder or config-sourced value. The override
 	 * must be armed explicitly after duckdb_fdw is loaded into the backend.
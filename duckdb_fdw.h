@@ -12,6 +12,7 @@
 #include "utils/rel.h"
 #include "optimizer/cost.h"
 #include "optimizer/pathnode.h"
+#include "portability/instr_time.h"
 #include "runtime_guard.h"
 
 typedef struct duckdb_opt
@@ -19,6 +20,7 @@ typedef struct duckdb_opt
 	char	   *svr_database;
 	char	   *svr_table;
     bool        use_remote_estimate;
+    char       *on_conflict;        /* table option: error, nothing or update */
 } duckdb_opt;
 
 typedef struct DuckDBFdwRelationInfo
@@ -60,6 +62,12 @@ typedef struct DuckDBFdwRelationInfo
     List       *grouped_tlist;
     bool        is_tlist_func_pushdown;
     List       *final_remote_exprs;
+
+    /*
+     * Upper relation stage this entry was built for.  Only meaningful when
+     * the relation IS_UPPER_REL; outerrel then points at the input stage.
+     */
+    UpperRelationKind stage;
 } DuckDBFdwRelationInfo;
 
 typedef struct DuckDBFdwExecState
@@ -75,12 +83,43 @@ typedef struct DuckDBFdwExecState
     duckdb_prepared_statement prepared_stmt;
 
 	char	   *query;
+	char	   *cached_query;	/* reads query's cached result, if any */
 	TupleDesc	tupdesc;
     AttInMetadata *attinmeta;
 	List	   *retrieved_attrs;
     List       *param_expr_states;
     List       *param_exprs;
 
+    /* true while res holds a result that must be destroyed */
+    bool        has_result;
+
+    /* true while this scan holds a reference to the cluster budget grant */
+    bool        has_budget;
+
+    /* Shared host mode: queries run in the host worker, not on conn */
+    ForeignServer *server;
+    bool        use_host;
+    struct DuckDBHostResult *host_res;
+
+    /*
+     * Instrumentation: analyze is set under EXPLAIN ANALYZE and also profiles
+     * the remote query; instrument is set whenever the counters below are
+     * collected, for EXPLAIN ANALYZE or duckdb_fdw_stat_statements.
+     */
+    bool        analyze;
+    bool        instrument;
+    bool        chunk_capable;      /* every column has a chunk fast path */
+    List       *remote_plan;        /* DuckDB profiler's operators, in tree order */
+    double      remote_latency;     /* seconds, as reported by the profiler */
+    int64       executions;         /* runs of the remote query, rescans included */
+    int64       chunks_fetched;
+    int64       rows_fetched;
+    int64       bytes_fetched;
+    int64       fallback_cells;
+    int         text_columns;       /* columns per row converted through text */
+    instr_time  convert_time;
+    instr_time  exec_time;          /* time spent inserting, modify path only */
+
     /* Iteration state */
     int64_t     current_chunk_row_idx;
     int64_t     current_chunk_row_count;
@@ -91,6 +130,10 @@ typedef struct DuckDBFdwExecState
     int64_t     batch_row_count;
     char       *table_name;
     bool        use_appender;
+    const char *insert_verb;        /* INSERT, or INSERT OR IGNORE/REPLACE on conflict */
+    char       *stage_table;        /* temp table merged into the target at the end */
+    StringInfoData host_rows;       /* shared host: VALUES rows not sent yet */
+    int         host_nrows;
 } DuckDBFdwExecState;
 
 /* Exported functions */
@@ -104,6 +147,7 @@ extern Datum duckdb_execute(PG_FUNCTION_ARGS);
 extern Datum duckdb_create_s3_secret(PG_FUNCTION_ARGS);
 extern List *duckdb_import_foreign_schema(ImportForeignSchemaStmt *stmt, Oid serverOid);
 extern duckdb_opt * duckdb_get_options(Oid foreigntableid);
+extern char *duckdb_build_relation_reference(const char *table_name);
 extern char *duckdb_fdw_quote_literal(const char *input);
 extern char *duckdb_fdw_quote_identifier(const char *input);
 extern bool duckdb_fdw_is_valid_identifier(const char *input);
@@ -112,9 +156,154 @@ extern char *duckdb_fdw_redact_secret_text(const char *input);
 extern char *duckdb_fdw_trim_token(char *token);
 extern char *duckdb_fdw_next_token(char *str, const char *delim, char **saveptr);
 
+/* PostgreSQL 15.1 renamed SetSingleFuncCall; older releases have neither */
+#if PG_VERSION_NUM < 150000
+extern void duckdb_fdw_init_materialized_srf(FunctionCallInfo fcinfo);
+#define InitMaterializedSRF(fcinfo, flags) duckdb_fdw_init_materialized_srf(fcinfo)
+#elif PG_VERSION_NUM < 150001
+#define InitMaterializedSRF(fcinfo, flags) SetSingleFuncCall(fcinfo, flags)
+#endif
+
 /* Internal functions */
 extern void duckdb_do_sql_command(duckdb_connection conn, const char *sql, int level);
-extern duckdb_connection duckdb_get_connection(ForeignServer *server, bool truncatable);
+extern bool duckdb_run_prepared(duckdb_connection conn, duckdb_prepared_statement stmt, duckdb_result *res, char **errmsg);
+extern bool duckdb_run_query(duckdb_connection conn, const char *sql, duckdb_result *res, char **errmsg);
+extern List *duckdb_server_engine_settings(ForeignServer *server);
+extern List *duckdb_server_setup_commands(ForeignServer *server);
+extern const char *duckdb_setup_command_sql(duckdb_connection conn, const char *cmd);
+extern bool duckdb_attach_catalogs(ForeignServer *server, const char *text);
+extern duckdb_connection duckdb_xact_connection(ForeignServer *server);
+extern duckdb_appender duckdb_xact_appender(ForeignServer *server, Oid relid, const char *table);
+extern void duckdb_flush_xact_appenders(ForeignServer *server);
+extern void duckdb_register_xact_callbacks(void);
+extern duckdb_connection duckdb_get_connection(ForeignServer *server, bool for_write);
+extern duckdb_connection duckdb_lease_connection(ForeignServer *server, bool for_write);
+extern void duckdb_release_connection(duckdb_connection conn);
+extern duckdb_prepared_statement duckdb_acquire_prepared_statement(duckdb_connection conn, const char *sql);
+extern void duckdb_release_prepared_statement(duckdb_connection conn, duckdb_prepared_statement stmt);
+extern Datum duckdb_fdw_prepared_statement_cache_stats(PG_FUNCTION_ARGS);
+
+/* GUC variables */
+extern int duckdb_fdw_prepared_statement_cache_size;
+extern int duckdb_fdw_max_connections_per_server;
+extern int duckdb_fdw_threads;
+extern char *duckdb_fdw_memory_limit;
+extern char *duckdb_fdw_temp_directory;
+extern char *duckdb_fdw_max_temp_directory_size;
+extern bool duckdb_fdw_preserve_insertion_order;
+extern char *duckdb_fdw_default_order;
+extern int duckdb_fdw_cluster_threads;
+extern int duckdb_fdw_cluster_memory_limit;
+extern int duckdb_fdw_budget_wait_timeout;
+extern bool duckdb_fdw_host_worker;
+extern int duckdb_fdw_stat_statements_max;
+extern bool duckdb_fdw_track_statements;
+extern int duckdb_fdw_metadata_estimates;
+extern int duckdb_fdw_metadata_cache_ttl;
+
+/* Wait events reported while a backend is blocked inside DuckDB */
+typedef enum DuckDBWaitEvent
+{
+	DUCKDB_WAIT_QUERY,
+	DUCKDB_WAIT_FETCH_CHUNK,
+	DUCKDB_WAIT_APPENDER_FLUSH,
+	DUCKDB_WAIT_ATTACH,
+	DUCKDB_WAIT_EXTENSION_LOAD,
+	DUCKDB_WAIT_OPEN,
+	DUCKDB_WAIT_BUDGET,
+	DUCKDB_WAIT_NUM_EVENTS
+} DuckDBWaitEvent;
+
+extern uint32 duckdb_wait_event(DuckDBWaitEvent event);
+
+/* budget.c */
+extern void duckdb_budget_init(void);
+extern void duckdb_budget_acquire(duckdb_connection conn, ForeignServer *server);
+extern void duckdb_budget_release(void);
+extern void duckdb_budget_release_all(void);
+
+/* Values of duckdb_fdw.metadata_estimates */
+typedef enum DuckDBMetadataEstimates
+{
+	DUCKDB_METADATA_ESTIMATES_OFF,
+	DUCKDB_METADATA_ESTIMATES_LOCAL,	/* skip sources behind a URL */
+	DUCKDB_METADATA_ESTIMATES_ON
+} DuckDBMetadataEstimates;
+
+/* Values of the access_mode server option */
+typedef enum DuckDBAccessMode
+{
+	DUCKDB_ACCESS_READ_WRITE,
+	DUCKDB_ACCESS_READ_ONLY,
+	DUCKDB_ACCESS_AUTOMATIC
+} DuckDBAccessMode;
+
+extern DuckDBAccessMode duckdb_server_access_mode(ForeignServer *server);
+
+/* host.c */
+typedef struct DuckDBHostResult
+{
+	int			ncols;
+	int64		nrows;
+	char	  **values;			/* nrows * ncols text values, NULL for NULL */
+} DuckDBHostResult;
+
+extern void duckdb_host_init(void);
+extern bool duckdb_server_uses_host(ForeignServer *server);
+extern void duckdb_host_exec(ForeignServer *server, const char *sql, int level);
+extern void duckdb_host_insert(ForeignServer *server, const char *sql);
+extern DuckDBHostResult *duckdb_host_query(ForeignServer *server, const char *sql, List *params);
+extern void duckdb_host_commit_sessions(void);
+extern bool duckdb_host_in_transaction(void);
+extern void duckdb_host_abort_sessions(void);
+extern bool duckdb_host_abort_subxact(SubTransactionId mySubid);
+extern PGDLLEXPORT void duckdb_host_main(Datum main_arg);
+
+/* stats.c */
+extern void duckdb_stats_init(void);
+extern bool duckdb_stats_enabled(void);
+extern bool duckdb_stats_visible(Oid userid);
+extern void duckdb_stats_record(Oid serverid, const char *sql, int64 calls, double exec_ms,
+								int64 rows, double convert_ms, int64 fallback_cells);
+extern Datum duckdb_fdw_stat_statements(PG_FUNCTION_ARGS);
+extern Datum duckdb_fdw_stat_statements_reset(PG_FUNCTION_ARGS);
+
+/* progress.c */
+extern void duckdb_progress_init(void);
+extern bool duckdb_progress_enabled(void);
+extern void duckdb_progress_begin(Oid serverid, const char *sql);
+extern void duckdb_progress_update(duckdb_connection conn, bool force);
+extern void duckdb_progress_end(void);
+extern Datum duckdb_fdw_progress(PG_FUNCTION_ARGS);
+
+/* diskcache.c */
+typedef bool (*DuckDBCacheFileFilter) (const char *name);
+
+extern bool duckdb_disk_cache_parse_size(const char *value, int *size_mb);
+extern bool duckdb_server_disk_cache(ForeignServer *server, char **directory, int *max_size_mb);
+extern bool duckdb_cache_check_due(const char *directory, int interval_secs);
+extern void duckdb_trim_cache_directory(const char *directory, int max_size_mb,
+										DuckDBCacheFileFilter is_cache_file);
+extern void duckdb_disk_cache_maintain(ForeignServer *server);
+
+/* resultcache.c */
+extern char *duckdb_result_cache_query(ForeignServer *server, duckdb_connection conn,
+									   Oid foreigntableid, const char *sql);
+extern Datum duckdb_fdw_result_cache_stats(PG_FUNCTION_ARGS);
+
+/* localcache.c */
+extern bool duckdb_local_cache_parse_age(const char *value, int *age_s);
+extern char *duckdb_local_cache_relation(Oid relid);
+extern List *duckdb_local_cache_relids(PlannerInfo *root, Relids relids, const char *sql);
+extern char *duckdb_local_cache_revalidate(const char *sql, List *relids);
+extern Datum duckdb_fdw_refresh_cache(PG_FUNCTION_ARGS);
+
+/* estimate.c */
+extern bool duckdb_is_parquet_source(const char *source);
+extern char *duckdb_source_fingerprint(duckdb_connection conn, const char *source);
+extern bool duckdb_metadata_estimate(PlannerInfo *root, RelOptInfo *baserel,
+									 ForeignServer *server, Oid foreigntableid,
+									 const char *source, double *rows);
 
 /* Helper to get cleaned C-String for BuildTupleFromCStrings */
 extern char *duckdb_extract_as_cstring(duckdb_result *res, int col, uint64_t row, Oid pgtyp);
@@ -123,8 +312,12 @@ extern Datum duckdb_convert_to_pg(Oid pgtyp, int pgtypmod, duckdb_result *res, i
 /* Deparse functions */
 extern void duckdb_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo *rel, List *tlist, List *remote_conds, List *pathkeys, bool has_final_sort, bool has_limit, bool is_subquery, List **retrieved_attrs, List **params_list);
 extern List *duckdb_build_tlist_to_deparse(RelOptInfo *foreignrel);
+extern char *duckdb_deparse_table_reference(Oid relid);
 extern void duckdb_classify_conditions(PlannerInfo *root, RelOptInfo *baserel, List *input_conds, List **remote_conds, List **local_conds);
 extern bool duckdb_is_foreign_expr(PlannerInfo *root, RelOptInfo *baserel, Expr *expr);
+extern RelOptInfo *duckdb_get_upper_scanrel(RelOptInfo *rel);
+extern bool duckdb_can_bind_array_type(Oid elemtype);
+extern bool duckdb_is_foreign_sort_clause(PlannerInfo *root, RelOptInfo *rel, List *sortClause);
 
 typedef struct foreign_glob_cxt
 {
@@ -0,0 +1,534 @@
+/*-------------------------------------------------------------------------
+ *
+ * DuckDB Foreign Data Wrapper for PostgreSQL
+ *
+ * IDENTIFICATION
+ *        estimate.c
+ *
+ * Plan-time row estimates from metadata.  Parquet footers already record
+ * row counts and per-column min/max/null counts, and DuckDB keeps a row
+ * count for catalog tables (native, DuckLake), so a relation can be sized
+ * without reading data pages.  Parquet column ranges also give the
+ * selectivity of pushed-down range predicates.
+ *
+ * Results are cached per backend, keyed by server and table option.  After
+ * duckdb_fdw.metadata_cache_ttl a Parquet entry is revalidated against a
+ * fingerprint of its file set (count, total size, latest modification),
+ * which only lists the files.  Sources without usable metadata are cached
+ * as such for the same time.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "duckdb_fdw.h"
+
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/selfuncs.h"
+#include "utils/timestamp.h"
+
+/* Seconds between the Unix and PostgreSQL epochs */
+#define DUCKDB_PG_EPOCH_OFFSET_SECS \
+	((double) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY)
+
+typedef enum DuckDBRangeKind
+{
+	DUCKDB_RANGE_NONE,
+	DUCKDB_RANGE_NUMERIC,		/* min/max as numbers */
+	DUCKDB_RANGE_TEMPORAL		/* min/max as seconds since the Unix epoch */
+} DuckDBRangeKind;
+
+typedef struct DuckDBColumnStats
+{
+	char	   *name;
+	DuckDBRangeKind kind;
+	double		min;
+	double		max;
+	double		null_frac;		/* negative when unknown */
+} DuckDBColumnStats;
+
+typedef struct DuckDBMetadataEntry
+{
+	Oid			serverid;
+	char	   *source;			/* the table option */
+	char	   *fingerprint;	/* Parquet file set, NULL for catalog tables */
+	TimestampTz checked_at;
+	bool		missing;		/* no metadata; cached so planning skips the lookup */
+	double		rows;
+	int			ncols;
+	DuckDBColumnStats *cols;
+} DuckDBMetadataEntry;
+
+static List *metadata_cache = NIL;
+
+bool
+duckdb_is_parquet_source(const char *source)
+{
+	return strstr(source, ".parquet") != NULL && strstr(source, "read_parquet") == NULL;
+}
+
+/*
+ * Fingerprint of the files matching a Parquet path or glob, quoted as lit.
+ * read_blob only lists them; the content column is not read.
+ */
+static char *
+duckdb_parquet_fingerprint(duckdb_connection conn, const char *lit)
+{
+	duckdb_result res;
+	char	   *sql;
+	char	   *errmsg;
+	char	   *fingerprint = NULL;
+
+	sql = psprintf("SELECT count(*) || '/' || coalesce(sum(size), 0) || '/' || "
+				   "coalesce(max(last_modified)::VARCHAR, '') FROM read_blob(%s)", lit);
+	if (duckdb_run_query(conn, sql, &res, &errmsg))
+	{
+		char	   *value = duckdb_value_varchar(&res, 0, 0);
+
+		if (value != NULL)
+		{
+			fingerprint = pstrdup(value);
+			duckdb_free(value);
+		}
+		duckdb_destroy_result(&res);
+	}
+	pfree(sql);
+	return fingerprint;
+}
+
+/*
+ * Current fingerprint of a Parquet source, or NULL when it cannot be listed.
+ */
+char *
+duckdb_source_fingerprint(duckdb_connection conn, const char *source)
+{
+	char	   *lit = duckdb_fdw_quote_literal(source);
+	char	   *fingerprint = duckdb_parquet_fingerprint(conn, lit);
+
+	pfree(lit);
+	return fingerprint;
+}
+
+/*
+ * Read the row count and column statistics of a Parquet source from its
+ * footers.
+ */
+static bool
+duckdb_load_parquet_metadata(duckdb_connection conn, const char *lit,
+							 DuckDBMetadataEntry *entry)
+{
+	duckdb_result res;
+	char	   *sql;
+	char	   *errmsg;
+	idx_t		nrows;
+
+	sql = psprintf("SELECT coalesce(sum(num_rows), 0) FROM parquet_file_metadata(%s)", lit);
+	if (!duckdb_run_query(conn, sql, &res, &errmsg))
+	{
+		elog(DEBUG1, "duckdb_fdw: no Parquet metadata for %s: %s", lit, errmsg);
+		pfree(sql);
+		return false;
+	}
+	entry->rows = (double) duckdb_value_int64(&res, 0, 0);
+	duckdb_destroy_result(&res);
+	pfree(sql);
+
+	sql = psprintf("SELECT path_in_schema, "
+				   "min(TRY_CAST(stats_min_value AS DOUBLE)), "
+				   "max(TRY_CAST(stats_max_value AS DOUBLE)), "
+				   "min(epoch(TRY_CAST(stats_min_value AS TIMESTAMP))), "
+				   "max(epoch(TRY_CAST(stats_max_value AS TIMESTAMP))), "
+				   "sum(stats_null_count), sum(num_values) "
+				   "FROM parquet_metadata(%s) GROUP BY path_in_schema", lit);
+	if (!duckdb_run_query(conn, sql, &res, &errmsg))
+	{
+		/* The row count alone is still worth having */
+		elog(DEBUG1, "duckdb_fdw: no Parquet column statistics for %s: %s", lit, errmsg);
+		pfree(sql);
+		return true;
+	}
+	pfree(sql);
+
+	nrows = duckdb_row_count(&res);
+	entry->cols = MemoryContextAllocZero(CacheMemoryContext,
+										 Max(nrows, 1) * sizeof(DuckDBColumnStats));
+	entry->ncols = (int) nrows;
+	for (idx_t i = 0; i < nrows; i++)
+	{
+		DuckDBColumnStats *col = &entry->cols[i];
+		char	   *name = duckdb_value_varchar(&res, 0, i);
+
+		col->name = MemoryContextStrdup(CacheMemoryContext, name ? name : "");
+		duckdb_free(name);
+
+		if (!duckdb_value_is_null(&res, 1, i) && !duckdb_value_is_null(&res, 2, i))
+		{
+			col->kind = DUCKDB_RANGE_NUMERIC;
+			col->min = duckdb_value_double(&res, 1, i);
+			col->max = duckdb_value_double(&res, 2, i);
+		}
+		else if (!duckdb_value_is_null(&res, 3, i) && !duckdb_value_is_null(&res, 4, i))
+		{
+			col->kind = DUCKDB_RANGE_TEMPORAL;
+			col->min = duckdb_value_double(&res, 3, i);
+			col->max = duckdb_value_double(&res, 4, i);
+		}
+		else
+			col->kind = DUCKDB_RANGE_NONE;
+
+		col->null_frac = -1;
+		if (!duckdb_value_is_null(&res, 5, i) && entry->rows > 0)
+			col->null_frac = Min((double) duckdb_value_int64(&res, 5, i) / entry->rows, 1.0);
+	}
+	duckdb_destroy_result(&res);
+	return true;
+}
+
+/*
+ * Row count DuckDB keeps for a catalog table named [[database.]schema.]table.
+ */
+static bool
+duckdb_load_catalog_metadata(duckdb_connection conn, const char *source,
+							 DuckDBMetadataEntry *entry)
+{
+	char	   *copy;
+	char	   *parts[3];
+	int			nparts = 0;
+	char	   *saveptr = NULL;
+	char	   *token;
+	StringInfoData sql;
+	duckdb_result res;
+	char	   *errmsg;
+	bool		found = false;
+	static const char *const columns[3] = {"database_name", "schema_name", "table_name"};
+
+	/* Quoted names and table functions are left to the default estimate */
+	if (strchr(source, '"') != NULL || strchr(source, '(') != NULL)
+		return false;
+
+	copy = pstrdup(source);
+	for (token = duckdb_fdw_next_token(copy, ".", &saveptr); token != NULL;
+		 token = duckdb_fdw_next_token(NULL, ".", &saveptr))
+	{
+		if (nparts == 3)
+		{
+			pfree(copy);
+			return false;
+		}
+		parts[nparts++] = duckdb_fdw_trim_token(token);
+	}
+	if (nparts == 0)
+	{
+		pfree(copy);
+		return false;
+	}
+
+	initStringInfo(&sql);
+	appendStringInfoString(&sql, "SELECT estimated_size FROM duckdb_tables() WHERE true");
+	for (int i = 0; i < nparts; i++)
+	{
+		char	   *lit = duckdb_fdw_quote_literal(parts[i]);
+
+		appendStringInfo(&sql, " AND %s = %s", columns[3 - nparts + i], lit);
+		pfree(lit);
+	}
+
+	if (duckdb_run_query(conn, sql.data, &res, &errmsg))
+	{
+		/* An ambiguous name matches several tables; do not guess */
+		if (duckdb_row_count(&res) == 1 && !duckdb_value_is_null(&res, 0, 0))
+		{
+			entry->rows = (double) duckdb_value_int64(&res, 0, 0);
+			found = true;
+		}
+		duckdb_destroy_result(&res);
+	}
+	pfree(sql.data);
+	pfree(copy);
+	return found;
+}
+
+static void
+duckdb_free_metadata_entry(DuckDBMetadataEntry *entry)
+{
+	for (int i = 0; i < entry->ncols; i++)
+		pfree(entry->cols[i].name);
+	if (entry->cols)
+		pfree(entry->cols);
+	if (entry->fingerprint)
+		pfree(entry->fingerprint);
+	pfree(entry->source);
+	pfree(entry);
+}
+
+/*
+ * Look up, revalidate or load the metadata of a table option.
+ */
+static DuckDBMetadataEntry *
+duckdb_get_metadata(ForeignServer *server, const char *source)
+{
+	DuckDBMetadataEntry *entry = NULL;
+	duckdb_connection conn;
+	bool		parquet = duckdb_is_parquet_source(source);
+	char	   *lit = NULL;
+	char	   *fingerprint = NULL;
+	TimestampTz now = GetCurrentTimestamp();
+	ListCell   *lc;
+	bool		ok;
+
+	foreach(lc, metadata_cache)
+	{
+		DuckDBMetadataEntry *e = (DuckDBMetadataEntry *) lfirst(lc);
+
+		if (e->serverid == server->serverid && strcmp(e->source, source) == 0)
+		{
+			entry = e;
+			break;
+		}
+	}
+
+	if (entry != NULL &&
+		!TimestampDifferenceExceeds(entry->checked_at, now,
+									duckdb_fdw_metadata_cache_ttl * 1000))
+		return entry->missing ? NULL : entry;
+
+	conn = duckdb_get_connection(server, false);
+	if (parquet)
+	{
+		lit = duckdb_fdw_quote_literal(source);
+		fingerprint = duckdb_parquet_fingerprint(conn, lit);
+		if (fingerprint != NULL)
+		{
+			char	   *copy = MemoryContextStrdup(CacheMemoryContext, fingerprint);
+
+			pfree(fingerprint);
+			fingerprint = copy;
+		}
+	}
+
+	if (entry != NULL)
+	{
+		/* Unchanged files keep their statistics */
+		if (parquet && fingerprint != NULL && entry->fingerprint != NULL &&
+			strcmp(fingerprint, entry->fingerprint) == 0)
+		{
+			pfree(fingerprint);
+			pfree(lit);
+			entry->checked_at = now;
+			return entry->missing ? NULL : entry;
+		}
+		metadata_cache = list_delete_ptr(metadata_cache, entry);
+		duckdb_free_metadata_entry(entry);
+	}
+
+	entry = MemoryContextAllocZero(CacheMemoryContext, sizeof(DuckDBMetadataEntry));
+	entry->serverid = server->serverid;
+	entry->source = MemoryContextStrdup(CacheMemoryContext, source);
+	entry->fingerprint = fingerprint;
+	entry->checked_at = now;
+
+	if (parquet)
+	{
+		ok = duckdb_load_parquet_metadata(conn, lit, entry);
+		pfree(lit);
+	}
+	else
+		ok = duckdb_load_catalog_metadata(conn, source, entry);
+
+	/* Remember a failed lookup too, so each plan does not repeat it */
+	entry->missing = !ok;
+
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(CacheMemoryContext);
+
+		metadata_cache = lappend(metadata_cache, entry);
+		MemoryContextSwitchTo(oldcxt);
+	}
+	return entry->missing ? NULL : entry;
+}
+
+static DuckDBColumnStats *
+duckdb_find_column_stats(DuckDBMetadataEntry *entry, Oid relid, AttrNumber attnum)
+{
+	char	   *colname = NULL;
+	ListCell   *lc;
+
+	foreach(lc, GetForeignColumnOptions(relid, attnum))
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "column_name") == 0)
+			colname = defGetString(def);
+	}
+	if (colname == NULL)
+		colname = get_attname(relid, attnum, false);
+
+	for (int i = 0; i < entry->ncols; i++)
+	{
+		if (strcmp(entry->cols[i].name, colname) == 0)
+			return &entry->cols[i];
+	}
+	return NULL;
+}
+
+/*
+ * A constant as a number comparable with the column's min/max.
+ */
+static bool
+duckdb_const_to_range_value(Const *c, DuckDBRangeKind kind, double *value)
+{
+	if (c->constisnull)
+		return false;
+
+	switch (c->consttype)
+	{
+		case INT2OID:
+			*value = DatumGetInt16(c->constvalue);
+			return kind == DUCKDB_RANGE_NUMERIC;
+		case INT4OID:
+			*value = DatumGetInt32(c->constvalue);
+			return kind == DUCKDB_RANGE_NUMERIC;
+		case INT8OID:
+			*value = (double) DatumGetInt64(c->constvalue);
+			return kind == DUCKDB_RANGE_NUMERIC;
+		case FLOAT4OID:
+			*value = DatumGetFloat4(c->constvalue);
+			return kind == DUCKDB_RANGE_NUMERIC;
+		case FLOAT8OID:
+			*value = DatumGetFloat8(c->constvalue);
+			return kind == DUCKDB_RANGE_NUMERIC;
+		case NUMERICOID:
+			*value = DatumGetFloat8(DirectFunctionCall1(numeric_float8, c->constvalue));
+			return kind == DUCKDB_RANGE_NUMERIC;
+		case DATEOID:
+			if (DATE_NOT_FINITE(DatumGetDateADT(c->constvalue)))
+				return false;
+			*value = (double) DatumGetDateADT(c->constvalue) * SECS_PER_DAY +
+				DUCKDB_PG_EPOCH_OFFSET_SECS;
+			return kind == DUCKDB_RANGE_TEMPORAL;
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			if (TIMESTAMP_NOT_FINITE(DatumGetTimestamp(c->constvalue)))
+				return false;
+			*value = (double) DatumGetTimestamp(c->constvalue) / USECS_PER_SEC +
+				DUCKDB_PG_EPOCH_OFFSET_SECS;
+			return kind == DUCKDB_RANGE_TEMPORAL;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Selectivity of one restriction clause from the column statistics, or a
+ * negative value when they do not apply.
+ */
+static Selectivity
+duckdb_metadata_clause_selectivity(DuckDBMetadataEntry *entry, Oid relid, Index varno,
+								   Expr *clause)
+{
+	if (IsA(clause, NullTest))
+	{
+		NullTest   *nt = (NullTest *) clause;
+		Var		   *var = (Var *) nt->arg;
+		DuckDBColumnStats *col;
+
+		if (!IsA(var, Var) || var->varno != varno || var->varattno <= 0)
+			return -1;
+		col = duckdb_find_column_stats(entry, relid, var->varattno);
+		if (col == NULL || col->null_frac < 0)
+			return -1;
+		return nt->nulltesttype == IS_NULL ? col->null_frac : 1.0 - col->null_frac;
+	}
+
+	if (IsA(clause, OpExpr) && list_length(((OpExpr *) clause)->args) == 2)
+	{
+		OpExpr	   *op = (OpExpr *) clause;
+		Node	   *left = strip_implicit_coercions(linitial(op->args));
+		Node	   *right = strip_implicit_coercions(lsecond(op->args));
+		char	   *opname = get_opname(op->opno);
+		bool		var_on_left = true;
+		Var		   *var;
+		Const	   *c;
+		DuckDBColumnStats *col;
+		double		value;
+		double		fraction;
+
+		if (IsA(left, Const) && IsA(right, Var))
+		{
+			Node	   *tmp = left;
+
+			left = right;
+			right = tmp;
+			var_on_left = false;
+		}
+		if (!IsA(left, Var) || !IsA(right, Const) || opname == NULL)
+			return -1;
+		var = (Var *) left;
+		c = (Const *) right;
+		if (var->varno != varno || var->varattno <= 0)
+			return -1;
+
+		col = duckdb_find_column_stats(entry, relid, var->varattno);
+		if (col == NULL || col->kind == DUCKDB_RANGE_NONE ||
+			!duckdb_const_to_range_value(c, col->kind, &value))
+			return -1;
+
+		if (strcmp(opname, "=") == 0)
+			return (value < col->min || value > col->max) ? 0.0 : -1;
+
+		/* Fraction of the column's range below the constant */
+		if (col->max <= col->min)
+			fraction = value < col->min ? 0.0 : 1.0;
+		else
+			fraction = (value - col->min) / (col->max - col->min);
+		fraction = Max(Min(fraction, 1.0), 0.0);
+
+		/* "c < col" is "col > c" */
+		if (strcmp(opname, "<") == 0 || strcmp(opname, "<=") == 0)
+			return var_on_left ? fraction : 1.0 - fraction;
+		if (strcmp(opname, ">") == 0 || strcmp(opname, ">=") == 0)
+			return var_on_left ? 1.0 - fraction : fraction;
+	}
+
+	return -1;
+}
+
+/*
+ * Estimate the rows of a foreign table scan from metadata alone, applying
+ * baserel's restriction clauses.  Returns false when no metadata is
+ * available, leaving the caller to its default estimate.
+ */
+bool
+duckdb_metadata_estimate(PlannerInfo *root, RelOptInfo *baserel, ForeignServer *server,
+						 Oid foreigntableid, const char *source, double *rows)
+{
+	DuckDBMetadataEntry *entry;
+	Selectivity selectivity = 1.0;
+	ListCell   *lc;
+
+	entry = duckdb_get_metadata(server, source);
+	if (entry == NULL)
+		return false;
+
+	foreach(lc, baserel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+		Selectivity s;
+
+		s = duckdb_metadata_clause_selectivity(entry, foreigntableid, baserel->relid,
+											   rinfo->clause);
+		if (s < 0)
+			s = clause_selectivity(root, (Node *) rinfo, baserel->relid, JOIN_INNER, NULL);
+		selectivity *= s;
+	}
+
+	*rows = clamp_row_est(entry->rows * selectivity);
+	return true;
+}
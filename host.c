@@ -0,0 +1,1375 @@
+/*-------------------------------------------------------------------------
+ *
+ * DuckDB Foreign Data Wrapper for PostgreSQL
+ *
+ * IDENTIFICATION
+ *        host.c
+ *
+ * Shared DuckDB host.  Normally every backend opens its own DuckDB, which
+ * duplicates buffer pools and, because of DuckDB's single-writer file lock,
+ * keeps a second backend from opening the same database file read-write.
+ * With duckdb_fdw.host_worker enabled, a background worker owns one DuckDB
+ * instance per database path instead.  Backends on servers with the
+ * shared_host option send it deparsed SQL over a pair of shm_mq queues and
+ * read back the result in text form.
+ *
+ * The host is serialized: it runs one request at a time for all sessions,
+ * and DuckDB parallelizes each query internally.  Queries run through
+ * DuckDB's pending-result API, so a backend that gives up on its request
+ * (query cancel, statement_timeout, an error) interrupts it instead of
+ * leaving the host busy.  Backends read every result to completion as soon
+ * as it is sent, so a slow consumer never stalls the host.
+ *
+ * A session's inserts run in one DuckDB transaction, committed when the
+ * backend's transaction commits and rolled back by dropping the session.
+ *
+ * A database is set up once, by the first session to open it, and later
+ * sessions must ask for the same settings and setup.  Secrets are the
+ * exception: they come from the user mapping, so each session keeps its own
+ * and the host swaps them in before running that session's request.
+ * Attached catalogs keep the credentials they were attached with, so they
+ * are only shared by sessions with the same secrets.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "duckdb_fdw.h"
+
+#include "access/xact.h"
+#include "commands/defrem.h"
+#include "libpq/pqformat.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shm_toc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+
+#define DUCKDB_HOST_MAGIC			0x44424846	/* "DBHF" */
+#define DUCKDB_HOST_QUEUE_SIZE		(1024 * 1024)
+#define DUCKDB_HOST_MAX_PENDING		64
+#define DUCKDB_HOST_ROWS_PER_MSG	1024
+
+/* Requests, backend to host */
+#define HOST_MSG_OPEN		'O'
+#define HOST_MSG_QUERY		'Q'
+#define HOST_MSG_EXEC		'X'
+#define HOST_MSG_CANCEL		'Z'		/* interrupt the running request */
+
+/* Replies, host to backend */
+#define HOST_MSG_OK			'K'
+#define HOST_MSG_ROWDESC	'T'
+#define HOST_MSG_DATA		'D'
+#define HOST_MSG_COMPLETE	'C'
+#define HOST_MSG_ERROR		'E'
+
+typedef struct DuckDBHostShared
+{
+	slock_t		mutex;
+	pid_t		host_pid;		/* 0 while no host is running */
+	Latch	   *host_latch;
+	int			npending;
+	dsm_handle	pending[DUCKDB_HOST_MAX_PENDING];	/* sessions to pick up */
+} DuckDBHostShared;
+
+static DuckDBHostShared *host = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/*
+ * Backend side: one session per foreign server and user, kept for the
+ * backend's life
+ */
+typedef struct DuckDBHostSession
+{
+	Oid			serverid;
+	Oid			userid;
+	dsm_segment *seg;
+	shm_mq_handle *request;
+	shm_mq_handle *response;
+	bool		busy;			/* a reply is still being read */
+	bool		in_xact;		/* the host holds an open transaction */
+	SubTransactionId xact_subid;	/* subtransaction that began it */
+	SubTransactionId insert_subid;	/* subtransaction of the latest insert */
+} DuckDBHostSession;
+
+static List *host_sessions = NIL;
+
+/* Host side */
+typedef struct HostSession HostSession;
+
+typedef struct HostDatabase
+{
+	char	   *path;
+	duckdb_database db;
+	List	   *settings;		/* "name=value" strings it was opened with */
+	List	   *setup;			/* setup commands it ran, minus secrets */
+	List	   *catalog_secrets;	/* secrets its catalogs were attached with */
+	HostSession *secrets_owner; /* session whose secrets are installed */
+} HostDatabase;
+
+struct HostSession
+{
+	dsm_segment *seg;
+	shm_mq_handle *request;
+	shm_mq_handle *response;
+	duckdb_connection conn;
+	HostDatabase *hdb;
+	List	   *secrets;		/* CREATE SECRET commands for this session */
+	bool		cancelled;		/* the backend gave up on the session */
+};
+
+static List *host_databases = NIL;
+
+static void
+duckdb_host_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+	RequestAddinShmemSpace(MAXALIGN(sizeof(DuckDBHostShared)));
+}
+
+static void
+duckdb_host_shmem_startup(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	host = ShmemInitStruct("duckdb_fdw host", sizeof(DuckDBHostShared), &found);
+	if (!found)
+	{
+		SpinLockInit(&host->mutex);
+		host->host_pid = 0;
+		host->host_latch = NULL;
+		host->npending = 0;
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Reserve shared memory and register the host worker.  Called from _PG_init;
+ * the host is only available when the library is preloaded.
+ */
+void
+duckdb_host_init(void)
+{
+	BackgroundWorker worker;
+
+	if (!process_shared_preload_libraries_in_progress || !duckdb_fdw_host_worker)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = duckdb_host_shmem_request;
+#else
+	duckdb_host_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = duckdb_host_shmem_startup;
+
+	MemSet(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 10;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "duckdb_fdw");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "duckdb_host_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "duckdb_fdw host");
+	snprintf(worker.bgw_type, BGW_MAXLEN, "duckdb_fdw host");
+	RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * True if queries on this server run in the shared host.
+ */
+bool
+duckdb_server_uses_host(ForeignServer *server)
+{
+	ListCell   *lc;
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "shared_host") == 0)
+			return defGetBoolean(def);
+	}
+	return false;
+}
+
+/*
+ * Length-prefixed strings; a length of -1 stands for NULL.
+ */
+static void
+host_put_text(StringInfo buf, const char *s)
+{
+	if (s == NULL)
+	{
+		pq_sendint32(buf, -1);
+		return;
+	}
+	pq_sendint32(buf, (int32) strlen(s));
+	pq_sendbytes(buf, s, strlen(s));
+}
+
+static char *
+host_get_text(StringInfo msg)
+{
+	int32		len = (int32) pq_getmsgint(msg, 4);
+
+	if (len < 0)
+		return NULL;
+	return pnstrdup(pq_getmsgbytes(msg, len), len);
+}
+
+static shm_mq_result
+host_mq_send(shm_mq_handle *mqh, StringInfo buf, bool nowait)
+{
+#if PG_VERSION_NUM >= 150000
+	return shm_mq_send(mqh, buf->len, buf->data, nowait, true);
+#else
+	return shm_mq_send(mqh, buf->len, buf->data, nowait);
+#endif
+}
+
+/* ---------------------------------------------------------------------
+ * Backend side
+ * ---------------------------------------------------------------------
+ */
+
+static void
+duckdb_host_drop_session(DuckDBHostSession *sess)
+{
+	host_sessions = list_delete_ptr(host_sessions, sess);
+	dsm_detach(sess->seg);
+	pfree(sess);
+}
+
+static void
+duckdb_host_send(DuckDBHostSession *sess, StringInfo buf)
+{
+	if (host_mq_send(sess->request, buf, false) != SHM_MQ_SUCCESS)
+	{
+		duckdb_host_drop_session(sess);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+				 errmsg("duckdb_fdw: lost connection to the DuckDB host worker")));
+	}
+	sess->busy = true;
+}
+
+/*
+ * Read the next reply into msg and return its tag.  The message data stays
+ * valid until the next receive on the session.  An error reply ends the
+ * request and is raised here.
+ */
+static char
+duckdb_host_receive(DuckDBHostSession *sess, StringInfo msg)
+{
+	Size		nbytes;
+	void	   *data;
+	char		tag;
+
+	if (shm_mq_receive(sess->response, &nbytes, &data, false) != SHM_MQ_SUCCESS)
+	{
+		duckdb_host_drop_session(sess);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+				 errmsg("duckdb_fdw: lost connection to the DuckDB host worker")));
+	}
+
+	msg->data = (char *) data;
+	msg->len = (int) nbytes;
+	msg->maxlen = (int) nbytes;
+	msg->cursor = 0;
+
+	tag = pq_getmsgbyte(msg);
+	if (tag == HOST_MSG_COMPLETE || tag == HOST_MSG_OK || tag == HOST_MSG_ERROR)
+		sess->busy = false;
+	if (tag == HOST_MSG_ERROR)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("duckdb_fdw: query failed: %s", host_get_text(msg))));
+	return tag;
+}
+
+static DuckDBHostSession *
+duckdb_host_get_session(ForeignServer *server)
+{
+	DuckDBHostSession *sess;
+	MemoryContext oldcxt;
+	shm_toc_estimator e;
+	shm_toc    *toc;
+	shm_mq	   *mq;
+	Size		segsize;
+	const char *dbpath = NULL;
+	ListCell   *lc;
+	StringInfoData buf;
+	StringInfoData reply;
+	List	   *settings;
+	List	   *setup;
+	bool		published = false;
+
+	foreach(lc, host_sessions)
+	{
+		sess = (DuckDBHostSession *) lfirst(lc);
+		if (sess->serverid == server->serverid && sess->userid == GetUserId())
+			return sess;
+	}
+
+	duckdb_register_xact_callbacks();
+
+	if (host == NULL || host->host_pid == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+				 errmsg("duckdb_fdw: server \"%s\" uses shared_host, but the DuckDB host worker is not running",
+						server->servername),
+				 errhint("Add duckdb_fdw to shared_preload_libraries and set duckdb_fdw.host_worker = on.")));
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "database") == 0)
+			dbpath = defGetString(def);
+		else if (strcmp(def->defname, "quack_host") == 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+					 errmsg("duckdb_fdw: shared_host cannot be combined with quack_host")));
+	}
+
+	settings = duckdb_server_engine_settings(server);
+	setup = duckdb_server_setup_commands(server);
+
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+	shm_toc_initialize_estimator(&e);
+	shm_toc_estimate_chunk(&e, DUCKDB_HOST_QUEUE_SIZE);
+	shm_toc_estimate_chunk(&e, DUCKDB_HOST_QUEUE_SIZE);
+	shm_toc_estimate_keys(&e, 2);
+	segsize = shm_toc_estimate(&e);
+
+	sess = palloc0(sizeof(DuckDBHostSession));
+	sess->serverid = server->serverid;
+	sess->userid = GetUserId();
+	sess->seg = dsm_create(segsize, 0);
+	dsm_pin_mapping(sess->seg);
+	toc = shm_toc_create(DUCKDB_HOST_MAGIC, dsm_segment_address(sess->seg), segsize);
+
+	mq = shm_mq_create(shm_toc_allocate(toc, DUCKDB_HOST_QUEUE_SIZE), DUCKDB_HOST_QUEUE_SIZE);
+	shm_toc_insert(toc, 0, mq);
+	shm_mq_set_sender(mq, MyProc);
+	sess->request = shm_mq_attach(mq, sess->seg, NULL);
+
+	mq = shm_mq_create(shm_toc_allocate(toc, DUCKDB_HOST_QUEUE_SIZE), DUCKDB_HOST_QUEUE_SIZE);
+	shm_toc_insert(toc, 1, mq);
+	shm_mq_set_receiver(mq, MyProc);
+	sess->response = shm_mq_attach(mq, sess->seg, NULL);
+
+	host_sessions = lappend(host_sessions, sess);
+	MemoryContextSwitchTo(oldcxt);
+
+	SpinLockAcquire(&host->mutex);
+	if (host->npending < DUCKDB_HOST_MAX_PENDING)
+	{
+		host->pending[host->npending++] = dsm_segment_handle(sess->seg);
+		published = true;
+	}
+	if (published && host->host_latch != NULL)
+		SetLatch(host->host_latch);
+	SpinLockRelease(&host->mutex);
+
+	if (!published)
+	{
+		duckdb_host_drop_session(sess);
+		ereport(ERROR,
+				(errcode(ERRCODE_TOO_MANY_CONNECTIONS),
+				 errmsg("duckdb_fdw: too many sessions waiting for the DuckDB host worker")));
+	}
+
+	/* Open (or join) the server's database in the host */
+	initStringInfo(&buf);
+	pq_sendbyte(&buf, HOST_MSG_OPEN);
+	host_put_text(&buf, dbpath);
+	pq_sendint32(&buf, list_length(settings));
+	foreach(lc, settings)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		host_put_text(&buf, def->defname);
+		host_put_text(&buf, strVal(def->arg));
+	}
+	pq_sendint32(&buf, list_length(setup));
+	foreach(lc, setup)
+		host_put_text(&buf, (char *) lfirst(lc));
+
+	duckdb_host_send(sess, &buf);
+	pfree(buf.data);
+
+	PG_TRY();
+	{
+		(void) duckdb_host_receive(sess, &reply);
+	}
+	PG_CATCH();
+	{
+		if (list_member_ptr(host_sessions, sess))
+			duckdb_host_drop_session(sess);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return sess;
+}
+
+/*
+ * Run a statement without a result set on a session.
+ */
+static void
+duckdb_host_session_exec(DuckDBHostSession *sess, const char *sql, int level)
+{
+	StringInfoData buf;
+	StringInfoData reply;
+	Size		nbytes;
+	void	   *data;
+
+	initStringInfo(&buf);
+	pq_sendbyte(&buf, HOST_MSG_EXEC);
+	host_put_text(&buf, sql);
+	duckdb_host_send(sess, &buf);
+	pfree(buf.data);
+
+	if (level >= ERROR)
+	{
+		(void) duckdb_host_receive(sess, &reply);
+		return;
+	}
+
+	if (shm_mq_receive(sess->response, &nbytes, &data, false) != SHM_MQ_SUCCESS)
+	{
+		duckdb_host_drop_session(sess);
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+				 errmsg("duckdb_fdw: lost connection to the DuckDB host worker")));
+	}
+	sess->busy = false;
+	if (nbytes > 0 && ((char *) data)[0] == HOST_MSG_ERROR)
+	{
+		reply.data = (char *) data;
+		reply.len = reply.maxlen = (int) nbytes;
+		reply.cursor = 1;
+		ereport(level,
+				(errmsg("duckdb_fdw: failed to execute sql: %s", sql),
+				 errdetail("%s", host_get_text(&reply))));
+	}
+}
+
+/*
+ * Run a statement without a result set in the host.  Like
+ * duckdb_do_sql_command, a failure is reported at the given level.
+ */
+void
+duckdb_host_exec(ForeignServer *server, const char *sql, int level)
+{
+	duckdb_host_session_exec(duckdb_host_get_session(server), sql, level);
+}
+
+/*
+ * Run an INSERT in the host, inside the DuckDB transaction the session holds
+ * for the backend's transaction.  The first insert begins it;
+ * duckdb_host_commit_sessions commits it.
+ */
+void
+duckdb_host_insert(ForeignServer *server, const char *sql)
+{
+	DuckDBHostSession *sess = duckdb_host_get_session(server);
+
+	if (!sess->in_xact)
+	{
+		duckdb_host_session_exec(sess, "BEGIN TRANSACTION", ERROR);
+		sess->in_xact = true;
+		sess->xact_subid = GetCurrentSubTransactionId();
+	}
+	sess->insert_subid = GetCurrentSubTransactionId();
+	duckdb_host_session_exec(sess, sql, ERROR);
+}
+
+/*
+ * Run a query in the host and read its whole result.  params holds the text
+ * form of each $n parameter, NULL for SQL NULL; DuckDB casts them to the
+ * types the statement expects.
+ */
+DuckDBHostResult *
+duckdb_host_query(ForeignServer *server, const char *sql, List *params)
+{
+	DuckDBHostSession *sess = duckdb_host_get_session(server);
+	DuckDBHostResult *result = palloc0(sizeof(DuckDBHostResult));
+	StringInfoData buf;
+	StringInfoData reply;
+	int64		capacity = 0;
+	ListCell   *lc;
+	char		tag;
+
+	initStringInfo(&buf);
+	pq_sendbyte(&buf, HOST_MSG_QUERY);
+	host_put_text(&buf, sql);
+	pq_sendint32(&buf, list_length(params));
+	foreach(lc, params)
+		host_put_text(&buf, (char *) lfirst(lc));
+	duckdb_host_send(sess, &buf);
+	pfree(buf.data);
+
+	while ((tag = duckdb_host_receive(sess, &reply)) != HOST_MSG_COMPLETE)
+	{
+		if (tag == HOST_MSG_ROWDESC)
+			result->ncols = (int) pq_getmsgint(&reply, 4);
+		else if (tag == HOST_MSG_DATA)
+		{
+			int			nrows = (int) pq_getmsgint(&reply, 4);
+			int64		nvalues = (int64) nrows * result->ncols;
+			int64		needed = result->nrows * result->ncols + nvalues;
+			int64		i;
+
+			if (needed > capacity)
+			{
+				capacity = Max(needed, capacity * 2);
+				if (result->values == NULL)
+					result->values = palloc_extended(capacity * sizeof(char *), MCXT_ALLOC_HUGE);
+				else
+					result->values = repalloc_huge(result->values, capacity * sizeof(char *));
+			}
+			for (i = 0; i < nvalues; i++)
+				result->values[result->nrows * result->ncols + i] = host_get_text(&reply);
+			result->nrows += nrows;
+		}
+		else
+			elog(ERROR, "duckdb_fdw: unexpected message \"%c\" from the DuckDB host worker", tag);
+	}
+
+	return result;
+}
+
+/*
+ * Commit the host transactions holding the backend transaction's inserts.
+ * Called before the local commit, so a DuckDB failure fails it.
+ */
+void
+duckdb_host_commit_sessions(void)
+{
+	ListCell   *lc;
+
+	foreach(lc, host_sessions)
+	{
+		DuckDBHostSession *sess = (DuckDBHostSession *) lfirst(lc);
+
+		if (sess->in_xact)
+		{
+			duckdb_host_session_exec(sess, "COMMIT", ERROR);
+			sess->in_xact = false;
+		}
+	}
+}
+
+/*
+ * True if some session holds inserts of the current transaction.
+ */
+bool
+duckdb_host_in_transaction(void)
+{
+	ListCell   *lc;
+
+	foreach(lc, host_sessions)
+	{
+		if (((DuckDBHostSession *) lfirst(lc))->in_xact)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Give up on a session: ask the host to interrupt a request still running
+ * for it, and detach.  The host then closes the session, which rolls back
+ * its transaction, and discards the rest of any reply instead of waiting for
+ * this backend to read it.
+ */
+static void
+duckdb_host_cancel_session(DuckDBHostSession *sess)
+{
+	if (sess->busy)
+	{
+		char		tag = HOST_MSG_CANCEL;
+
+#if PG_VERSION_NUM >= 150000
+		(void) shm_mq_send(sess->request, 1, &tag, true, true);
+#else
+		(void) shm_mq_send(sess->request, 1, &tag, true);
+#endif
+	}
+	dsm_detach(sess->seg);
+	pfree(sess);
+}
+
+/*
+ * At transaction abort, drop sessions whose reply was abandoned by an error
+ * and those holding the transaction's inserts.
+ */
+void
+duckdb_host_abort_sessions(void)
+{
+	ListCell   *lc;
+
+	foreach(lc, host_sessions)
+	{
+		DuckDBHostSession *sess = (DuckDBHostSession *) lfirst(lc);
+
+		if (sess->busy || sess->in_xact)
+		{
+			duckdb_host_cancel_session(sess);
+			host_sessions = foreach_delete_current(host_sessions, lc);
+		}
+	}
+}
+
+/*
+ * At subtransaction abort, drop sessions whose reply was abandoned and those
+ * holding inserts of the aborted subtransaction; DuckDB has no savepoints,
+ * so those can only go with the whole host transaction.  Sessions whose
+ * inserts all predate the subtransaction keep them.  Returns true if some
+ * dropped transaction also held such earlier inserts, which the commit would
+ * then silently lose.
+ */
+bool
+duckdb_host_abort_subxact(SubTransactionId mySubid)
+{
+	ListCell   *lc;
+	bool		lost = false;
+
+	foreach(lc, host_sessions)
+	{
+		DuckDBHostSession *sess = (DuckDBHostSession *) lfirst(lc);
+
+		if (sess->busy || (sess->in_xact && sess->insert_subid >= mySubid))
+		{
+			if (sess->in_xact && sess->xact_subid < mySubid)
+				lost = true;
+			duckdb_host_cancel_session(sess);
+			host_sessions = foreach_delete_current(host_sessions, lc);
+		}
+	}
+	return lost;
+}
+
+/* ---------------------------------------------------------------------
+ * Host side
+ * ---------------------------------------------------------------------
+ */
+
+static void
+host_shmem_exit(int code, Datum arg)
+{
+	SpinLockAcquire(&host->mutex);
+	host->host_pid = 0;
+	host->host_latch = NULL;
+	SpinLockRelease(&host->mutex);
+}
+
+static bool
+host_reply(HostSession *s, StringInfo buf)
+{
+	return host_mq_send(s->response, buf, false) == SHM_MQ_SUCCESS;
+}
+
+static bool
+host_reply_error(HostSession *s, const char *message)
+{
+	StringInfoData buf;
+	bool		ok;
+
+	initStringInfo(&buf);
+	pq_sendbyte(&buf, HOST_MSG_ERROR);
+	host_put_text(&buf, message ? message : "unknown error");
+	ok = host_reply(s, &buf);
+	pfree(buf.data);
+	return ok;
+}
+
+static bool
+host_reply_tag(HostSession *s, char tag)
+{
+	StringInfoData buf;
+	bool		ok;
+
+	initStringInfo(&buf);
+	pq_sendbyte(&buf, tag);
+	ok = host_reply(s, &buf);
+	pfree(buf.data);
+	return ok;
+}
+
+#define HOST_SECRET_PREFIX	"CREATE OR REPLACE SECRET "
+#define HOST_DROP_SECRETS	"DROP SECRET IF EXISTS pg_duck_s3; DROP SECRET IF EXISTS pg_duck_md;"
+
+static bool
+host_is_secret_command(const char *cmd)
+{
+	return strncmp(cmd, HOST_SECRET_PREFIX, strlen(HOST_SECRET_PREFIX)) == 0;
+}
+
+static bool
+host_string_lists_equal(List *a, List *b)
+{
+	ListCell   *la;
+	ListCell   *lb;
+
+	if (list_length(a) != list_length(b))
+		return false;
+	forboth(la, a, lb, b)
+	{
+		if (strcmp((char *) lfirst(la), (char *) lfirst(lb)) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool
+host_has_catalogs(List *setup)
+{
+	ListCell   *lc;
+
+	foreach(lc, setup)
+	{
+		if (pg_strncasecmp((char *) lfirst(lc), "ATTACH ", 7) == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Find the database open on path, opening it with the session's settings and
+ * setup commands if it is not open yet.  settings holds "name=value" strings
+ * and shared_setup the setup commands other than secrets; a database that is
+ * already open must have been opened with the same ones.  A database with
+ * attached catalogs is only shared by sessions with the secrets that
+ * attached them; other sessions get their own in-memory database.  Returns
+ * an error message on failure.
+ */
+static char *
+host_open_database(const char *path, List *settings, List *setup,
+				   List *shared_setup, List *secrets, HostDatabase **result)
+{
+	HostDatabase *hdb;
+	duckdb_config config;
+	duckdb_database db;
+	duckdb_connection conn;
+	char	   *open_err = NULL;
+	MemoryContext oldcxt;
+	ListCell   *lc;
+	bool		has_catalogs = host_has_catalogs(shared_setup);
+
+	foreach(lc, host_databases)
+	{
+		hdb = (HostDatabase *) lfirst(lc);
+		if (strcmp(hdb->path, path) == 0)
+		{
+			if (has_catalogs && !host_string_lists_equal(hdb->catalog_secrets, secrets))
+			{
+				if (path[0] == '\0')
+					continue;
+				return psprintf("database \"%s\" is already open in the host with catalogs attached by another user",
+								path);
+			}
+			if (!host_string_lists_equal(hdb->settings, settings) ||
+				!host_string_lists_equal(hdb->setup, shared_setup))
+				return psprintf("database \"%s\" is already open in the host with different settings, extensions or catalogs",
+								path[0] ? path : ":memory:");
+			*result = hdb;
+			return NULL;
+		}
+	}
+
+	if (duckdb_create_config(&config) == DuckDBError)
+		return pstrdup("failed to create DuckDB config");
+	foreach(lc, settings)
+	{
+		char	   *name = pstrdup((char *) lfirst(lc));
+		char	   *value = strchr(name, '=');
+
+		*value++ = '\0';
+		if (duckdb_set_config(config, name, value) == DuckDBError)
+		{
+			duckdb_destroy_config(&config);
+			return psprintf("invalid DuckDB setting \"%s\" = \"%s\"", name, value);
+		}
+	}
+
+	if (duckdb_open_ext(path[0] ? path : NULL, &db, config, &open_err) == DuckDBError)
+	{
+		char	   *msg = psprintf("failed to open DuckDB: %s",
+								   open_err ? open_err : "unknown error");
+
+		if (open_err)
+			duckdb_free(open_err);
+		duckdb_destroy_config(&config);
+		return msg;
+	}
+	duckdb_destroy_config(&config);
+
+	if (duckdb_connect(db, &conn) == DuckDBError)
+	{
+		duckdb_close(&db);
+		return pstrdup("failed to connect to DuckDB");
+	}
+
+	/*
+	 * Catalogs may need the opener's secrets to attach, so run the setup in
+	 * its original order and drop the secrets afterwards.
+	 */
+	setup = lappend(list_copy(setup), HOST_DROP_SECRETS);
+	foreach(lc, setup)
+	{
+		duckdb_result res;
+
+		if (duckdb_query(conn, duckdb_setup_command_sql(conn, (char *) lfirst(lc)), &res) == DuckDBError)
+		{
+			char	   *msg = pstrdup(duckdb_result_error(&res));
+
+			duckdb_destroy_result(&res);
+			duckdb_disconnect(&conn);
+			duckdb_close(&db);
+			return msg;
+		}
+		duckdb_destroy_result(&res);
+	}
+	duckdb_disconnect(&conn);
+
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	hdb = palloc0(sizeof(HostDatabase));
+	hdb->path = pstrdup(path);
+	hdb->db = db;
+	foreach(lc, settings)
+		hdb->settings = lappend(hdb->settings, pstrdup((char *) lfirst(lc)));
+	foreach(lc, shared_setup)
+		hdb->setup = lappend(hdb->setup, pstrdup((char *) lfirst(lc)));
+	if (has_catalogs)
+	{
+		foreach(lc, secrets)
+			hdb->catalog_secrets = lappend(hdb->catalog_secrets, pstrdup((char *) lfirst(lc)));
+	}
+	host_databases = lappend(host_databases, hdb);
+	MemoryContextSwitchTo(oldcxt);
+
+	*result = hdb;
+	return NULL;
+}
+
+static bool
+host_handle_open(HostSession *s, StringInfo msg)
+{
+	char	   *path = host_get_text(msg);
+	List	   *settings = NIL;
+	List	   *setup = NIL;
+	List	   *shared_setup = NIL;
+	List	   *secrets = NIL;
+	HostDatabase *hdb;
+	MemoryContext oldcxt;
+	ListCell   *lc;
+	char	   *err;
+	int			n;
+	int			i;
+
+	n = (int) pq_getmsgint(msg, 4);
+	for (i = 0; i < n; i++)
+	{
+		char	   *name = host_get_text(msg);
+
+		settings = lappend(settings, psprintf("%s=%s", name, host_get_text(msg)));
+	}
+	n = (int) pq_getmsgint(msg, 4);
+	for (i = 0; i < n; i++)
+	{
+		char	   *cmd = host_get_text(msg);
+
+		setup = lappend(setup, cmd);
+		if (host_is_secret_command(cmd))
+			secrets = lappend(secrets, cmd);
+		else
+			shared_setup = lappend(shared_setup, cmd);
+	}
+
+	if (s->conn != NULL)
+		return host_reply_error(s, "session is already open");
+
+	err = host_open_database(path ? path : "", settings, setup, shared_setup, secrets, &hdb);
+	if (err != NULL)
+		return host_reply_error(s, err);
+	if (duckdb_connect(hdb->db, &s->conn) == DuckDBError)
+	{
+		s->conn = NULL;
+		return host_reply_error(s, "failed to connect to DuckDB");
+	}
+
+	s->hdb = hdb;
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	foreach(lc, secrets)
+		s->secrets = lappend(s->secrets, pstrdup((char *) lfirst(lc)));
+	MemoryContextSwitchTo(oldcxt);
+
+	return host_reply_tag(s, HOST_MSG_OK);
+}
+
+/*
+ * Make the session's secrets the ones installed in its database, dropping
+ * those of whichever session ran there last.  Returns an error message on
+ * failure.
+ */
+static char *
+host_install_secrets(HostSession *s)
+{
+	HostDatabase *hdb = s->hdb;
+	duckdb_result res;
+	ListCell   *lc;
+
+	if (hdb->secrets_owner == s)
+		return NULL;
+
+	if (hdb->secrets_owner != NULL)
+	{
+		if (duckdb_query(s->conn, HOST_DROP_SECRETS, &res) == DuckDBError)
+		{
+			char	   *msg = pstrdup(duckdb_result_error(&res));
+
+			duckdb_destroy_result(&res);
+			return msg;
+		}
+		duckdb_destroy_result(&res);
+		hdb->secrets_owner = NULL;
+	}
+
+	foreach(lc, s->secrets)
+	{
+		if (duckdb_query(s->conn, (char *) lfirst(lc), &res) == DuckDBError)
+		{
+			char	   *msg = pstrdup(duckdb_result_error(&res));
+
+			duckdb_destroy_result(&res);
+			(void) duckdb_query(s->conn, HOST_DROP_SECRETS, NULL);
+			return msg;
+		}
+		duckdb_destroy_result(&res);
+	}
+	hdb->secrets_owner = s;
+	return NULL;
+}
+
+/*
+ * Stream a materialized result to the backend, DUCKDB_HOST_ROWS_PER_MSG rows
+ * per message.
+ */
+static bool
+host_send_result(HostSession *s, duckdb_result *res)
+{
+	idx_t		ncols = duckdb_column_count(res);
+	idx_t		nrows = duckdb_row_count(res);
+	idx_t		row = 0;
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+	pq_sendbyte(&buf, HOST_MSG_ROWDESC);
+	pq_sendint32(&buf, (int32) ncols);
+	if (!host_reply(s, &buf))
+		return false;
+
+	while (row < nrows)
+	{
+		idx_t		batch = Min(nrows - row, DUCKDB_HOST_ROWS_PER_MSG);
+		idx_t		r;
+
+		resetStringInfo(&buf);
+		pq_sendbyte(&buf, HOST_MSG_DATA);
+		pq_sendint32(&buf, (int32) batch);
+		for (r = row; r < row + batch; r++)
+		{
+			idx_t		col;
+
+			for (col = 0; col < ncols; col++)
+			{
+				char	   *value = NULL;
+
+				if (!duckdb_value_is_null(res, col, r))
+					value = duckdb_value_varchar(res, col, r);
+				host_put_text(&buf, value);
+				if (value)
+					duckdb_free(value);
+			}
+		}
+		if (!host_reply(s, &buf))
+			return false;
+		row += batch;
+	}
+	pfree(buf.data);
+
+	return host_reply_tag(s, HOST_MSG_COMPLETE);
+}
+
+/*
+ * Whether the running request should stop: the backend sent
+ * HOST_MSG_CANCEL or detached from the session, or the host is shutting
+ * down.  Nothing else arrives while a request runs, since the backend waits
+ * for its reply.
+ */
+static bool
+host_cancel_requested(HostSession *s)
+{
+	Size		nbytes;
+	void	   *data;
+
+	if (ShutdownRequestPending)
+		return true;
+	if (shm_mq_receive(s->request, &nbytes, &data, true) == SHM_MQ_WOULD_BLOCK)
+		return false;
+	s->cancelled = true;
+	return true;
+}
+
+/*
+ * Execute a prepared statement through DuckDB's pending-result API, checking
+ * for a cancel between tasks and interrupting the query on one, like
+ * duckdb_run_pending does for backends.  Returns an error message on
+ * failure.
+ */
+static char *
+host_run_pending(HostSession *s, duckdb_prepared_statement stmt, duckdb_result *res)
+{
+	duckdb_pending_result pending;
+	duckdb_pending_state state;
+	bool		interrupted = false;
+	char	   *err = NULL;
+
+	if (duckdb_pending_prepared(stmt, &pending) == DuckDBError)
+	{
+		err = pstrdup(duckdb_pending_error(pending) ? duckdb_pending_error(pending) : "unknown error");
+		duckdb_destroy_pending(&pending);
+		return err;
+	}
+
+	for (;;)
+	{
+		state = duckdb_pending_execute_task(pending);
+		if (state == DUCKDB_PENDING_RESULT_READY || state == DUCKDB_PENDING_ERROR)
+			break;
+		if (!interrupted && host_cancel_requested(s))
+		{
+			duckdb_interrupt(s->conn);
+			interrupted = true;
+		}
+		if (state == DUCKDB_PENDING_NO_TASKS_AVAILABLE)
+		{
+			/* DuckDB's own threads hold the remaining work; wait briefly */
+			(void) WaitLatch(MyLatch,
+							 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+							 1L,
+							 PG_WAIT_EXTENSION);
+			ResetLatch(MyLatch);
+		}
+	}
+
+	if (state == DUCKDB_PENDING_ERROR)
+		err = pstrdup(duckdb_pending_error(pending) ? duckdb_pending_error(pending) : "unknown error");
+	else if (duckdb_execute_pending(pending, res) == DuckDBError)
+	{
+		err = pstrdup(duckdb_result_error(res) ? duckdb_result_error(res) : "unknown error");
+		duckdb_destroy_result(res);
+	}
+	duckdb_destroy_pending(&pending);
+	return err;
+}
+
+/*
+ * Run sql, one or more ';'-separated statements, binding the request's text
+ * parameters to a single statement.  *res receives the last statement's
+ * result.  Returns an error message on failure.
+ */
+static char *
+host_run_sql(HostSession *s, const char *sql, int nparams, StringInfo msg,
+			 duckdb_result *res)
+{
+	duckdb_extracted_statements extracted;
+	idx_t		n;
+	idx_t		i;
+	char	   *err = NULL;
+
+	n = duckdb_extract_statements(s->conn, sql, &extracted);
+	if (n == 0)
+	{
+		const char *msg_err = duckdb_extract_statements_error(extracted);
+
+		err = pstrdup(msg_err ? msg_err : "no statement to run");
+		duckdb_destroy_extracted(&extracted);
+		return err;
+	}
+	if (nparams > 0 && n > 1)
+	{
+		duckdb_destroy_extracted(&extracted);
+		return pstrdup("cannot bind parameters to more than one statement");
+	}
+
+	for (i = 0; i < n && err == NULL; i++)
+	{
+		duckdb_prepared_statement stmt;
+		int			p;
+
+		if (duckdb_prepare_extracted_statement(s->conn, extracted, i, &stmt) == DuckDBError)
+		{
+			err = pstrdup(duckdb_prepare_error(stmt) ? duckdb_prepare_error(stmt) : "prepare error");
+			duckdb_destroy_prepare(&stmt);
+			break;
+		}
+		for (p = 1; p <= nparams; p++)
+		{
+			char	   *value = host_get_text(msg);
+
+			if (value == NULL)
+				duckdb_bind_null(stmt, p);
+			else
+				duckdb_bind_varchar(stmt, p, value);
+		}
+		/* Only the last statement's result is kept */
+		if (i > 0)
+			duckdb_destroy_result(res);
+		err = host_run_pending(s, stmt, res);
+		duckdb_destroy_prepare(&stmt);
+	}
+	duckdb_destroy_extracted(&extracted);
+	return err;
+}
+
+static bool
+host_handle_query(HostSession *s, StringInfo msg, bool want_result)
+{
+	char	   *sql = host_get_text(msg);
+	int			nparams = want_result ? (int) pq_getmsgint(msg, 4) : 0;
+	duckdb_result res;
+	char	   *err;
+	bool		ok;
+
+	if (s->conn == NULL)
+		return host_reply_error(s, "session is not open");
+	if ((err = host_install_secrets(s)) != NULL)
+		return host_reply_error(s, err);
+
+	if ((err = host_run_sql(s, sql, nparams, msg, &res)) != NULL)
+		return !s->cancelled && host_reply_error(s, err);
+	if (s->cancelled)
+	{
+		duckdb_destroy_result(&res);
+		return false;
+	}
+
+	ok = want_result ? host_send_result(s, &res) : host_reply_tag(s, HOST_MSG_COMPLETE);
+	duckdb_destroy_result(&res);
+	return ok;
+}
+
+/*
+ * Handle one request.  Returns false once the backend has gone away.
+ */
+static bool
+host_handle_message(HostSession *s, void *data, Size nbytes)
+{
+	StringInfoData msg;
+
+	msg.data = (char *) data;
+	msg.len = (int) nbytes;
+	msg.maxlen = (int) nbytes;
+	msg.cursor = 0;
+
+	switch (pq_getmsgbyte(&msg))
+	{
+		case HOST_MSG_OPEN:
+			return host_handle_open(s, &msg);
+		case HOST_MSG_QUERY:
+			return host_handle_query(s, &msg, true);
+		case HOST_MSG_EXEC:
+			return host_handle_query(s, &msg, false);
+		case HOST_MSG_CANCEL:
+			/* Arrived after its request finished; the backend is gone */
+			return false;
+		default:
+			return host_reply_error(s, "unrecognized request");
+	}
+}
+
+static void
+host_close_session(HostSession *s)
+{
+	if (s->hdb != NULL && s->hdb->secrets_owner == s)
+	{
+		(void) duckdb_query(s->conn, HOST_DROP_SECRETS, NULL);
+		s->hdb->secrets_owner = NULL;
+	}
+	if (s->conn)
+		duckdb_disconnect(&s->conn);
+	list_free_deep(s->secrets);
+	dsm_detach(s->seg);
+	pfree(s);
+}
+
+/*
+ * Attach to the sessions backends have published since the last pass.
+ */
+static List *
+host_accept_sessions(List *sessions)
+{
+	dsm_handle	handles[DUCKDB_HOST_MAX_PENDING];
+	int			n;
+	int			i;
+
+	SpinLockAcquire(&host->mutex);
+	n = host->npending;
+	memcpy(handles, host->pending, n * sizeof(dsm_handle));
+	host->npending = 0;
+	SpinLockRelease(&host->mutex);
+
+	for (i = 0; i < n; i++)
+	{
+		dsm_segment *seg = dsm_attach(handles[i]);
+		shm_toc    *toc;
+		shm_mq	   *mq;
+		HostSession *s;
+
+		/* The backend may already have given up on this session */
+		if (seg == NULL)
+			continue;
+		dsm_pin_mapping(seg);
+		toc = shm_toc_attach(DUCKDB_HOST_MAGIC, dsm_segment_address(seg));
+		if (toc == NULL)
+		{
+			dsm_detach(seg);
+			continue;
+		}
+
+		s = MemoryContextAllocZero(TopMemoryContext, sizeof(HostSession));
+		s->seg = seg;
+
+		mq = shm_toc_lookup(toc, 0, false);
+		shm_mq_set_receiver(mq, MyProc);
+		s->request = shm_mq_attach(mq, seg, NULL);
+
+		mq = shm_toc_lookup(toc, 1, false);
+		shm_mq_set_sender(mq, MyProc);
+		s->response = shm_mq_attach(mq, seg, NULL);
+
+		sessions = lappend(sessions, s);
+	}
+	return sessions;
+}
+
+void
+duckdb_host_main(Datum main_arg)
+{
+	MemoryContext msg_context;
+	List	   *sessions = NIL;
+
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+	BackgroundWorkerUnblockSignals();
+
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "duckdb_fdw host");
+	msg_context = AllocSetContextCreate(TopMemoryContext,
+										"duckdb_fdw host message",
+										ALLOCSET_DEFAULT_SIZES);
+
+	on_shmem_exit(host_shmem_exit, (Datum) 0);
+	SpinLockAcquire(&host->mutex);
+	host->host_pid = MyProcPid;
+	host->host_latch = MyLatch;
+	SpinLockRelease(&host->mutex);
+
+	while (!ShutdownRequestPending)
+	{
+		bool		did_work = false;
+		ListCell   *lc;
+
+		MemoryContextSwitchTo(TopMemoryContext);
+		sessions = host_accept_sessions(sessions);
+
+		foreach(lc, sessions)
+		{
+			HostSession *s = (HostSession *) lfirst(lc);
+			Size		nbytes;
+			void	   *data;
+			shm_mq_result res;
+			volatile bool alive;
+
+			res = shm_mq_receive(s->request, &nbytes, &data, true);
+			if (res == SHM_MQ_WOULD_BLOCK)
+				continue;
+
+			did_work = true;
+			alive = false;
+			if (res == SHM_MQ_SUCCESS)
+			{
+				MemoryContextSwitchTo(msg_context);
+				PG_TRY();
+				{
+					alive = host_handle_message(s, data, nbytes);
+				}
+				PG_CATCH();
+				{
+					ErrorData  *edata;
+
+					/*
+					 * Fail the request instead of the worker, which would
+					 * take every other session's database down with it.
+					 */
+					MemoryContextSwitchTo(msg_context);
+					edata = CopyErrorData();
+					FlushErrorState();
+					alive = host_reply_error(s, edata->message);
+				}
+				PG_END_TRY();
+				MemoryContextSwitchTo(TopMemoryContext);
+				MemoryContextReset(msg_context);
+			}
+			if (!alive)
+			{
+				host_close_session(s);
+				sessions = foreach_delete_current(sessions, lc);
+			}
+		}
+
+		if (!did_work)
+		{
+			(void) WaitLatch(MyLatch,
+							 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+							 1000L,
+							 PG_WAIT_EXTENSION);
+			ResetLatch(MyLatch);
+		}
+		CHECK_FOR_INTERRUPTS();
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+	}
+
+	proc_exit(0);
+}
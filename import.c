@@ -1,4 +1,7 @@
 #include "postgres.h"
+
+#include <ctype.h>
+
 #include "duckdb_fdw.h"
 #include "duckdb.h"
 
@@ -61,38 +64,305 @@ duckdb_map_type_name(const char *duck_type)
     return "text";
 }
 
+/*
+ * Append the DuckDB side of IMPORT FOREIGN SCHEMA's LIMIT TO / EXCEPT
+ * clause, so excluded tables are never read from the catalog.
+ */
+static void
+duckdb_append_import_filter(StringInfo query, ImportForeignSchemaStmt *stmt)
+{
+    ListCell   *lc;
+    bool        first = true;
+
+    if (stmt->list_type == FDW_IMPORT_SCHEMA_ALL)
+        return;
+
+    appendStringInfo(query, " AND table_name %sIN (",
+                     stmt->list_type == FDW_IMPORT_SCHEMA_EXCEPT ? "NOT " : "");
+    foreach(lc, stmt->table_list)
+    {
+        RangeVar   *rv = (RangeVar *) lfirst(lc);
+        char       *lit = duckdb_fdw_quote_literal(rv->relname);
+
+        if (!first)
+            appendStringInfoString(query, ", ");
+        appendStringInfoString(query, lit);
+        first = false;
+        pfree(lit);
+    }
+    appendStringInfoChar(query, ')');
+}
+
+/*
+ * Name of a foreign partition: the parent's name followed by the partition
+ * value with everything but letters and digits replaced, kept unique among
+ * the names already in *used and short enough not to be truncated.
+ */
+static char *
+duckdb_hive_partition_name(const char *parent, const char *value, List **used)
+{
+    StringInfoData name;
+    char       *candidate;
+    int         maxlen = NAMEDATALEN - 1 - 8;   /* room for a "_NNNNNNN" suffix */
+    int         suffix = 1;
+    const char *p;
+
+    initStringInfo(&name);
+    appendStringInfo(&name, "%s_", parent);
+    for (p = value ? value : "null"; *p && name.len < maxlen; p++)
+        appendStringInfoChar(&name, isalnum((unsigned char) *p) ? *p : '_');
+
+    candidate = pstrdup(name.data);
+    for (;;)
+    {
+        ListCell   *lc;
+        bool        taken = false;
+
+        foreach(lc, *used)
+        {
+            if (strcmp((char *) lfirst(lc), candidate) == 0)
+            {
+                taken = true;
+                break;
+            }
+        }
+        if (!taken)
+            break;
+        pfree(candidate);
+        candidate = psprintf("%s_%d", name.data, ++suffix);
+    }
+    *used = lappend(*used, candidate);
+    pfree(name.data);
+    return candidate;
+}
+
+/*
+ * IMPORT FOREIGN SCHEMA "<dir>" ... OPTIONS (hive_partitioning 'true'):
+ * import a hive-partitioned Parquet directory (<dir>/key=value/...) as a
+ * partitioned table with one foreign partition per value of the top-level
+ * key, so partition pruning skips whole prefixes at plan time.  Deeper keys
+ * stay ordinary columns of every partition.  The partitioned parent is not
+ * a foreign table, which IMPORT FOREIGN SCHEMA cannot return, so the tables
+ * are created here.
+ */
+static void
+duckdb_import_hive_partitioned(ImportForeignSchemaStmt *stmt, ForeignServer *server,
+                               duckdb_connection conn, const char *table_name)
+{
+    char       *base = pstrdup(stmt->remote_schema);
+    char       *parent;
+    char       *glob_lit;
+    char       *key = NULL;
+    char       *key_type = NULL;
+    char       *errmsg;
+    List       *used_names = NIL;
+    List       *segments = NIL;
+    ListCell   *lc;
+    StringInfoData sql;
+    StringInfoData ddl;
+    duckdb_result res;
+    size_t      len = strlen(base);
+
+    if (stmt->list_type != FDW_IMPORT_SCHEMA_ALL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("duckdb_fdw: LIMIT TO and EXCEPT cannot be combined with hive_partitioning")));
+    if (strchr(base, '*') != NULL || strstr(base, ".parquet") != NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                 errmsg("duckdb_fdw: hive_partitioning expects a directory, not \"%s\"", base)));
+
+    while (len > 0 && base[len - 1] == '/')
+        base[--len] = '\0';
+    if (table_name == NULL)
+    {
+        char       *slash = strrchr(base, '/');
+
+        table_name = slash ? slash + 1 : base;
+    }
+    parent = pstrdup(table_name);
+
+    /* Top-level key=value directories, from the file listing alone */
+    glob_lit = duckdb_fdw_quote_literal(psprintf("%s/**/*.parquet", base));
+    initStringInfo(&sql);
+    appendStringInfo(&sql,
+                     "SELECT DISTINCT split_part(file[%d:], '/', 1) AS segment "
+                     "FROM glob(%s) ORDER BY segment",
+                     (int) len + 2, glob_lit);
+    if (!duckdb_run_query(conn, sql.data, &res, &errmsg))
+        elog(ERROR, "DuckDB: %s", errmsg);
+    for (idx_t i = 0; i < duckdb_row_count(&res); i++)
+    {
+        char       *segment = duckdb_value_varchar(&res, 0, i);
+        char       *eq = strchr(segment, '=');
+
+        if (eq == NULL || strchr(segment, '/') != NULL || strstr(segment, ".parquet") != NULL)
+        {
+            char       *msg = pstrdup(segment);
+
+            duckdb_free(segment);
+            duckdb_destroy_result(&res);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("duckdb_fdw: \"%s/%s\" is not a hive partition directory", base, msg),
+                     errhint("Every Parquet file must be below a key=value directory.")));
+        }
+        if (key == NULL)
+            key = pnstrdup(segment, eq - segment);
+        else if (strncmp(key, segment, eq - segment) != 0 || key[eq - segment] != '\0')
+        {
+            char       *msg = pstrdup(segment);
+
+            duckdb_free(segment);
+            duckdb_destroy_result(&res);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("duckdb_fdw: partition directory \"%s\" does not use key \"%s\"", msg, key)));
+        }
+        segments = lappend(segments, pstrdup(segment));
+        duckdb_free(segment);
+    }
+    duckdb_destroy_result(&res);
+
+    if (segments == NIL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("duckdb_fdw: no Parquet files found below \"%s\"", base)));
+
+    /* Columns, including the partition keys, of the whole dataset */
+    resetStringInfo(&sql);
+    appendStringInfo(&sql, "DESCRIBE SELECT * FROM read_parquet(%s, hive_partitioning = true)",
+                     glob_lit);
+    if (!duckdb_run_query(conn, sql.data, &res, &errmsg))
+        elog(ERROR, "DuckDB: %s", errmsg);
+
+    initStringInfo(&ddl);
+    appendStringInfo(&ddl, "CREATE TABLE %s.%s (",
+                     quote_identifier(stmt->local_schema), quote_identifier(parent));
+    for (idx_t i = 0; i < duckdb_row_count(&res); i++)
+    {
+        char       *cname = duckdb_value_varchar(&res, 0, i);
+        char       *ctype = duckdb_value_varchar(&res, 1, i);
+        char       *pgtype = duckdb_map_type_name(ctype);
+
+        if (strcmp(cname, key) == 0)
+            key_type = pstrdup(pgtype);
+        appendStringInfo(&ddl, "%s%s %s", i > 0 ? ", " : "", quote_identifier(cname), pgtype);
+        duckdb_free(cname);
+        duckdb_free(ctype);
+    }
+    duckdb_destroy_result(&res);
+    if (key_type == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("duckdb_fdw: partition key \"%s\" not found in \"%s\"", key, base)));
+    appendStringInfo(&ddl, ") PARTITION BY LIST (%s)", quote_identifier(key));
+
+    if (SPI_connect() != SPI_OK_CONNECT)
+        elog(ERROR, "SPI_connect failed");
+    if (SPI_execute(ddl.data, false, 0) != SPI_OK_UTILITY)
+        elog(ERROR, "Failed to create partitioned table: %s", ddl.data);
+
+    used_names = lappend(used_names, parent);
+    foreach(lc, segments)
+    {
+        char       *segment = (char *) lfirst(lc);
+        char       *value = strchr(segment, '=') + 1;
+        bool        is_default = strcmp(value, "__HIVE_DEFAULT_PARTITION__") == 0;
+        char       *partname = duckdb_hive_partition_name(parent, is_default ? NULL : value,
+                                                          &used_names);
+        char       *path = psprintf("%s/%s/**/*.parquet", base, segment);
+
+        resetStringInfo(&ddl);
+        appendStringInfo(&ddl,
+                         "CREATE FOREIGN TABLE %s.%s PARTITION OF %s.%s FOR VALUES IN (%s) "
+                         "SERVER %s OPTIONS (table %s)",
+                         quote_identifier(stmt->local_schema), quote_identifier(partname),
+                         quote_identifier(stmt->local_schema), quote_identifier(parent),
+                         is_default ? "NULL" : quote_literal_cstr(value),
+                         quote_identifier(server->servername), quote_literal_cstr(path));
+        if (SPI_execute(ddl.data, false, 0) != SPI_OK_UTILITY)
+            elog(ERROR, "Failed to create foreign partition: %s", ddl.data);
+        pfree(path);
+    }
+    SPI_finish();
+
+    pfree(sql.data);
+    pfree(ddl.data);
+}
+
+/*
+ * Build the CREATE FOREIGN TABLE commands for IMPORT FOREIGN SCHEMA.  The
+ * commands are returned to PostgreSQL, which creates the tables itself; the
+ * local schema is filled in by the caller.
+ */
 List *
 duckdb_import_foreign_schema(ImportForeignSchemaStmt *stmt, Oid serverOid)
 {
     ForeignServer *server = GetForeignServer(serverOid);
-    duckdb_connection conn = duckdb_get_connection(server, false);
+    duckdb_connection conn;
     duckdb_result res;
     StringInfoData query;
+    List *commands = NIL;
     bool is_file = false;
-    bool is_quack = false;
+    bool hive_partitioning = false;
+    const char *hive_table_name = NULL;
     const char *quack_prefix = "";
+    char *errmsg;
+    ListCell *lc;
+
+    if (duckdb_server_uses_host(server))
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("duckdb_fdw: IMPORT FOREIGN SCHEMA is not supported on servers with shared_host")));
+    conn = duckdb_get_connection(server, false);
 
     /* Detect Quack proxy mode: if server has quack_host, tables live in
      * the ATTACHed 'remote' database and catalog queries need the prefix. */
     {
-        ListCell *lc;
         foreach(lc, server->options)
         {
             DefElem *def = (DefElem *) lfirst(lc);
             if (strcmp(def->defname, "quack_host") == 0)
             {
-                is_quack = true;
                 quack_prefix = "remote.";
                 break;
             }
         }
     }
 
+    foreach(lc, stmt->options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
+
+        if (strcmp(def->defname, "hive_partitioning") == 0)
+            hive_partitioning = defGetBoolean(def);
+        else if (strcmp(def->defname, "table_name") == 0)
+            hive_table_name = defGetString(def);
+        else
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                     errmsg("invalid option \"%s\" for IMPORT FOREIGN SCHEMA", def->defname),
+                     errhint("Valid options are \"hive_partitioning\" and \"table_name\".")));
+    }
+
     if (strstr(stmt->remote_schema, ".parquet") || strstr(stmt->remote_schema, "/"))
         is_file = true;
 
-    if (SPI_connect() != SPI_OK_CONNECT)
-        elog(ERROR, "SPI_connect failed");
+    /* A schema that names no configured catalog may live in any of them */
+    if (!is_file && !duckdb_attach_catalogs(server, stmt->remote_schema))
+        (void) duckdb_attach_catalogs(server, NULL);
+
+    if (!duckdb_fdw_is_safe_sql_fragment(stmt->remote_schema))
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                 errmsg("remote schema contains unsafe SQL fragment")));
+
+    if (hive_partitioning)
+    {
+        duckdb_import_hive_partitioned(stmt, server, conn, hive_table_name);
+        return NIL;
+    }
 
     initStringInfo(&query);
 	    if (is_file)
@@ -109,18 +379,13 @@ duckdb_import_foreign_schema(ImportForeignSchemaStmt *stmt, Oid serverOid)
         if (dot) *dot = '\0';
 
 	        initStringInfo(&ddl);
-	        appendStringInfo(&ddl, "CREATE FOREIGN TABLE %s.%s (",
-	                         quote_identifier(stmt->local_schema),
+	        appendStringInfo(&ddl, "CREATE FOREIGN TABLE %s (",
 	                         quote_identifier(tablename));
 
-			if (!duckdb_fdw_is_safe_sql_fragment(stmt->remote_schema))
-				ereport(ERROR,
-						(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-						 errmsg("remote schema contains unsafe SQL fragment")));
 			remote_schema_lit = duckdb_fdw_quote_literal(stmt->remote_schema);
 	        appendStringInfo(&query, "DESCRIBE SELECT * FROM read_parquet(%s)", remote_schema_lit);
-	        if (duckdb_query(conn, query.data, &res) == DuckDBError)
-	            elog(ERROR, "DuckDB: %s", duckdb_result_error(&res));
+	        if (!duckdb_run_query(conn, query.data, &res, &errmsg))
+	            elog(ERROR, "DuckDB: %s", errmsg);
 
         for (idx_t i = 0; i < duckdb_row_count(&res); i++)
         {
@@ -137,87 +402,97 @@ duckdb_import_foreign_schema(ImportForeignSchemaStmt *stmt, Oid serverOid)
 	                         quote_identifier(server->servername), remote_schema_pg_lit);
 			pfree(remote_schema_pg_lit);
 
-	        if (SPI_execute(ddl.data, false, 0) != SPI_OK_UTILITY)
-	            elog(ERROR, "Failed to create foreign table via SPI: %s", ddl.data);
+	        commands = lappend(commands, ddl.data);
     }
     else
     {
         /*
-         * 1. Get list of tables first.
-         * 2. For each table, use DESCRIBE to get accurate column info.
+         * Read every column of every matching table with one catalog query
+         * rather than a DESCRIBE per table, which is a remote round trip
+         * each on httpfs-backed DuckLake and Iceberg catalogs.
          */
-	        duckdb_result tables_res;
-			char *remote_schema_lit;
-			if (!duckdb_fdw_is_safe_sql_fragment(stmt->remote_schema))
-				ereport(ERROR,
-						(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-						 errmsg("remote schema contains unsafe SQL fragment")));
-			remote_schema_lit = duckdb_fdw_quote_literal(stmt->remote_schema);
-	        appendStringInfo(&query,
-	            "SELECT database_name, schema_name, table_name "
-	            "FROM %sduckdb_tables() "
-	            "WHERE database_name = %s OR schema_name = %s",
-	            quack_prefix, remote_schema_lit, remote_schema_lit);
-			pfree(remote_schema_lit);
+        char *remote_schema_lit = duckdb_fdw_quote_literal(stmt->remote_schema);
+        StringInfoData ddl;
+        char *cur_db = NULL;
+        char *cur_schema = NULL;
+        char *cur_table = NULL;
+        idx_t nrows;
+
+        appendStringInfo(&query,
+            "SELECT database_name, schema_name, table_name, column_name, data_type "
+            "FROM %sduckdb_columns() "
+            "WHERE (database_name = %s OR schema_name = %s) "
+            "AND table_oid IN (SELECT table_oid FROM %sduckdb_tables())",
+            quack_prefix, remote_schema_lit, remote_schema_lit, quack_prefix);
+        duckdb_append_import_filter(&query, stmt);
+        appendStringInfoString(&query,
+            " ORDER BY database_name, schema_name, table_name, column_index");
+        pfree(remote_schema_lit);
+
+        if (!duckdb_run_query(conn, query.data, &res, &errmsg))
+            elog(ERROR, "DuckDB: %s", errmsg);
+
+        initStringInfo(&ddl);
+        nrows = duckdb_row_count(&res);
+        for (idx_t i = 0; i <= nrows; i++)
+        {
+            char *dbname = NULL;
+            char *schname = NULL;
+            char *tname = NULL;
+            bool same_table;
 
-        if (duckdb_query(conn, query.data, &tables_res) == DuckDBError)
-            elog(ERROR, "DuckDB: %s", duckdb_result_error(&tables_res));
+            if (i < nrows)
+            {
+                dbname = duckdb_value_varchar(&res, 0, i);
+                schname = duckdb_value_varchar(&res, 1, i);
+                tname = duckdb_value_varchar(&res, 2, i);
+            }
+            same_table = cur_table != NULL && tname != NULL &&
+                strcmp(cur_db, dbname) == 0 &&
+                strcmp(cur_schema, schname) == 0 &&
+                strcmp(cur_table, tname) == 0;
 
-        for (idx_t i = 0; i < duckdb_row_count(&tables_res); i++)
-        {
-            char *dbname = duckdb_value_varchar(&tables_res, 0, i);
-            char *schname = duckdb_value_varchar(&tables_res, 1, i);
-            char *tname = duckdb_value_varchar(&tables_res, 2, i);
-
-            StringInfoData ddl;
-            StringInfoData desc_query;
-            duckdb_result col_res;
-
-            initStringInfo(&ddl);
-            initStringInfo(&desc_query);
-
-            appendStringInfo(&ddl, "CREATE FOREIGN TABLE %s.%s (",
-                             quote_identifier(stmt->local_schema), quote_identifier(tname));
-
-            appendStringInfo(&desc_query, "DESCRIBE SELECT * FROM %s%s.%s.%s",
-                             quack_prefix,
-                             quote_identifier(dbname), quote_identifier(schname), quote_identifier(tname));
-
-	            if (duckdb_query(conn, desc_query.data, &col_res) != DuckDBError)
-	            {
-					char *remote_table_pg_lit;
-					char *remote_table_name;
-	                bool first_col = true;
-                for (idx_t j = 0; j < duckdb_row_count(&col_res); j++)
-                {
-                    char *cname = duckdb_value_varchar(&col_res, 0, j);
-                    char *ctype = duckdb_value_varchar(&col_res, 1, j);
-
-                    if (!first_col) appendStringInfoString(&ddl, ", ");
-                    appendStringInfo(&ddl, "%s %s", quote_identifier(cname), duckdb_map_type_name(ctype));
-                    first_col = false;
-
-                    duckdb_free(cname); duckdb_free(ctype);
-                }
-						remote_table_name = psprintf("%s.%s.%s", dbname, schname, tname);
-						remote_table_pg_lit = quote_literal_cstr(remote_table_name);
-						pfree(remote_table_name);
-		                appendStringInfo(&ddl, ") SERVER %s OPTIONS (table %s)",
-		                                 quote_identifier(server->servername), remote_table_pg_lit);
-						pfree(remote_table_pg_lit);
-
-                if (SPI_execute(ddl.data, false, 0) != SPI_OK_UTILITY)
-                    elog(ERROR, "Failed to create foreign table: %s", ddl.data);
-
-                duckdb_destroy_result(&col_res);
+            /* Finish the previous table's command when a new table starts */
+            if (cur_table != NULL && !same_table)
+            {
+                char *remote_table_name = psprintf("%s.%s.%s", cur_db, cur_schema, cur_table);
+                char *remote_table_pg_lit = quote_literal_cstr(remote_table_name);
+
+                appendStringInfo(&ddl, ") SERVER %s OPTIONS (table %s)",
+                                 quote_identifier(server->servername), remote_table_pg_lit);
+                commands = lappend(commands, pstrdup(ddl.data));
+                pfree(remote_table_name);
+                pfree(remote_table_pg_lit);
+                pfree(cur_db); pfree(cur_schema); pfree(cur_table);
+                cur_db = cur_schema = cur_table = NULL;
+            }
+            if (i == nrows)
+                break;
+
+            if (!same_table)
+            {
+                resetStringInfo(&ddl);
+                appendStringInfo(&ddl, "CREATE FOREIGN TABLE %s (", quote_identifier(tname));
+                cur_db = pstrdup(dbname);
+                cur_schema = pstrdup(schname);
+                cur_table = pstrdup(tname);
             }
+            else
+                appendStringInfoString(&ddl, ", ");
 
+            {
+                char *cname = duckdb_value_varchar(&res, 3, i);
+                char *ctype = duckdb_value_varchar(&res, 4, i);
+
+                appendStringInfo(&ddl, "%s %s", quote_identifier(cname), duckdb_map_type_name(ctype));
+                duckdb_free(cname); duckdb_free(ctype);
+            }
             duckdb_free(dbname); duckdb_free(schname); duckdb_free(tname);
-            pfree(ddl.data); pfree(desc_query.data);
         }
-        duckdb_destroy_result(&tables_res);
+        duckdb_destroy_result(&res);
+        pfree(ddl.data);
     }
 
-    SPI_finish();
-    return NIL;
+    pfree(query.data);
+    return commands;
 }
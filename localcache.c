@@ -0,0 +1,436 @@
+/*-------------------------------------------------------------------------
+ *
+ * DuckDB Foreign Data Wrapper for PostgreSQL
+ *
+ * IDENTIFICATION
+ *        localcache.c
+ *
+ * Local copies of slow remote sources.  A foreign table with
+ * cache_mode 'local' can be copied into a table of the server's own DuckDB
+ * database by duckdb_fdw_refresh_cache(); scans then read the copy, as long
+ * as it was made from the current table option and is younger than
+ * cache_max_age.
+ *
+ * Copies live in the duckdb_fdw_cache schema, one table per PostgreSQL
+ * database and foreign table.  duckdb_fdw_cache.sources records what each
+ * was copied from and when; for Parquet sources duckdb_fdw_cache.files
+ * records every file copied with its size and modification time, so a
+ * refresh appends only new files and recopies everything only when a copied
+ * file was rewritten or removed.
+ *
+ * Whether a copy is fresh is decided while planning, so a plan records the
+ * tables whose copies it reads, and a scan swaps any that have expired
+ * since back for their sources before it starts.  Dropping a foreign table
+ * leaves its copy behind.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "duckdb_fdw.h"
+
+#include <ctype.h>
+
+#include "catalog/pg_class.h"
+#include "commands/defrem.h"
+#include "miscadmin.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+
+#define DUCKDB_CACHE_SETUP_SQL \
+	"CREATE SCHEMA IF NOT EXISTS duckdb_fdw_cache; " \
+	"CREATE TABLE IF NOT EXISTS duckdb_fdw_cache.sources (" \
+	"dbid UINTEGER, relid UINTEGER, source VARCHAR, refreshed_at TIMESTAMPTZ, " \
+	"PRIMARY KEY (dbid, relid)); " \
+	"CREATE TABLE IF NOT EXISTS duckdb_fdw_cache.files (" \
+	"dbid UINTEGER, relid UINTEGER, file VARCHAR, last_modified TIMESTAMPTZ, size UBIGINT);"
+
+/*
+ * Parse a cache_max_age value such as '1h' into seconds.
+ */
+bool
+duckdb_local_cache_parse_age(const char *value, int *age_s)
+{
+	const char *hintmsg;
+
+	return parse_int(value, age_s, GUC_UNIT_S, &hintmsg) && *age_s > 0;
+}
+
+/*
+ * True when the foreign table has cache_mode 'local'.  *max_age_s is its
+ * cache_max_age, 0 when the copy never expires.
+ */
+static bool
+duckdb_table_uses_local_cache(ForeignTable *table, int *max_age_s)
+{
+	bool		local = false;
+	ListCell   *lc;
+
+	*max_age_s = 0;
+	foreach(lc, table->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "cache_mode") == 0)
+			local = pg_strcasecmp(defGetString(def), "local") == 0;
+		else if (strcmp(def->defname, "cache_max_age") == 0)
+			(void) duckdb_local_cache_parse_age(defGetString(def), max_age_s);
+	}
+	return local;
+}
+
+static char *
+duckdb_local_cache_name(Oid relid)
+{
+	return psprintf("duckdb_fdw_cache.t_%u_%u", MyDatabaseId, relid);
+}
+
+/*
+ * The local copy to scan instead of the foreign table's source, or NULL when
+ * the table is not cached or its copy is missing, outdated or expired.
+ */
+char *
+duckdb_local_cache_relation(Oid relid)
+{
+	ForeignTable *table = GetForeignTable(relid);
+	ForeignServer *server;
+	duckdb_opt *options;
+	duckdb_connection conn;
+	duckdb_result res;
+	char	   *sql;
+	char	   *errmsg;
+	char	   *cached = NULL;
+	int			max_age;
+
+	if (!duckdb_table_uses_local_cache(table, &max_age))
+		return NULL;
+	server = GetForeignServer(table->serverid);
+	if (duckdb_server_uses_host(server))
+		return NULL;
+
+	options = duckdb_get_options(relid);
+	conn = duckdb_get_connection(server, false);
+	sql = psprintf("SELECT source, epoch(now()) - epoch(refreshed_at) "
+				   "FROM duckdb_fdw_cache.sources WHERE dbid = %u AND relid = %u",
+				   MyDatabaseId, relid);
+
+	/* Fails until the first refresh creates the schema */
+	if (duckdb_run_query(conn, sql, &res, &errmsg))
+	{
+		if (duckdb_row_count(&res) == 1)
+		{
+			char	   *source = duckdb_value_varchar(&res, 0, 0);
+			double		age = duckdb_value_double(&res, 1, 0);
+
+			if (source != NULL && strcmp(source, options->svr_table) == 0 &&
+				(max_age == 0 || age <= max_age))
+				cached = duckdb_local_cache_name(relid);
+			duckdb_free(source);
+		}
+		duckdb_destroy_result(&res);
+	}
+	pfree(sql);
+	pfree(options);
+	return cached;
+}
+
+/*
+ * Find the copy name in sql, skipping longer names it is a prefix of.
+ */
+static const char *
+duckdb_find_cache_name(const char *sql, const char *name)
+{
+	size_t		len = strlen(name);
+	const char *p = sql;
+
+	while ((p = strstr(p, name)) != NULL)
+	{
+		if (!isdigit((unsigned char) p[len]))
+			return p;
+		p += len;
+	}
+	return NULL;
+}
+
+/*
+ * The foreign tables among relids whose local copy sql reads.
+ */
+List *
+duckdb_local_cache_relids(PlannerInfo *root, Relids relids, const char *sql)
+{
+	List	   *result = NIL;
+	int			i = -1;
+
+	if (strstr(sql, "duckdb_fdw_cache.t_") == NULL)
+		return NIL;
+
+	while ((i = bms_next_member(relids, i)) >= 0)
+	{
+		RangeTblEntry *rte = planner_rt_fetch(i, root);
+		char	   *name;
+
+		if (rte->rtekind != RTE_RELATION)
+			continue;
+		name = duckdb_local_cache_name(rte->relid);
+		if (duckdb_find_cache_name(sql, name) != NULL)
+			result = lappend_oid(result, rte->relid);
+		pfree(name);
+	}
+	return result;
+}
+
+/*
+ * The remote SQL of a plan, with the copies of relids that are no longer
+ * fresh replaced by their foreign tables' sources.
+ */
+char *
+duckdb_local_cache_revalidate(const char *sql, List *relids)
+{
+	char	   *result = pstrdup(sql);
+	ListCell   *lc;
+
+	foreach(lc, relids)
+	{
+		Oid			relid = lfirst_oid(lc);
+		char	   *cached = duckdb_local_cache_relation(relid);
+		char	   *name;
+		char	   *source;
+		const char *start;
+		const char *p;
+		StringInfoData buf;
+
+		if (cached != NULL)
+		{
+			pfree(cached);
+			continue;
+		}
+
+		name = duckdb_local_cache_name(relid);
+		source = duckdb_deparse_table_reference(relid);
+		initStringInfo(&buf);
+		start = result;
+		while ((p = duckdb_find_cache_name(start, name)) != NULL)
+		{
+			appendBinaryStringInfo(&buf, start, p - start);
+			appendStringInfoString(&buf, source);
+			start = p + strlen(name);
+		}
+		appendStringInfoString(&buf, start);
+
+		pfree(result);
+		result = buf.data;
+		pfree(source);
+		pfree(name);
+	}
+	return result;
+}
+
+static int64
+duckdb_query_int64(duckdb_connection conn, const char *sql)
+{
+	duckdb_result res;
+	char	   *errmsg;
+	int64		value = 0;
+
+	if (!duckdb_run_query(conn, sql, &res, &errmsg))
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("DuckDB: %s", errmsg)));
+	if (duckdb_row_count(&res) > 0)
+		value = duckdb_value_int64(&res, 0, 0);
+	duckdb_destroy_result(&res);
+	return value;
+}
+
+/*
+ * Copy new files of a Parquet source, or all of them when a copied file
+ * changed.  Runs inside a DuckDB transaction; returns the rows copied.
+ */
+static int64
+duckdb_refresh_parquet_copy(duckdb_connection conn, Oid relid, const char *cache,
+							const char *key, const char *source, bool full)
+{
+	char	   *lit = duckdb_fdw_quote_literal(source);
+	StringInfoData files;
+	duckdb_result res;
+	char	   *sql;
+	char	   *errmsg;
+	idx_t		nfiles;
+	int64		rows;
+
+	/* List the source once; everything below works on this snapshot */
+	sql = psprintf("CREATE OR REPLACE TEMP TABLE duckdb_fdw_listing AS "
+				   "SELECT filename, last_modified, size FROM read_blob(%s)", lit);
+	duckdb_do_sql_command(conn, sql, ERROR);
+	pfree(sql);
+
+	if (!full)
+	{
+		sql = psprintf("SELECT count(*) FROM duckdb_fdw_cache.files f WHERE %s AND NOT EXISTS "
+					   "(SELECT 1 FROM duckdb_fdw_listing l WHERE l.filename = f.file "
+					   "AND l.last_modified = f.last_modified AND l.size = f.size)", key);
+		full = duckdb_query_int64(conn, sql) > 0;
+		pfree(sql);
+	}
+	if (full)
+	{
+		sql = psprintf("DELETE FROM duckdb_fdw_cache.files WHERE %s", key);
+		duckdb_do_sql_command(conn, sql, ERROR);
+		pfree(sql);
+	}
+
+	sql = psprintf("SELECT filename FROM duckdb_fdw_listing l WHERE NOT EXISTS "
+				   "(SELECT 1 FROM duckdb_fdw_cache.files f WHERE %s AND f.file = l.filename) "
+				   "ORDER BY filename", key);
+	if (!duckdb_run_query(conn, sql, &res, &errmsg))
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("DuckDB: %s", errmsg)));
+	pfree(sql);
+
+	nfiles = duckdb_row_count(&res);
+	initStringInfo(&files);
+	appendStringInfoChar(&files, '[');
+	for (idx_t i = 0; i < nfiles; i++)
+	{
+		char	   *file = duckdb_value_varchar(&res, 0, i);
+		char	   *file_lit = duckdb_fdw_quote_literal(file);
+
+		appendStringInfo(&files, "%s%s", i > 0 ? ", " : "", file_lit);
+		pfree(file_lit);
+		duckdb_free(file);
+	}
+	appendStringInfoChar(&files, ']');
+	duckdb_destroy_result(&res);
+
+	if (nfiles == 0 && full)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("duckdb_fdw: no files match \"%s\"", source)));
+
+	if (full)
+	{
+		sql = psprintf("CREATE OR REPLACE TABLE %s AS SELECT * FROM read_parquet(%s)",
+					   cache, files.data);
+		duckdb_do_sql_command(conn, sql, ERROR);
+		pfree(sql);
+		sql = psprintf("SELECT count(*) FROM %s", cache);
+		rows = duckdb_query_int64(conn, sql);
+		pfree(sql);
+	}
+	else if (nfiles > 0)
+	{
+		/* The INSERT's result is its row count */
+		sql = psprintf("INSERT INTO %s BY NAME SELECT * FROM read_parquet(%s)",
+					   cache, files.data);
+		rows = duckdb_query_int64(conn, sql);
+		pfree(sql);
+	}
+	else
+		rows = 0;
+
+	if (nfiles > 0)
+	{
+		sql = psprintf("INSERT INTO duckdb_fdw_cache.files "
+					   "SELECT %u, %u, filename, last_modified, size FROM duckdb_fdw_listing "
+					   "WHERE list_contains(%s, filename)",
+					   MyDatabaseId, relid, files.data);
+		duckdb_do_sql_command(conn, sql, ERROR);
+		pfree(sql);
+	}
+
+	pfree(files.data);
+	pfree(lit);
+	return rows;
+}
+
+PG_FUNCTION_INFO_V1(duckdb_fdw_refresh_cache);
+Datum
+duckdb_fdw_refresh_cache(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	ForeignTable *table;
+	ForeignServer *server;
+	duckdb_opt *options;
+	duckdb_connection conn;
+	char	   *cache;
+	char	   *key;
+	char	   *source_lit;
+	char	   *sql;
+	int			max_age;
+	bool		full = true;
+	int64		rows;
+	AclResult	aclresult;
+
+	if (get_rel_relkind(relid) != RELKIND_FOREIGN_TABLE)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a foreign table", get_rel_name(relid))));
+
+	aclresult = pg_class_aclcheck(relid, GetUserId(), ACL_SELECT);
+	if (aclresult != ACLCHECK_OK)
+		aclcheck_error(aclresult, OBJECT_FOREIGN_TABLE, get_rel_name(relid));
+
+	table = GetForeignTable(relid);
+	if (!duckdb_table_uses_local_cache(table, &max_age))
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("foreign table \"%s\" is not cached locally", get_rel_name(relid)),
+				 errhint("Set the table's cache_mode option to 'local'.")));
+
+	server = GetForeignServer(table->serverid);
+	if (duckdb_server_uses_host(server))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("local caches are not supported on shared_host servers")));
+
+	options = duckdb_get_options(relid);
+	cache = duckdb_local_cache_name(relid);
+	key = psprintf("dbid = %u AND relid = %u", MyDatabaseId, relid);
+	source_lit = duckdb_fdw_quote_literal(options->svr_table);
+
+	/*
+	 * The copy is made in the transaction's DuckDB transaction, so it commits
+	 * or rolls back with it and sees the transaction's inserts.
+	 */
+	conn = duckdb_xact_connection(server);
+	(void) duckdb_attach_catalogs(server, options->svr_table);
+	duckdb_do_sql_command(conn, DUCKDB_CACHE_SETUP_SQL, ERROR);
+
+	/* A copy of another source is no base for appending */
+	sql = psprintf("SELECT count(*) FROM duckdb_fdw_cache.sources WHERE %s AND source = %s",
+				   key, source_lit);
+	full = duckdb_query_int64(conn, sql) == 0;
+	pfree(sql);
+
+	if (strstr(options->svr_table, ".parquet") != NULL &&
+		strstr(options->svr_table, "read_parquet") == NULL)
+		rows = duckdb_refresh_parquet_copy(conn, relid, cache, key,
+										   options->svr_table, full);
+	else
+	{
+		/* Catalog tables and table functions are copied whole */
+		char	   *relref = duckdb_build_relation_reference(options->svr_table);
+
+		sql = psprintf("CREATE OR REPLACE TABLE %s AS SELECT * FROM %s", cache, relref);
+		duckdb_do_sql_command(conn, sql, ERROR);
+		pfree(sql);
+		sql = psprintf("SELECT count(*) FROM %s", cache);
+		rows = duckdb_query_int64(conn, sql);
+		pfree(sql);
+		pfree(relref);
+	}
+
+	sql = psprintf("INSERT OR REPLACE INTO duckdb_fdw_cache.sources VALUES (%u, %u, %s, now())",
+				   MyDatabaseId, relid, source_lit);
+	duckdb_do_sql_command(conn, sql, ERROR);
+	pfree(sql);
+	duckdb_do_sql_command(conn, "DROP TABLE IF EXISTS duckdb_fdw_listing", ERROR);
+
+	pfree(source_lit);
+	pfree(key);
+	pfree(cache);
+	PG_RETURN_INT64(rows);
+}
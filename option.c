@@ -15,6 +15,7 @@
 #include "catalog/pg_foreign_table.h"
 #include "catalog/pg_user_mapping.h"
 #include "commands/defrem.h"
+#include "miscadmin.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 
@@ -25,6 +26,7 @@ struct DuckDBFdwOption
 {
 	const char *defname;
 	Oid			optcontext;
+	bool		superuser_only;	/* names a directory DuckDB uses as the OS user */
 };
 
 /*
@@ -63,10 +65,39 @@ static struct DuckDBFdwOption valid_options[] =
 
     /* Extensions */
     {"extensions", ForeignServerRelationId}, /* e.g., 'httpfs,spatial,iceberg' */
+    {"extension_directory", ForeignServerRelationId, true},     /* pre-seeded, for offline hosts */
+    {"allow_extension_install", ForeignServerRelationId},
+
+    /* DuckDB engine configuration, applied when the database is opened */
+    {"threads", ForeignServerRelationId},
+    {"memory_limit", ForeignServerRelationId},           /* e.g. '4GB' */
+    {"temp_directory", ForeignServerRelationId, true},
+    {"max_temp_directory_size", ForeignServerRelationId},
+    {"preserve_insertion_order", ForeignServerRelationId},
+    {"default_order", ForeignServerRelationId},          /* 'asc' or 'desc' */
+
+    {"access_mode", ForeignServerRelationId},            /* read_only, read_write, automatic */
+
+    /* Local cache of remote object-storage reads, shared by all backends */
+    {"disk_cache_directory", ForeignServerRelationId, true},
+    {"disk_cache_max_size", ForeignServerRelationId},     /* e.g. '20GB' */
+
+    /* Results of scans of immutable Parquet sources, shared by all backends */
+    {"result_cache_directory", ForeignServerRelationId, true},
+    {"result_cache_max_size", ForeignServerRelationId},
+
+    /* Run queries in the shared DuckDB host worker instead of the backend */
+    {"shared_host", ForeignServerRelationId},
+
+    /* Keep the database open across transactions (default true) */
+    {"keep_connections", ForeignServerRelationId},
 
 	/* Table options */
 	{"table", ForeignTableRelationId},
     {"read_parquet", ForeignTableRelationId}, /* Path to parquet file */
+    {"cache_mode", ForeignTableRelationId},   /* 'none' or 'local' */
+    {"cache_max_age", ForeignTableRelationId}, /* e.g. '1h' */
+    {"on_conflict", ForeignTableRelationId},  /* 'error', 'nothing' or 'update' */
 	
     /* Execution options */
 	{"use_remote_estimate", ForeignServerRelationId},
@@ -89,6 +120,21 @@ duckdb_is_valid_option(const char *option, Oid context)
 	return false;
 }
 
+/*
+ * Check if only superusers may set the option
+ */
+static bool
+duckdb_is_superuser_option(const char *option)
+{
+	struct DuckDBFdwOption *opt;
+	for (opt = valid_options; opt->defname; opt++)
+	{
+		if (opt->superuser_only && strcmp(opt->defname, option) == 0)
+			return true;
+	}
+	return false;
+}
+
 /*
  * FDW Option Validator
  */
@@ -108,6 +154,122 @@ duckdb_fdw_validator(PG_FUNCTION_ARGS)
 			ereport(ERROR, (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
 					 errmsg("invalid option \"%s\"", def->defname)));
 		}
+
+		/*
+		 * DuckDB creates and removes files in these directories, or loads
+		 * extension libraries from them, as the PostgreSQL OS user, so a
+		 * server owner must not pick them.
+		 */
+		if (duckdb_is_superuser_option(def->defname) && !superuser())
+			ereport(ERROR,
+					(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+					 errmsg("permission denied to set option \"%s\"", def->defname),
+					 errdetail("Only superusers may set options that name a server directory.")));
+
+		if (strcmp(def->defname, "threads") == 0)
+		{
+			char	   *value = defGetString(def);
+			char	   *endp;
+			long		threads = strtol(value, &endp, 10);
+
+			if (*value == '\0' || *endp != '\0' || threads < 1 || threads > INT_MAX)
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, value),
+						 errhint("Valid values are positive integers.")));
+		}
+		else if (strcmp(def->defname, "preserve_insertion_order") == 0 ||
+				 strcmp(def->defname, "shared_host") == 0 ||
+				 strcmp(def->defname, "keep_connections") == 0 ||
+				 strcmp(def->defname, "allow_extension_install") == 0)
+			(void) defGetBoolean(def);
+		else if (strcmp(def->defname, "default_order") == 0)
+		{
+			char	   *value = defGetString(def);
+
+			if (pg_strcasecmp(value, "asc") != 0 && pg_strcasecmp(value, "desc") != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, value),
+						 errhint("Valid values are \"asc\" and \"desc\".")));
+		}
+		else if (strcmp(def->defname, "access_mode") == 0)
+		{
+			char	   *value = defGetString(def);
+
+			if (pg_strcasecmp(value, "read_only") != 0 &&
+				pg_strcasecmp(value, "read_write") != 0 &&
+				pg_strcasecmp(value, "automatic") != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, value),
+						 errhint("Valid values are \"read_only\", \"read_write\" and \"automatic\".")));
+		}
+		else if (strcmp(def->defname, "cache_mode") == 0)
+		{
+			char	   *value = defGetString(def);
+
+			if (pg_strcasecmp(value, "none") != 0 && pg_strcasecmp(value, "local") != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, value),
+						 errhint("Valid values are \"none\" and \"local\".")));
+		}
+		else if (strcmp(def->defname, "on_conflict") == 0)
+		{
+			char	   *value = defGetString(def);
+
+			if (pg_strcasecmp(value, "error") != 0 &&
+				pg_strcasecmp(value, "nothing") != 0 &&
+				pg_strcasecmp(value, "update") != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, value),
+						 errhint("Valid values are \"error\", \"nothing\" and \"update\".")));
+		}
+		else if (strcmp(def->defname, "cache_max_age") == 0)
+		{
+			char	   *value = defGetString(def);
+			int			age_s;
+
+			if (!duckdb_local_cache_parse_age(value, &age_s))
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, value),
+						 errhint("Valid values are positive durations such as \"15min\" or \"1h\".")));
+		}
+		else if (strcmp(def->defname, "disk_cache_directory") == 0 ||
+				 strcmp(def->defname, "result_cache_directory") == 0 ||
+				 strcmp(def->defname, "extension_directory") == 0)
+		{
+			char	   *value = defGetString(def);
+
+			if (!is_absolute_path(value))
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, value),
+						 errhint("The directory must be an absolute path.")));
+		}
+		else if (strcmp(def->defname, "disk_cache_max_size") == 0 ||
+				 strcmp(def->defname, "result_cache_max_size") == 0)
+		{
+			char	   *value = defGetString(def);
+			int			size_mb;
+
+			if (!duckdb_disk_cache_parse_size(value, &size_mb))
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, value),
+						 errhint("Valid values are positive sizes such as \"512MB\" or \"20GB\".")));
+		}
 	}
 	PG_RETURN_VOID();
 }
@@ -153,6 +315,8 @@ duckdb_get_options(Oid foreignoid)
 			opt->svr_table = defGetString(def);
 		else if (strcmp(def->defname, "use_remote_estimate") == 0)
 			opt->use_remote_estimate = defGetBoolean(def);
+		else if (strcmp(def->defname, "on_conflict") == 0)
+			opt->on_conflict = defGetString(def);
 	}
 
 	/* If table name is not specified, use Postgres relation name */
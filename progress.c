@@ -0,0 +1,272 @@
+/*-------------------------------------------------------------------------
+ *
+ * DuckDB Foreign Data Wrapper for PostgreSQL
+ *
+ * IDENTIFICATION
+ *        progress.c
+ *
+ * Live progress of remote DuckDB queries.  Each backend owns one slot in
+ * shared memory; while a scan's query runs, the pending-result loop samples
+ * duckdb_query_progress() into it, and duckdb_fdw_progress() lists the
+ * slots of all backends.  PostgreSQL's pg_stat_progress_* views only cover
+ * built-in commands, hence the separate function.  Like pg_stat_activity, it
+ * shows other users' remote SQL only to members of pg_read_all_stats.
+ * Requires duckdb_fdw in shared_preload_libraries.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "duckdb_fdw.h"
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "postmaster/autovacuum.h"
+#include "replication/walsender.h"
+#include "storage/ipc.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/timestamp.h"
+
+/* Longest remote SQL text shown per query; longer statements are truncated */
+#define DUCKDB_PROGRESS_QUERY_LEN	1024
+
+/* Sample DuckDB's progress once per this many executed tasks */
+#define DUCKDB_PROGRESS_TASK_INTERVAL	64
+
+/* Number of output columns of duckdb_fdw_progress() */
+#define DUCKDB_PROGRESS_COLS		7
+
+typedef struct DuckDBProgressSlot
+{
+	slock_t		mutex;
+	pid_t		pid;			/* 0 while no remote query is running */
+	Oid			userid;
+	Oid			serverid;
+	TimestampTz started;
+	double		percentage;		/* negative while DuckDB cannot tell */
+	uint64		rows_processed;
+	uint64		total_rows;
+	char		query[DUCKDB_PROGRESS_QUERY_LEN];
+} DuckDBProgressSlot;
+
+static DuckDBProgressSlot *progress_slots = NULL;
+static int	progress_nslots = 0;
+
+/* This backend's slot while one of its queries is being tracked */
+static DuckDBProgressSlot *my_slot = NULL;
+static int	tasks_since_sample = 0;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static int
+duckdb_progress_max_slots(void)
+{
+#if PG_VERSION_NUM >= 150000
+	return GetMaxBackends();
+#else
+	/*
+	 * MaxBackends is still 0 when _PG_init requests shared memory, so add it
+	 * up the way InitializeMaxBackends will.
+	 */
+	return MaxConnections + autovacuum_max_workers + 1 +
+		max_worker_processes + max_wal_senders;
+#endif
+}
+
+static void
+duckdb_progress_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+	RequestAddinShmemSpace(mul_size(duckdb_progress_max_slots(),
+									sizeof(DuckDBProgressSlot)));
+}
+
+static void
+duckdb_progress_shmem_startup(void)
+{
+	bool		found;
+	int			i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	progress_nslots = duckdb_progress_max_slots();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	progress_slots = ShmemInitStruct("duckdb_fdw progress",
+									 mul_size(progress_nslots, sizeof(DuckDBProgressSlot)),
+									 &found);
+	if (!found)
+	{
+		for (i = 0; i < progress_nslots; i++)
+		{
+			SpinLockInit(&progress_slots[i].mutex);
+			progress_slots[i].pid = 0;
+		}
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Install the shared memory hooks.  Called from _PG_init; progress is only
+ * reported when the library is preloaded.
+ */
+void
+duckdb_progress_init(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = duckdb_progress_shmem_request;
+#else
+	duckdb_progress_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = duckdb_progress_shmem_startup;
+}
+
+/*
+ * True when DuckDB connections should track query progress.
+ */
+bool
+duckdb_progress_enabled(void)
+{
+	return progress_slots != NULL;
+}
+
+/*
+ * Start publishing the progress of a remote query on a foreign server.
+ */
+void
+duckdb_progress_begin(Oid serverid, const char *sql)
+{
+#if PG_VERSION_NUM >= 170000
+	int			slotno = MyProcNumber;
+#else
+	int			slotno = MyProc->pgprocno;
+#endif
+	char	   *text;
+
+	if (progress_slots == NULL || slotno < 0 || slotno >= progress_nslots)
+		return;
+
+	text = duckdb_fdw_redact_secret_text(sql);
+
+	my_slot = &progress_slots[slotno];
+	tasks_since_sample = 0;
+
+	SpinLockAcquire(&my_slot->mutex);
+	my_slot->pid = MyProcPid;
+	my_slot->userid = GetUserId();
+	my_slot->serverid = serverid;
+	my_slot->started = GetCurrentTimestamp();
+	my_slot->percentage = -1;
+	my_slot->rows_processed = 0;
+	my_slot->total_rows = 0;
+	strlcpy(my_slot->query, text, DUCKDB_PROGRESS_QUERY_LEN);
+	SpinLockRelease(&my_slot->mutex);
+
+	pfree(text);
+}
+
+/*
+ * Sample the progress of the query running on conn.  Called from the
+ * pending-result loop; unless force is set, only every few tasks.
+ */
+void
+duckdb_progress_update(duckdb_connection conn, bool force)
+{
+	duckdb_query_progress_type progress;
+
+	if (my_slot == NULL)
+		return;
+	if (!force && ++tasks_since_sample < DUCKDB_PROGRESS_TASK_INTERVAL)
+		return;
+	tasks_since_sample = 0;
+
+	progress = duckdb_query_progress(conn);
+
+	SpinLockAcquire(&my_slot->mutex);
+	my_slot->percentage = progress.percentage;
+	my_slot->rows_processed = progress.rows_processed;
+	my_slot->total_rows = progress.total_rows_to_process;
+	SpinLockRelease(&my_slot->mutex);
+}
+
+/*
+ * Stop publishing progress.  Also called at transaction end, for queries
+ * that errored out before they finished.
+ */
+void
+duckdb_progress_end(void)
+{
+	if (my_slot == NULL)
+		return;
+
+	SpinLockAcquire(&my_slot->mutex);
+	my_slot->pid = 0;
+	SpinLockRelease(&my_slot->mutex);
+	my_slot = NULL;
+}
+
+PG_FUNCTION_INFO_V1(duckdb_fdw_progress);
+Datum
+duckdb_fdw_progress(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	int			i;
+
+	if (progress_slots == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("duckdb_fdw query progress is not available"),
+				 errhint("Add duckdb_fdw to shared_preload_libraries.")));
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	for (i = 0; i < progress_nslots; i++)
+	{
+		DuckDBProgressSlot tmp;
+		Datum		values[DUCKDB_PROGRESS_COLS];
+		bool		nulls[DUCKDB_PROGRESS_COLS];
+
+		SpinLockAcquire(&progress_slots[i].mutex);
+		tmp = progress_slots[i];
+		SpinLockRelease(&progress_slots[i].mutex);
+
+		if (tmp.pid == 0)
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = Int32GetDatum(tmp.pid);
+		values[1] = ObjectIdGetDatum(tmp.serverid);
+		values[2] = TimestampTzGetDatum(tmp.started);
+		if (duckdb_stats_visible(tmp.userid))
+			values[3] = CStringGetTextDatum(tmp.query);
+		else
+			values[3] = CStringGetTextDatum("<insufficient privilege>");
+		if (tmp.percentage >= 0)
+		{
+			values[4] = Float8GetDatum(tmp.percentage);
+			values[5] = Int64GetDatum((int64) tmp.rows_processed);
+			values[6] = Int64GetDatum((int64) tmp.total_rows);
+		}
+		else
+			nulls[4] = nulls[5] = nulls[6] = true;
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
@@ -0,0 +1,231 @@
+/*-------------------------------------------------------------------------
+ *
+ * DuckDB Foreign Data Wrapper for PostgreSQL
+ *
+ * IDENTIFICATION
+ *        resultcache.c
+ *
+ * Result cache for scans of immutable Parquet sources.  On servers with
+ * result_cache_directory, the result of a scan without parameters is
+ * written to a Parquet file named after a hash of the remote SQL and of the
+ * fingerprint of the source's files.  Later scans, in any backend, read
+ * that file instead of the source until a file is added, removed or
+ * rewritten.  result_cache_max_size bounds the directory, evicting the
+ * least recently used results.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "duckdb_fdw.h"
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <sys/time.h>
+#endif
+#include <unistd.h>
+
+#include "access/htup_details.h"
+#include "commands/defrem.h"
+#include "common/hashfn.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+
+/* Seconds between size checks of the result cache in one backend */
+#define DUCKDB_RESULT_CACHE_CHECK_INTERVAL	30
+
+/* Backend-lifetime result cache counters */
+static uint64 result_cache_hits = 0;
+static uint64 result_cache_misses = 0;
+static uint64 result_cache_bypasses = 0;
+
+/*
+ * Whether name is a result file written by duckdb_result_cache_query.
+ * Files still being written keep their .tmp suffix and are left alone.
+ */
+static bool
+duckdb_is_result_cache_file(const char *name)
+{
+	unsigned int dbid;
+	unsigned int serverid;
+	unsigned long long hash;
+	int			len = 0;
+
+	return sscanf(name, "%u_%u_%16llx.parquet%n", &dbid, &serverid, &hash, &len) == 3 &&
+		len > 0 && name[len] == '\0';
+}
+
+/*
+ * The server's result cache directory and size limit in megabytes (0 when
+ * unlimited).  Returns false when the server has no result cache.
+ */
+static bool
+duckdb_server_result_cache(ForeignServer *server, char **directory, int *max_size_mb)
+{
+	ListCell   *lc;
+
+	*directory = NULL;
+	*max_size_mb = 0;
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "result_cache_directory") == 0)
+			*directory = defGetString(def);
+		else if (strcmp(def->defname, "result_cache_max_size") == 0)
+			(void) duckdb_disk_cache_parse_size(defGetString(def), max_size_mb);
+	}
+	return *directory != NULL;
+}
+
+/*
+ * Parquet cannot hold every DuckDB type exactly; HUGEINT, for one, is
+ * written as DOUBLE.  Results with such columns are not cached.
+ */
+static bool
+duckdb_result_cacheable(duckdb_connection conn, const char *sql)
+{
+	duckdb_prepared_statement stmt = duckdb_acquire_prepared_statement(conn, sql);
+	idx_t		ncols = duckdb_prepared_statement_column_count(stmt);
+	bool		ok = true;
+
+	for (idx_t i = 0; i < ncols && ok; i++)
+	{
+		switch (duckdb_prepared_statement_column_type(stmt, i))
+		{
+			case DUCKDB_TYPE_HUGEINT:
+			case DUCKDB_TYPE_UHUGEINT:
+			case DUCKDB_TYPE_UNION:
+			case DUCKDB_TYPE_INVALID:
+				ok = false;
+				break;
+			default:
+				break;
+		}
+	}
+	duckdb_release_prepared_statement(conn, stmt);
+	return ok;
+}
+
+static char *
+duckdb_result_cache_read_sql(const char *path)
+{
+	char	   *lit = duckdb_fdw_quote_literal(path);
+	char	   *sql = psprintf("SELECT * FROM read_parquet(%s)", lit);
+
+	pfree(lit);
+	return sql;
+}
+
+/*
+ * SQL that reads the cached result of a parameterless scan of a foreign
+ * table, storing the result first if it is not cached yet.  Returns NULL
+ * when the scan has to run its own query: the server has no result cache,
+ * the table's source is not a Parquet path, or the result cannot be cached.
+ */
+char *
+duckdb_result_cache_query(ForeignServer *server, duckdb_connection conn,
+						  Oid foreigntableid, const char *sql)
+{
+	char	   *directory;
+	int			max_size_mb;
+	duckdb_opt *options;
+	char	   *fingerprint;
+	uint64		hash;
+	char	   *path;
+	char	   *tmp_path;
+	char	   *tmp_lit;
+	char	   *copy_sql;
+
+	if (!duckdb_server_result_cache(server, &directory, &max_size_mb))
+		return NULL;
+
+	/* Only file sources have a version to key on */
+	options = duckdb_get_options(foreigntableid);
+	fingerprint = duckdb_is_parquet_source(options->svr_table) ?
+		duckdb_source_fingerprint(conn, options->svr_table) : NULL;
+	pfree(options);
+	if (fingerprint == NULL)
+	{
+		result_cache_bypasses++;
+		return NULL;
+	}
+
+	hash = hash_bytes_extended((const unsigned char *) sql, strlen(sql), 0);
+	hash = hash_bytes_extended((const unsigned char *) fingerprint, strlen(fingerprint), hash);
+	path = psprintf("%s/%u_%u_%016llx.parquet", directory, MyDatabaseId,
+					server->serverid, (unsigned long long) hash);
+	pfree(fingerprint);
+
+	if (access(path, R_OK) == 0)
+	{
+		/* Refresh its modification time; eviction goes by last use */
+#ifdef _WIN32
+		(void) _utime(path, NULL);
+#else
+		(void) utimes(path, NULL);
+#endif
+		result_cache_hits++;
+		return duckdb_result_cache_read_sql(path);
+	}
+
+	if (!duckdb_result_cacheable(conn, sql))
+	{
+		result_cache_bypasses++;
+		pfree(path);
+		return NULL;
+	}
+	result_cache_misses++;
+
+	if (MakePGDirectory(directory) != 0 && errno != EEXIST)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m", directory)));
+
+	/* Write privately, then publish in one rename so readers never see a partial file */
+	tmp_path = psprintf("%s.tmp.%d", path, MyProcPid);
+	tmp_lit = duckdb_fdw_quote_literal(tmp_path);
+	copy_sql = psprintf("COPY (%s) TO %s (FORMAT parquet)", sql, tmp_lit);
+	duckdb_do_sql_command(conn, copy_sql, ERROR);
+	if (rename(tmp_path, path) != 0)
+	{
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("duckdb_fdw: could not rename \"%s\" to \"%s\": %m",
+						tmp_path, path)));
+		(void) unlink(tmp_path);
+		pfree(path);
+		path = NULL;
+	}
+	pfree(copy_sql);
+	pfree(tmp_lit);
+	pfree(tmp_path);
+
+	if (max_size_mb > 0 &&
+		duckdb_cache_check_due(directory, DUCKDB_RESULT_CACHE_CHECK_INTERVAL))
+		duckdb_trim_cache_directory(directory, max_size_mb,
+									duckdb_is_result_cache_file);
+
+	return path ? duckdb_result_cache_read_sql(path) : NULL;
+}
+
+PG_FUNCTION_INFO_V1(duckdb_fdw_result_cache_stats);
+Datum
+duckdb_fdw_result_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[3];
+	bool		nulls[3] = {false, false, false};
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	values[0] = Int64GetDatum((int64) result_cache_hits);
+	values[1] = Int64GetDatum((int64) result_cache_misses);
+	values[2] = Int64GetDatum((int64) result_cache_bypasses);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
@@ -77,6 +77,102 @@ SELECT stddev(i), variance(j), log(d) FROM test_types GROUP BY s;
 EXPLAIN (VERBOSE, COSTS OFF) SELECT * FROM test_types WHERE i = 1;
 SELECT * FROM test_types WHERE i = 1;
 
+-- Window function pushdown; EXPLAIN's Output lines differ between
+-- PostgreSQL versions, so only the Remote SQL is shown
+CREATE FUNCTION remote_sql(q text) RETURNS SETOF text LANGUAGE plpgsql AS $$
+DECLARE ln text;
+BEGIN
+  FOR ln IN EXECUTE 'EXPLAIN (VERBOSE, COSTS OFF) ' || q LOOP
+    IF ln ~ '^\s*Remote SQL: ' THEN
+      RETURN NEXT btrim(ln);
+    END IF;
+  END LOOP;
+END $$;
+SELECT remote_sql('SELECT i, row_number() OVER (ORDER BY i DESC) AS rn, sum(j) OVER (ORDER BY i ROWS BETWEEN 1 PRECEDING AND CURRENT ROW) AS running FROM test_types WHERE i <= 3 ORDER BY i');
+SELECT i, row_number() OVER (ORDER BY i DESC) AS rn,
+       sum(j) OVER (ORDER BY i ROWS BETWEEN 1 PRECEDING AND CURRENT ROW) AS running
+FROM test_types WHERE i <= 3 ORDER BY i;
+SELECT s, rank() OVER (ORDER BY sum(j) DESC) AS r FROM test_types WHERE i <= 3 GROUP BY s ORDER BY r;
+SELECT remote_sql('SELECT s, rank() OVER (ORDER BY sum(j) DESC) AS r FROM test_types WHERE i <= 3 GROUP BY s ORDER BY r');
+-- A run condition (rn <= 3) is only applied by the local WindowAgg
+SELECT * FROM (SELECT i, row_number() OVER (ORDER BY i) AS rn FROM test_types) s WHERE rn <= 3 ORDER BY i;
+SELECT remote_sql('SELECT * FROM (SELECT i, row_number() OVER (ORDER BY i) AS rn FROM test_types) s WHERE rn <= 3 ORDER BY i');
+
+-- A qual evaluated locally keeps window functions and aggregates local
+CREATE FUNCTION local_odd(n int) RETURNS bool LANGUAGE plpgsql IMMUTABLE AS $$ BEGIN RETURN n % 2 = 1; END $$;
+SELECT i, row_number() OVER (ORDER BY i) AS rn FROM test_types WHERE i <= 5 AND local_odd(i) ORDER BY i;
+SELECT remote_sql('SELECT i, row_number() OVER (ORDER BY i) AS rn FROM test_types WHERE i <= 5 AND local_odd(i) ORDER BY i');
+SELECT count(*) FROM test_types WHERE local_odd(i);
+SELECT remote_sql('SELECT count(*) FROM test_types WHERE local_odd(i)');
+
+-- DISTINCT / DISTINCT ON pushdown
+SELECT DISTINCT s FROM test_types WHERE i <= 3 ORDER BY s;
+SELECT remote_sql('SELECT DISTINCT s FROM test_types WHERE i <= 3 ORDER BY s');
+SELECT DISTINCT ON (d > 5) i, s FROM test_types WHERE i <= 3 ORDER BY d > 5, i DESC;
+SELECT remote_sql('SELECT DISTINCT ON (d > 5) i, s FROM test_types WHERE i <= 3 ORDER BY d > 5, i DESC');
+
+-- A qual evaluated locally keeps DISTINCT local too
+SELECT DISTINCT s FROM test_types WHERE i <= 5 AND local_odd(i) ORDER BY s;
+SELECT remote_sql('SELECT DISTINCT s FROM test_types WHERE i <= 5 AND local_odd(i) ORDER BY s');
+
+-- Array parameters are bound as DuckDB lists
+SELECT i, s FROM test_types WHERE i = ANY (ARRAY(SELECT generate_series(2, 3))) ORDER BY i;
+SELECT i, s FROM test_types WHERE s LIKE ANY (ARRAY(SELECT 'wor%')) ORDER BY i;
+-- A NULL array parameter makes ANY and ALL NULL, as in PostgreSQL
+SELECT i FROM test_types WHERE i <> ALL ((SELECT NULL::int4[])) ORDER BY i;
+SELECT i FROM test_types WHERE NOT (i = ANY ((SELECT NULL::int4[]))) ORDER BY i;
+SELECT remote_sql('SELECT i FROM test_types WHERE i <> ALL ((SELECT NULL::int4[]))');
+-- A multi-dimensional array parameter is bound as the flat list of its elements
+SELECT i FROM test_types WHERE i = ANY ((SELECT ARRAY[[1, 2], [3, 4]])) ORDER BY i;
+
+-- Rescans re-execute only when parameters change
+CREATE FUNCTION remote_executions(q text) RETURNS SETOF text LANGUAGE plpgsql AS $$
+DECLARE ln text;
+BEGIN
+  FOR ln IN EXECUTE 'EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF) ' || q LOOP
+    IF ln ~ '^\s*Remote Executions: ' THEN
+      RETURN NEXT btrim(ln);
+    END IF;
+  END LOOP;
+END $$;
+SELECT l.i, (SELECT s FROM test_types t WHERE t.i = l.i) AS s
+FROM generate_series(1, 3) AS l(i);
+SELECT remote_executions('SELECT l.i, (SELECT s FROM test_types t WHERE t.i = l.i) AS s FROM generate_series(1, 3) AS l(i)');
+-- An inner scan whose parameters stay the same replays its first result
+SET enable_material = off;
+SELECT remote_executions('SELECT v.x, t.s FROM (VALUES (1), (2), (3)) v(x) LEFT JOIN test_types t ON t.i = ANY ((SELECT ARRAY[1, 2]))');
+RESET enable_material;
+DROP FUNCTION remote_executions(text);
+-- EXPLAIN ANALYZE shows the remote counters and DuckDB's plan, without times under TIMING OFF
+CREATE FUNCTION explain_remote(q text) RETURNS SETOF text LANGUAGE plpgsql AS $$
+DECLARE ln text;
+BEGIN
+  FOR ln IN EXECUTE 'EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF) ' || q LOOP
+    IF ln ~ '^\s*(Remote (Executions|Chunks|Rows|Latency|Plan)|Conversion Time|[A-Z_]+ \(actual)' THEN
+      RETURN NEXT rtrim(ln);
+    END IF;
+  END LOOP;
+END $$;
+SELECT explain_remote('SELECT i FROM test_types WHERE i <= 3');
+DROP FUNCTION explain_remote(text);
+
+-- Prepared statements are cached per connection, across transactions
+SELECT hits AS hits_before FROM duckdb_fdw_prepared_statement_cache_stats() \gset
+SELECT s FROM test_types WHERE i = ANY (ARRAY(SELECT generate_series(2, 2)));
+SELECT s FROM test_types WHERE i = ANY (ARRAY(SELECT generate_series(2, 2)));
+SELECT hits > :hits_before AS reused, entries > 0 AS cached
+FROM duckdb_fdw_prepared_statement_cache_stats();
+
+-- Scans open at the same time lease separate connections of the pool
+BEGIN;
+DECLARE c1 CURSOR FOR SELECT i FROM test_types WHERE i <= 3 ORDER BY i;
+DECLARE c2 CURSOR FOR SELECT s FROM test_types WHERE i >= 9 ORDER BY i;
+FETCH 1 FROM c1;
+FETCH 1 FROM c2;
+FETCH ALL FROM c1;
+FETCH ALL FROM c2;
+COMMIT;
+
 -- Server option refresh should use a new DuckDB database after ALTER SERVER
 CREATE SERVER duckdb_switch FOREIGN DATA WRAPPER duckdb_fdw
 OPTIONS (database 'duckdb_switch_one.db');
@@ -94,6 +190,199 @@ SELECT * FROM switch_test_ft;
 DROP FOREIGN TABLE switch_test_ft;
 DROP SERVER duckdb_switch CASCADE;
 
+-- Per-server DuckDB engine configuration
+CREATE SERVER duckdb_tuned FOREIGN DATA WRAPPER duckdb_fdw
+OPTIONS (database ':memory:', threads '2', memory_limit '256MB',
+         preserve_insertion_order 'false');
+CREATE FOREIGN TABLE tuned_settings (name text, value text)
+SERVER duckdb_tuned OPTIONS (table 'duckdb_settings()');
+SELECT name, value FROM tuned_settings
+WHERE name IN ('threads', 'preserve_insertion_order') ORDER BY name;
+ALTER SERVER duckdb_tuned OPTIONS (SET threads '0');
+ALTER SERVER duckdb_tuned OPTIONS (ADD default_order 'sideways');
+DROP SERVER duckdb_tuned CASCADE;
+
+-- Read-only access mode
+CREATE SERVER duckdb_ro FOREIGN DATA WRAPPER duckdb_fdw
+OPTIONS (database '/tmp/duckdb_fdw_regress_main.db', access_mode 'read_only');
+CREATE FOREIGN TABLE test_types_ro (i INT4, j INT8, d FLOAT8, s TEXT)
+SERVER duckdb_ro OPTIONS (table 'test_types');
+SELECT i, s FROM test_types_ro WHERE i = 1;
+INSERT INTO test_types_ro VALUES (9, 900, 9.9, 'ro');
+SELECT duckdb_execute('duckdb_ro', 'SELECT 1');
+ALTER SERVER duckdb_ro OPTIONS (SET access_mode 'sometimes');
+ALTER SERVER duckdb_ro OPTIONS (ADD disk_cache_directory 'duckdb_cache');
+ALTER SERVER duckdb_ro OPTIONS (ADD disk_cache_max_size 'lots');
+ALTER SERVER duckdb_ro OPTIONS (ADD extension_directory 'extensions');
+ALTER SERVER duckdb_ro OPTIONS (ADD allow_extension_install 'maybe');
+ALTER SERVER duckdb_ro OPTIONS (ADD keep_connections 'maybe');
+DROP SERVER duckdb_ro CASCADE;
+
+-- Only superusers may point a server at a directory DuckDB writes to
+GRANT USAGE ON FOREIGN DATA WRAPPER duckdb_fdw TO duckdb_fdw_unprivileged;
+SET ROLE duckdb_fdw_unprivileged;
+CREATE SERVER duckdb_spill FOREIGN DATA WRAPPER duckdb_fdw
+OPTIONS (temp_directory '/tmp/duckdb_fdw_spill');
+CREATE SERVER duckdb_spill FOREIGN DATA WRAPPER duckdb_fdw
+OPTIONS (result_cache_directory '/tmp/duckdb_fdw_results');
+RESET ROLE;
+REVOKE USAGE ON FOREIGN DATA WRAPPER duckdb_fdw FROM duckdb_fdw_unprivileged;
+
+-- statement_timeout interrupts a running DuckDB query
+CREATE FOREIGN TABLE huge_range (range INT8)
+SERVER duckdb_test OPTIONS (table 'range(1000000000000)');
+SET statement_timeout = '200ms';
+SELECT sum(range) FROM huge_range;
+RESET statement_timeout;
+DROP FOREIGN TABLE huge_range;
+
+-- IMPORT FOREIGN SCHEMA reads the catalog once and honours LIMIT TO
+CREATE SCHEMA imported;
+IMPORT FOREIGN SCHEMA main LIMIT TO (test_types, no_such_table)
+  FROM SERVER duckdb_test INTO imported;
+SELECT column_name, data_type FROM information_schema.columns
+WHERE table_schema = 'imported' ORDER BY table_name, ordinal_position;
+DROP SCHEMA imported CASCADE;
+
+-- Hive-partitioned Parquet imports as a partitioned table
+SELECT duckdb_execute('duckdb_test', 'COPY (SELECT i AS id, i % 2 AS part FROM range(4) t(i)) TO ''/tmp/duckdb_fdw_regress_hive'' (FORMAT parquet, PARTITION_BY (part), OVERWRITE_OR_IGNORE)');
+CREATE SCHEMA hive;
+IMPORT FOREIGN SCHEMA "/tmp/duckdb_fdw_regress_hive" FROM SERVER duckdb_test INTO hive
+  OPTIONS (hive_partitioning 'true', table_name 'events');
+SELECT c.relname, pg_get_expr(c.relpartbound, c.oid) AS bound
+FROM pg_class c WHERE c.relnamespace = 'hive'::regnamespace AND c.relispartition
+ORDER BY 1;
+SELECT id FROM hive.events WHERE part = 1 ORDER BY id;
+DROP SCHEMA hive CASCADE;
+
+-- Parquet footers size a scan and its range quals at plan time
+SELECT duckdb_execute('duckdb_test', 'COPY (SELECT i AS id FROM range(1000) t(i)) TO ''/tmp/duckdb_fdw_regress_rows.parquet'' (FORMAT parquet)');
+CREATE FOREIGN TABLE parquet_rows (id INT8)
+SERVER duckdb_test OPTIONS (table '/tmp/duckdb_fdw_regress_rows.parquet');
+CREATE FUNCTION plan_rows(q text) RETURNS int LANGUAGE plpgsql AS $$
+DECLARE j json;
+BEGIN
+  EXECUTE 'EXPLAIN (FORMAT JSON) ' || q INTO j;
+  RETURN (j -> 0 -> 'Plan' ->> 'Plan Rows')::int;
+END $$;
+SELECT plan_rows('SELECT * FROM parquet_rows') AS "all",
+       plan_rows('SELECT * FROM parquet_rows WHERE id < 250') AS lt_250,
+       plan_rows('SELECT * FROM parquet_rows WHERE id > 2000') AS gt_2000;
+DROP FUNCTION plan_rows(text);
+DROP FOREIGN TABLE parquet_rows;
+
+-- A local cache copies new Parquet files only
+SELECT duckdb_execute('duckdb_test', 'COPY (SELECT i AS id, 1 AS p FROM range(3) t(i)) TO ''/tmp/duckdb_fdw_regress_cache'' (FORMAT parquet, PARTITION_BY (p), OVERWRITE)');
+CREATE FOREIGN TABLE cached_events (id INT8)
+SERVER duckdb_test OPTIONS (table '/tmp/duckdb_fdw_regress_cache/*/*.parquet', cache_mode 'local');
+SELECT duckdb_fdw_refresh_cache('cached_events');
+SELECT duckdb_execute('duckdb_test', 'COPY (SELECT i AS id, 2 AS p FROM range(2) t(i)) TO ''/tmp/duckdb_fdw_regress_cache'' (FORMAT parquet, PARTITION_BY (p), APPEND)');
+SELECT duckdb_fdw_refresh_cache('cached_events');
+SELECT duckdb_fdw_refresh_cache('cached_events');
+SELECT count(*) FROM cached_events;
+SELECT regexp_replace(q, 't_\d+_\d+', 't_N_N') AS remote_sql
+FROM remote_sql('SELECT id FROM cached_events WHERE id > 2') q;
+-- A cached plan stops reading the copy once it expires
+ALTER FOREIGN TABLE cached_events OPTIONS (ADD cache_max_age '1s');
+SET plan_cache_mode = force_generic_plan;
+SELECT duckdb_fdw_refresh_cache('cached_events');
+PREPARE cached_count AS SELECT count(*) FROM cached_events;
+EXECUTE cached_count;
+SELECT duckdb_execute('duckdb_test', 'COPY (SELECT i AS id, 3 AS p FROM range(2) t(i)) TO ''/tmp/duckdb_fdw_regress_cache'' (FORMAT parquet, PARTITION_BY (p), APPEND)');
+SELECT pg_sleep(1.5);
+EXECUTE cached_count;
+DEALLOCATE cached_count;
+RESET plan_cache_mode;
+ALTER FOREIGN TABLE cached_events OPTIONS (SET cache_max_age 'soon');
+DROP FOREIGN TABLE cached_events;
+DROP FUNCTION remote_sql(text);
+
+-- Results of immutable Parquet scans are cached on disk
+ALTER SERVER duckdb_test OPTIONS (ADD result_cache_directory '/tmp/duckdb_fdw_regress_results');
+CREATE FOREIGN TABLE cached_rows (id INT8)
+SERVER duckdb_test OPTIONS (table '/tmp/duckdb_fdw_regress_rows.parquet');
+SELECT id FROM cached_rows WHERE id < 2 ORDER BY id;
+SELECT id FROM cached_rows WHERE id < 2 ORDER BY id;
+SELECT * FROM duckdb_fdw_result_cache_stats();
+ALTER SERVER duckdb_test OPTIONS (DROP result_cache_directory);
+DROP FOREIGN TABLE cached_rows;
+
+-- Catalogs in attach_catalogs are attached on first reference
+CREATE SERVER duckdb_lazy FOREIGN DATA WRAPPER duckdb_fdw
+OPTIONS (database ':memory:',
+         attach_catalogs 'aux=/tmp/duckdb_fdw_regress_aux.db, gone=/nonexistent/duckdb_fdw/gone.db');
+SELECT duckdb_execute('duckdb_lazy', 'CREATE OR REPLACE TABLE aux.lazy AS SELECT 42 AS x');
+CREATE FOREIGN TABLE lazy_aux (x INT4) SERVER duckdb_lazy OPTIONS (table 'aux.lazy');
+SELECT x FROM lazy_aux;
+DROP SERVER duckdb_lazy CASCADE;
+
+-- Inserts of a transaction share one appender, show up in its own queries and commit with it
+SELECT duckdb_execute('duckdb_test', 'CREATE OR REPLACE TABLE xact_rows (i INTEGER)');
+CREATE FOREIGN TABLE xact_rows (i INT4) SERVER duckdb_test OPTIONS (table 'xact_rows');
+BEGIN;
+INSERT INTO xact_rows VALUES (1);
+INSERT INTO xact_rows VALUES (2);
+SELECT count(*) FROM xact_rows;
+COMMIT;
+BEGIN;
+SAVEPOINT s;
+INSERT INTO xact_rows VALUES (3);
+ROLLBACK TO SAVEPOINT s;
+INSERT INTO xact_rows VALUES (4);
+COMMIT;
+BEGIN;
+INSERT INTO xact_rows VALUES (5);
+ROLLBACK;
+BEGIN;
+INSERT INTO xact_rows VALUES (6);
+SAVEPOINT a;
+INSERT INTO xact_rows VALUES (7);
+SAVEPOINT b;
+ROLLBACK TO SAVEPOINT a;
+ROLLBACK;
+-- DuckDB has no savepoints: rolling back to one loses earlier inserts too
+BEGIN;
+INSERT INTO xact_rows VALUES (8);
+SAVEPOINT a;
+INSERT INTO xact_rows VALUES (9);
+ROLLBACK TO SAVEPOINT a;
+COMMIT;
+-- A subtransaction that did not use DuckDB leaves the inserts alone
+BEGIN;
+INSERT INTO xact_rows VALUES (10);
+SAVEPOINT c;
+SELECT 1 / 0;
+ROLLBACK TO SAVEPOINT c;
+COMMIT;
+SELECT i FROM xact_rows ORDER BY i;
+DROP FOREIGN TABLE xact_rows;
+
+-- ON CONFLICT DO NOTHING and the on_conflict table option merge through a staging table
+SELECT duckdb_execute('duckdb_test', 'CREATE OR REPLACE TABLE upsert_rows (id INTEGER PRIMARY KEY, v VARCHAR)');
+SELECT duckdb_execute('duckdb_test', 'INSERT INTO upsert_rows VALUES (1, ''one''), (2, ''two'')');
+CREATE FOREIGN TABLE upsert_rows (id INT4, v TEXT) SERVER duckdb_test OPTIONS (table 'upsert_rows');
+INSERT INTO upsert_rows VALUES (2, 'deux'), (3, 'three') ON CONFLICT DO NOTHING;
+SELECT * FROM upsert_rows ORDER BY id;
+-- The merge belongs to the transaction, as the plain inserts before it do
+BEGIN;
+INSERT INTO upsert_rows VALUES (7, 'seven');
+INSERT INTO upsert_rows VALUES (8, 'eight') ON CONFLICT DO NOTHING;
+ROLLBACK;
+SELECT * FROM upsert_rows ORDER BY id;
+ALTER FOREIGN TABLE upsert_rows OPTIONS (ADD on_conflict 'update');
+INSERT INTO upsert_rows VALUES (1, 'uno'), (4, 'four');
+SELECT * FROM upsert_rows ORDER BY id;
+-- A key repeated in one statement keeps its last row on update, its first on DO NOTHING
+INSERT INTO upsert_rows VALUES (5, 'cinq'), (1, 'ein'), (5, 'five'), (1, 'one');
+INSERT INTO upsert_rows VALUES (6, 'six'), (6, 'sechs') ON CONFLICT DO NOTHING;
+SELECT * FROM upsert_rows ORDER BY id;
+ALTER FOREIGN TABLE upsert_rows OPTIONS (SET on_conflict 'merge');
+DROP FOREIGN TABLE upsert_rows;
+
+-- Statement statistics and query progress live in shared memory and need shared_preload_libraries
+SELECT count(*) FROM duckdb_fdw_stat_statements;
+SELECT count(*) FROM duckdb_fdw_progress();
+
 -- Unsupported write paths remain explicit
 UPDATE test_types SET s = 'changed' WHERE i = 1;
 DELETE FROM test_types WHERE i = 1;
@@ -3,6 +3,9 @@
 
 #include <ctype.h>
 
+#include "miscadmin.h"
+#include "utils/tuplestore.h"
+
 static bool
 contains_keyword_ci(const char *input, const char *keyword)
 {
@@ -148,3 +151,34 @@ duckdb_fdw_next_token(char *str, const char *delim, char **saveptr)
 	return strtok_r(str, delim, saveptr);
 #endif
 }
+
+#if PG_VERSION_NUM < 150000
+/*
+ * Set up a materialized set-returning function call: a tuplestore and the
+ * result tuple descriptor in rsinfo, living in per-query memory.
+ */
+void
+duckdb_fdw_init_materialized_srf(FunctionCallInfo fcinfo)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	MemoryContext oldcxt;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	oldcxt = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->setDesc = tupdesc;
+	MemoryContextSwitchTo(oldcxt);
+}
+#endif
@@ -0,0 +1,354 @@
+/*-------------------------------------------------------------------------
+ *
+ * DuckDB Foreign Data Wrapper for PostgreSQL
+ *
+ * IDENTIFICATION
+ *        stats.c
+ *
+ * Cumulative statistics per remote SQL statement, in the spirit of
+ * pg_stat_statements.  Scans, inserts and duckdb_execute() add their
+ * execution time, rows, value conversion time and number of cells converted
+ * through text to a shared hash keyed by user, database, foreign server and a
+ * hash of the remote SQL.  The stored text has secrets redacted, and only
+ * its own user or a member of pg_read_all_stats can read it.  Requires
+ * duckdb_fdw in shared_preload_libraries.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "duckdb_fdw.h"
+
+#include "catalog/pg_authid.h"
+#include "common/hashfn.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+#if PG_VERSION_NUM < 140000
+#define ROLE_PG_READ_ALL_STATS DEFAULT_ROLE_READ_ALL_STATS
+#endif
+
+/* Longest remote SQL text kept per entry; longer statements are truncated */
+#define DUCKDB_STAT_QUERY_LEN		2048
+
+/* Number of output columns of duckdb_fdw_stat_statements() */
+#define DUCKDB_STAT_COLS			13
+
+typedef struct DuckDBStatKey
+{
+	Oid			userid;
+	Oid			dbid;
+	Oid			serverid;
+	uint64		queryid;		/* hash of the remote SQL text */
+} DuckDBStatKey;
+
+typedef struct DuckDBStatEntry
+{
+	DuckDBStatKey key;
+	slock_t		mutex;			/* protects the counters below */
+	int64		calls;
+	double		total_time;		/* ms */
+	double		min_time;
+	double		max_time;
+	int64		rows;
+	double		convert_time;	/* ms */
+	int64		fallback_cells;
+	char		query[DUCKDB_STAT_QUERY_LEN];
+} DuckDBStatEntry;
+
+typedef struct DuckDBStatShared
+{
+	LWLock	   *lock;			/* protects the hash table */
+} DuckDBStatShared;
+
+static DuckDBStatShared *stat_shared = NULL;
+static HTAB *stat_hash = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size
+duckdb_stats_memsize(void)
+{
+	return add_size(MAXALIGN(sizeof(DuckDBStatShared)),
+					hash_estimate_size(duckdb_fdw_stat_statements_max,
+									   sizeof(DuckDBStatEntry)));
+}
+
+static void
+duckdb_stats_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+	RequestAddinShmemSpace(duckdb_stats_memsize());
+	RequestNamedLWLockTranche("duckdb_fdw stats", 1);
+}
+
+static void
+duckdb_stats_shmem_startup(void)
+{
+	bool		found;
+	HASHCTL		info;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	stat_shared = ShmemInitStruct("duckdb_fdw stats", sizeof(DuckDBStatShared), &found);
+	if (!found)
+		stat_shared->lock = &(GetNamedLWLockTranche("duckdb_fdw stats"))->lock;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(DuckDBStatKey);
+	info.entrysize = sizeof(DuckDBStatEntry);
+	stat_hash = ShmemInitHash("duckdb_fdw stat statements",
+							  duckdb_fdw_stat_statements_max,
+							  duckdb_fdw_stat_statements_max,
+							  &info,
+							  HASH_ELEM | HASH_BLOBS);
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Install the shared memory hooks.  Called from _PG_init; statistics are
+ * only collected when the library is preloaded.
+ */
+void
+duckdb_stats_init(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = duckdb_stats_shmem_request;
+#else
+	duckdb_stats_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = duckdb_stats_shmem_startup;
+}
+
+/*
+ * True when statements should be timed and recorded.
+ */
+bool
+duckdb_stats_enabled(void)
+{
+	return stat_hash != NULL && duckdb_fdw_track_statements;
+}
+
+/*
+ * True if the current user may read the remote SQL text recorded for
+ * userid, as pg_stat_statements decides for query text.
+ */
+bool
+duckdb_stats_visible(Oid userid)
+{
+	return userid == GetUserId() ||
+		has_privs_of_role(GetUserId(), ROLE_PG_READ_ALL_STATS);
+}
+
+static int
+duckdb_stats_cmp_calls(const void *a, const void *b)
+{
+	int64		ca = (*(DuckDBStatEntry *const *) a)->calls;
+	int64		cb = (*(DuckDBStatEntry *const *) b)->calls;
+
+	if (ca < cb)
+		return -1;
+	if (ca > cb)
+		return 1;
+	return 0;
+}
+
+/*
+ * Make room for new entries by dropping the least-called 5% of them.
+ * Caller holds the lock exclusively.
+ */
+static void
+duckdb_stats_dealloc(void)
+{
+	HASH_SEQ_STATUS seq;
+	DuckDBStatEntry **entries;
+	DuckDBStatEntry *entry;
+	long		n = hash_get_num_entries(stat_hash);
+	long		i = 0;
+	long		ndrop;
+
+	entries = palloc(n * sizeof(DuckDBStatEntry *));
+	hash_seq_init(&seq, stat_hash);
+	while ((entry = hash_seq_search(&seq)) != NULL)
+		entries[i++] = entry;
+
+	qsort(entries, i, sizeof(DuckDBStatEntry *), duckdb_stats_cmp_calls);
+	ndrop = Min(Max(10, i / 20), i);
+	while (ndrop-- > 0)
+		hash_search(stat_hash, &entries[ndrop]->key, HASH_REMOVE, NULL);
+
+	pfree(entries);
+}
+
+/*
+ * Add one observation of a remote statement.  Scans record each execution
+ * with calls = 1 as it happens, and the rows and conversion costs with
+ * calls = 0 once the scan ends; min/max only track observations with calls.
+ */
+void
+duckdb_stats_record(Oid serverid, const char *sql, int64 calls, double exec_ms,
+					int64 rows, double convert_ms, int64 fallback_cells)
+{
+	DuckDBStatKey key;
+	DuckDBStatEntry *entry;
+
+	if (!duckdb_stats_enabled() || sql == NULL)
+		return;
+
+	memset(&key, 0, sizeof(key));
+	key.userid = GetUserId();
+	key.dbid = MyDatabaseId;
+	key.serverid = serverid;
+	key.queryid = hash_bytes_extended((const unsigned char *) sql, strlen(sql), 0);
+
+	LWLockAcquire(stat_shared->lock, LW_SHARED);
+	entry = hash_search(stat_hash, &key, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		bool		found;
+		char	   *text = duckdb_fdw_redact_secret_text(sql);
+
+		LWLockRelease(stat_shared->lock);
+		LWLockAcquire(stat_shared->lock, LW_EXCLUSIVE);
+
+		if (hash_get_num_entries(stat_hash) >= duckdb_fdw_stat_statements_max)
+			duckdb_stats_dealloc();
+
+		entry = hash_search(stat_hash, &key, HASH_ENTER, &found);
+		if (!found)
+		{
+			SpinLockInit(&entry->mutex);
+			entry->calls = 0;
+			entry->total_time = 0;
+			entry->min_time = 0;
+			entry->max_time = 0;
+			entry->rows = 0;
+			entry->convert_time = 0;
+			entry->fallback_cells = 0;
+			strlcpy(entry->query, text, DUCKDB_STAT_QUERY_LEN);
+		}
+		pfree(text);
+	}
+
+	SpinLockAcquire(&entry->mutex);
+	if (calls > 0)
+	{
+		double		per_call = exec_ms / calls;
+
+		if (entry->calls == 0 || per_call < entry->min_time)
+			entry->min_time = per_call;
+		if (entry->calls == 0 || per_call > entry->max_time)
+			entry->max_time = per_call;
+	}
+	entry->calls += calls;
+	entry->total_time += exec_ms;
+	entry->rows += rows;
+	entry->convert_time += convert_ms;
+	entry->fallback_cells += fallback_cells;
+	SpinLockRelease(&entry->mutex);
+
+	LWLockRelease(stat_shared->lock);
+}
+
+static void
+duckdb_stats_require_shmem(void)
+{
+	if (stat_hash == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("duckdb_fdw statement statistics are not available"),
+				 errhint("Add duckdb_fdw to shared_preload_libraries.")));
+}
+
+PG_FUNCTION_INFO_V1(duckdb_fdw_stat_statements);
+Datum
+duckdb_fdw_stat_statements(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HASH_SEQ_STATUS seq;
+	DuckDBStatEntry *entry;
+
+	duckdb_stats_require_shmem();
+	InitMaterializedSRF(fcinfo, 0);
+
+	LWLockAcquire(stat_shared->lock, LW_SHARED);
+	hash_seq_init(&seq, stat_hash);
+	while ((entry = hash_seq_search(&seq)) != NULL)
+	{
+		Datum		values[DUCKDB_STAT_COLS];
+		bool		nulls[DUCKDB_STAT_COLS];
+		DuckDBStatEntry tmp;
+		int			i = 0;
+
+		SpinLockAcquire(&entry->mutex);
+		tmp = *entry;
+		SpinLockRelease(&entry->mutex);
+
+		memset(nulls, 0, sizeof(nulls));
+		values[i++] = ObjectIdGetDatum(tmp.key.userid);
+		values[i++] = ObjectIdGetDatum(tmp.key.dbid);
+		values[i++] = ObjectIdGetDatum(tmp.key.serverid);
+		if (duckdb_stats_visible(tmp.key.userid))
+		{
+			values[i++] = Int64GetDatum((int64) tmp.key.queryid);
+			values[i++] = CStringGetTextDatum(tmp.query);
+		}
+		else
+		{
+			nulls[i++] = true;
+			values[i++] = CStringGetTextDatum("<insufficient privilege>");
+		}
+		values[i++] = Int64GetDatum(tmp.calls);
+		values[i++] = Float8GetDatum(tmp.total_time);
+		values[i++] = Float8GetDatum(tmp.min_time);
+		values[i++] = Float8GetDatum(tmp.max_time);
+		values[i++] = Float8GetDatum(tmp.calls > 0 ? tmp.total_time / tmp.calls : 0);
+		values[i++] = Int64GetDatum(tmp.rows);
+		values[i++] = Float8GetDatum(tmp.convert_time);
+		values[i++] = Int64GetDatum(tmp.fallback_cells);
+		Assert(i == DUCKDB_STAT_COLS);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+	LWLockRelease(stat_shared->lock);
+
+	return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(duckdb_fdw_stat_statements_reset);
+Datum
+duckdb_fdw_stat_statements_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS seq;
+	DuckDBStatEntry *entry;
+
+	duckdb_stats_require_shmem();
+
+	LWLockAcquire(stat_shared->lock, LW_EXCLUSIVE);
+	hash_seq_init(&seq, stat_hash);
+	while ((entry = hash_seq_search(&seq)) != NULL)
+		hash_search(stat_hash, &entry->key, HASH_REMOVE, NULL);
+	LWLockRelease(stat_shared->lock);
+
+	PG_RETURN_VOID();
+}